@@ -0,0 +1,101 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+_Static_assert(offsetof(ArenaBlock, data) % ARENA_ALIGNMENT == 0,
+               "arena blocks must start their data aligned");
+
+static size_t align_size(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void init_arena(Arena *arena) {
+  arena->blocks = NULL;
+  arena->allocation_count = 0;
+  arena->bytes_requested = 0;
+  arena->bytes_reserved = 0;
+  arena->block_count = 0;
+}
+
+void free_arena(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  init_arena(arena);
+}
+
+static ArenaBlock *add_block(Arena *arena, size_t min_size) {
+  size_t capacity = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+  ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + capacity);
+  if (block == NULL) {
+    printf("ran out of memory when growing arena\n");
+    exit(1);
+  }
+  block->capacity = capacity;
+  block->used = 0;
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->bytes_reserved += capacity;
+  arena->block_count++;
+  return block;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size_t aligned = align_size(size);
+  ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->capacity - block->used < aligned) {
+    block = add_block(arena, aligned);
+  }
+
+  void *result = block->data + block->used;
+  block->used += aligned;
+  arena->allocation_count++;
+  arena->bytes_requested += size;
+  return result;
+}
+
+// grows an array in place when it is the most recent allocation, otherwise
+// copies it to a fresh region (the old space is reclaimed by free_arena)
+void *arena_grow_array(Arena *arena, void *array, size_t old_size,
+                       size_t new_size) {
+  ArenaBlock *block = arena->blocks;
+  if (array != NULL && block != NULL &&
+      (unsigned char *)array >= block->data &&
+      (unsigned char *)array < block->data + block->capacity) {
+    size_t offset = (unsigned char *)array - block->data;
+    if (offset + align_size(old_size) == block->used &&
+        offset + align_size(new_size) <= block->capacity) {
+      block->used = offset + align_size(new_size);
+      arena->bytes_requested += new_size - old_size;
+      return array;
+    }
+  }
+
+  void *result = arena_alloc(arena, new_size);
+  if (array != NULL) {
+    memcpy(result, array, old_size);
+  }
+  return result;
+}
+
+char *arena_copy_string(Arena *arena, const char *chars, size_t length) {
+  char *copy = (char *)arena_alloc(arena, length + 1);
+  memcpy(copy, chars, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+void print_arena_stats(Arena *arena, const char *name) {
+  fprintf(stderr,
+          "%s: %zu allocations, %zu bytes requested, %zu bytes peak (%zu "
+          "blocks)\n",
+          name, arena->allocation_count, arena->bytes_requested,
+          arena->bytes_reserved, arena->block_count);
+}
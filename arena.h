@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+// Region allocator used for everything that only lives for the duration of a
+// compilation (tokens, lexemes, chunk arrays under construction). Memory is
+// bump allocated out of large blocks and released all at once by free_arena.
+typedef struct ArenaBlock ArenaBlock;
+
+// every allocation starts on this boundary
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t capacity;
+  size_t used;
+  // aligned so allocations at aligned offsets into it are too
+  _Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+typedef struct {
+  ArenaBlock *blocks;
+  size_t allocation_count;
+  size_t bytes_requested;
+  size_t bytes_reserved;
+  size_t block_count;
+} Arena;
+
+void init_arena(Arena *arena);
+void free_arena(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_grow_array(Arena *arena, void *array, size_t old_size,
+                       size_t new_size);
+char *arena_copy_string(Arena *arena, const char *chars, size_t length);
+void print_arena_stats(Arena *arena, const char *name);
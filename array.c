@@ -0,0 +1,367 @@
+#include "array.h"
+#include "chunk.h"
+#include "cpu.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+#include <immintrin.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The bulk kernels have an AVX2 version picked at runtime and a scalar
+// fallback. Reductions keep 16 partial results (4 vectors of 4 lanes) and
+// combine them in a fixed order in both versions, so a script gets the same
+// sum on every machine.
+
+#define LANES 16
+
+typedef enum {
+  KERNEL_ADD,
+  KERNEL_SUBTRACT,
+  KERNEL_MULTIPLY,
+  KERNEL_DIVIDE,
+} Kernel;
+
+// cleared by use_array_simd(false)
+static int simd_enabled = 1;
+
+void use_array_simd(bool enabled) {
+  __atomic_store_n(&simd_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+static bool has_avx2(void) {
+  return __atomic_load_n(&simd_enabled, __ATOMIC_RELAXED) && cpu_has_avx2();
+}
+
+static inline double apply_kernel(Kernel kernel, double a, double b) {
+  switch (kernel) {
+  case KERNEL_ADD:
+    return a + b;
+  case KERNEL_SUBTRACT:
+    return a - b;
+  case KERNEL_MULTIPLY:
+    return a * b;
+  case KERNEL_DIVIDE:
+    return a / b;
+  }
+  return 0;
+}
+
+__attribute__((target("avx2"))) static inline __m256d
+apply_kernel_avx2(Kernel kernel, __m256d a, __m256d b) {
+  switch (kernel) {
+  case KERNEL_ADD:
+    return _mm256_add_pd(a, b);
+  case KERNEL_SUBTRACT:
+    return _mm256_sub_pd(a, b);
+  case KERNEL_MULTIPLY:
+    return _mm256_mul_pd(a, b);
+  case KERNEL_DIVIDE:
+    return _mm256_div_pd(a, b);
+  }
+  return a;
+}
+
+// out[i] = a[i] op b[i], a step of 0 repeats a single value (array op number)
+__attribute__((target("avx2"))) static void
+elementwise_avx2(Kernel kernel, const double *a, size_t a_step,
+                 const double *b, size_t b_step, double *out, size_t count) {
+  size_t i = 0;
+  __m256d a_splat = _mm256_set1_pd(a[0]);
+  __m256d b_splat = _mm256_set1_pd(b[0]);
+  for (; i + 4 <= count; i += 4) {
+    __m256d x = a_step ? _mm256_loadu_pd(a + i) : a_splat;
+    __m256d y = b_step ? _mm256_loadu_pd(b + i) : b_splat;
+    _mm256_storeu_pd(out + i, apply_kernel_avx2(kernel, x, y));
+  }
+  for (; i < count; i++)
+    out[i] = apply_kernel(kernel, a[i * a_step], b[i * b_step]);
+}
+
+static void elementwise_scalar(Kernel kernel, const double *a, size_t a_step,
+                               const double *b, size_t b_step, double *out,
+                               size_t count) {
+  for (size_t i = 0; i < count; i++)
+    out[i] = apply_kernel(kernel, a[i * a_step], b[i * b_step]);
+}
+
+// folds the partial results pairwise, the same way for both versions
+static double combine_lanes(double *lanes) {
+  for (size_t width = LANES / 2; width > 0; width /= 2) {
+    for (size_t i = 0; i < width; i++)
+      lanes[i] += lanes[i + width];
+  }
+  return lanes[0];
+}
+
+// sum of a[i] * b[i], or of a[i] when b is NULL
+__attribute__((target("avx2"))) static double
+sum_avx2(const double *a, const double *b, size_t count) {
+  __m256d sums[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(),
+                     _mm256_setzero_pd(), _mm256_setzero_pd()};
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) {
+    for (size_t v = 0; v < 4; v++) {
+      __m256d x = _mm256_loadu_pd(a + i + v * 4);
+      if (b != NULL)
+        x = _mm256_mul_pd(x, _mm256_loadu_pd(b + i + v * 4));
+      sums[v] = _mm256_add_pd(sums[v], x);
+    }
+  }
+  double lanes[LANES];
+  for (size_t v = 0; v < 4; v++)
+    _mm256_storeu_pd(lanes + v * 4, sums[v]);
+  for (size_t lane = 0; i < count; i++, lane++)
+    lanes[lane] += b != NULL ? a[i] * b[i] : a[i];
+  return combine_lanes(lanes);
+}
+
+static double sum_scalar(const double *a, const double *b, size_t count) {
+  double lanes[LANES] = {0};
+  size_t i = 0;
+  for (; i + LANES <= count; i += LANES) {
+    for (size_t lane = 0; lane < LANES; lane++)
+      lanes[lane] += b != NULL ? a[i + lane] * b[i + lane] : a[i + lane];
+  }
+  for (size_t lane = 0; i < count; i++, lane++)
+    lanes[lane] += b != NULL ? a[i] * b[i] : a[i];
+  return combine_lanes(lanes);
+}
+
+static double extreme_scalar(const double *a, size_t count, bool maximum);
+
+// smallest (or largest) of count > 0 values. A nan anywhere makes the result
+// nan: vminpd and vmaxpd would drop one depending on the operand it is in, so
+// nan lanes are tracked apart and the scalar version picks the result then
+__attribute__((target("avx2"))) static double
+extreme_avx2(const double *a, size_t count, bool maximum) {
+  size_t i = 0;
+  double result = a[0];
+  if (count >= 4) {
+    __m256d best = _mm256_loadu_pd(a);
+    __m256d nans = _mm256_cmp_pd(best, best, _CMP_UNORD_Q);
+    for (i = 4; i + 4 <= count; i += 4) {
+      __m256d x = _mm256_loadu_pd(a + i);
+      nans = _mm256_or_pd(nans, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+      best = maximum ? _mm256_max_pd(best, x) : _mm256_min_pd(best, x);
+    }
+    if (_mm256_movemask_pd(nans) != 0)
+      return extreme_scalar(a, count, maximum);
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    result = lanes[0];
+    for (size_t lane = 1; lane < 4; lane++) {
+      if (maximum ? lanes[lane] > result : lanes[lane] < result)
+        result = lanes[lane];
+    }
+  }
+  for (; i < count; i++) {
+    if (isnan(a[i]))
+      return a[i];
+    if (maximum ? a[i] > result : a[i] < result)
+      result = a[i];
+  }
+  return result;
+}
+
+// the first nan when there is one
+static double extreme_scalar(const double *a, size_t count, bool maximum) {
+  double result = a[0];
+  for (size_t i = 0; i < count; i++) {
+    if (isnan(a[i]))
+      return a[i];
+    if (maximum ? a[i] > result : a[i] < result)
+      result = a[i];
+  }
+  return result;
+}
+
+static void elementwise(Kernel kernel, const double *a, size_t a_step,
+                        const double *b, size_t b_step, double *out,
+                        size_t count) {
+  if (has_avx2()) {
+    elementwise_avx2(kernel, a, a_step, b, b_step, out, count);
+  } else {
+    elementwise_scalar(kernel, a, a_step, b, b_step, out, count);
+  }
+}
+
+static double sum(const double *a, const double *b, size_t count) {
+  return has_avx2() ? sum_avx2(a, b, count) : sum_scalar(a, b, count);
+}
+
+static double extreme(const double *a, size_t count, bool maximum) {
+  return has_avx2() ? extreme_avx2(a, count, maximum)
+                    : extreme_scalar(a, count, maximum);
+}
+
+void array_push(ObjArray *array, double value) {
+  if (array->count == array->capacity) {
+    array->capacity = get_new_array_capacity(array->capacity);
+    array->values = (double *)grow_array_size(
+        array->values, array->capacity * sizeof(double));
+    if (array->values == NULL) {
+      printf("ran out of memory when growing an array\n");
+      exit(1);
+    }
+  }
+  array->values[array->count++] = value;
+}
+
+// + - * / with an array on either side: element by element for two arrays of
+// the same length, against every element for an array and a number. Returns
+// false when the operands do not fit
+bool array_binary_operation(VM *vm, OpCode op, Value a, Value b,
+                            Value *result) {
+  Kernel kernel;
+  switch (op) {
+  case OP_ADD:
+    kernel = KERNEL_ADD;
+    break;
+  case OP_SUBTRACT:
+    kernel = KERNEL_SUBTRACT;
+    break;
+  case OP_MULTIPLY:
+    kernel = KERNEL_MULTIPLY;
+    break;
+  case OP_DIVIDE:
+    kernel = KERNEL_DIVIDE;
+    break;
+  default:
+    return false;
+  }
+
+  if (!(IS_ARRAY(a) && (IS_ARRAY(b) || IS_NUMERIC(b))) &&
+      !(IS_NUMERIC(a) && IS_ARRAY(b)))
+    return false;
+
+  if (IS_ARRAY(a))
+    lock_array(vm, AS_ARRAY(a), false);
+  if (IS_ARRAY(b))
+    lock_array(vm, AS_ARRAY(b), false);
+  size_t count = IS_ARRAY(a) ? AS_ARRAY(a)->count : AS_ARRAY(b)->count;
+  bool fits = !IS_ARRAY(a) || !IS_ARRAY(b) || AS_ARRAY(b)->count == count;
+  ObjArray *out = NULL;
+  if (fits) {
+    out = new_array(vm, count);
+    out->count = count;
+  }
+  if (fits && count > 0) {
+    // a scalar is broadcast from a single double
+    double left_scalar = IS_ARRAY(a) ? 0 : AS_DOUBLE(a);
+    double right_scalar = IS_ARRAY(b) ? 0 : AS_DOUBLE(b);
+    const double *left = IS_ARRAY(a) ? AS_ARRAY(a)->values : &left_scalar;
+    const double *right = IS_ARRAY(b) ? AS_ARRAY(b)->values : &right_scalar;
+    elementwise(kernel, left, IS_ARRAY(a), right, IS_ARRAY(b), out->values,
+                count);
+  }
+  if (IS_ARRAY(b))
+    unlock_array(vm, AS_ARRAY(b));
+  if (IS_ARRAY(a))
+    unlock_array(vm, AS_ARRAY(a));
+  if (!fits)
+    return false;
+  *result = OBJ_VAL(out);
+  return true;
+}
+
+static bool check_array(VM *vm, Task *task, Value value) {
+  if (!IS_ARRAY(value)) {
+    log_vm_error(vm, task, "expected an array\n");
+    return false;
+  }
+  return true;
+}
+
+// array(length) is length zeros
+NativeResult array_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result) {
+  if (!IS_NUMERIC(args[0]) || AS_DOUBLE(args[0]) < 0) {
+    log_vm_error(vm, task, "array length must be a non negative number\n");
+    return NATIVE_ERROR;
+  }
+  size_t count = (size_t)AS_DOUBLE(args[0]);
+  ObjArray *array = new_array(vm, count);
+  for (size_t i = 0; i < count; i++)
+    array->values[i] = 0;
+  array->count = count;
+  *result = OBJ_VAL(array);
+  return NATIVE_OK;
+}
+
+// push(array, number) appends and evaluates to the new length
+NativeResult push_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result) {
+  if (!check_array(vm, task, args[0]))
+    return NATIVE_ERROR;
+  if (!IS_NUMERIC(args[1])) {
+    log_vm_error(vm, task, "arrays can only hold numbers\n");
+    return NATIVE_ERROR;
+  }
+  ObjArray *array = AS_ARRAY(args[0]);
+  lock_array(vm, array, true);
+  array_push(array, AS_DOUBLE(args[1]));
+  *result = INT_VAL((int64_t)array->count);
+  unlock_array(vm, array);
+  return NATIVE_OK;
+}
+
+NativeResult sum_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result) {
+  if (!check_array(vm, task, args[0]))
+    return NATIVE_ERROR;
+  ObjArray *array = AS_ARRAY(args[0]);
+  lock_array(vm, array, false);
+  *result = NUMBER_VAL(sum(array->values, NULL, array->count));
+  unlock_array(vm, array);
+  return NATIVE_OK;
+}
+
+// min and max of an empty array are nil
+NativeResult min_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result) {
+  if (!check_array(vm, task, args[0]))
+    return NATIVE_ERROR;
+  ObjArray *array = AS_ARRAY(args[0]);
+  lock_array(vm, array, false);
+  *result = array->count == 0
+                ? NIL_VAL
+                : NUMBER_VAL(extreme(array->values, array->count, false));
+  unlock_array(vm, array);
+  return NATIVE_OK;
+}
+
+NativeResult max_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result) {
+  if (!check_array(vm, task, args[0]))
+    return NATIVE_ERROR;
+  ObjArray *array = AS_ARRAY(args[0]);
+  lock_array(vm, array, false);
+  *result = array->count == 0
+                ? NIL_VAL
+                : NUMBER_VAL(extreme(array->values, array->count, true));
+  unlock_array(vm, array);
+  return NATIVE_OK;
+}
+
+NativeResult dot_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result) {
+  if (!check_array(vm, task, args[0]) || !check_array(vm, task, args[1]))
+    return NATIVE_ERROR;
+  ObjArray *a = AS_ARRAY(args[0]);
+  ObjArray *b = AS_ARRAY(args[1]);
+  lock_array(vm, a, false);
+  lock_array(vm, b, false);
+  size_t count = a->count;
+  bool same_length = count == b->count;
+  if (same_length)
+    *result = NUMBER_VAL(sum(a->values, b->values, count));
+  unlock_array(vm, b);
+  unlock_array(vm, a);
+  if (!same_length) {
+    log_vm_error(vm, task, "dot needs arrays of the same length\n");
+    return NATIVE_ERROR;
+  }
+  return NATIVE_OK;
+}
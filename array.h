@@ -0,0 +1,48 @@
+#pragma once
+#include "chunk.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// push can move an array's values, so once a scheduler runs it takes the
+// array's lock exclusively while indexing and the bulk operations take it
+// shared. Writes to single elements share it too: they never move the
+// values, and two tasks writing one element leave one of the two values.
+// Before a scheduler runs the program is single threaded and the lock is
+// skipped
+static inline void lock_array(VM *vm, ObjArray *array, bool write) {
+  if (vm->scheduler == NULL)
+    return;
+  if (write) {
+    pthread_rwlock_wrlock(&array->lock);
+  } else {
+    pthread_rwlock_rdlock(&array->lock);
+  }
+}
+
+static inline void unlock_array(VM *vm, ObjArray *array) {
+  if (vm->scheduler != NULL)
+    pthread_rwlock_unlock(&array->lock);
+}
+
+// the kernels use AVX2 when the cpu has it, false forces the scalar fallback
+// (for benchmarks)
+void use_array_simd(bool enabled);
+void array_push(ObjArray *array, double value);
+bool array_binary_operation(VM *vm, OpCode op, Value a, Value b,
+                            Value *result);
+
+NativeResult array_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result);
+NativeResult push_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result);
+NativeResult sum_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result);
+NativeResult min_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result);
+NativeResult max_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result);
+NativeResult dot_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result);
@@ -0,0 +1,89 @@
+// Element-wise add, sum and dot product over arrays of numbers: written as a
+// script loop indexing one element per iteration, against the bulk operation
+// running as one instruction with the AVX2 kernels and with the scalar
+// fallback.
+//
+// usage: make bench && build/bench/bench_arrays [elements]
+#include "array.h"
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// setup fills a and b, body is timed minus the setup alone
+static double time_body(long elements, int repeats, const char *body) {
+  static const char *setup = "{\n"
+                             "  var a = array(%ld);\n"
+                             "  var b = array(%ld);\n"
+                             "  var c = array(%ld);\n"
+                             "  var total = 0;\n"
+                             "  var i = 0;\n"
+                             "  while (i < %ld) {\n"
+                             "    expr a[i] = i;\n"
+                             "    expr b[i] = i / 3;\n"
+                             "    expr i = i + 1;\n"
+                             "  }\n"
+                             "  var round = 0;\n"
+                             "  while (round < %d) {\n"
+                             "%s"
+                             "    expr round = round + 1;\n"
+                             "  }\n"
+                             "}\n";
+  char source[2048];
+  snprintf(source, sizeof(source), setup, elements, elements, elements,
+           elements, repeats, body);
+  double with_body = best_run(source, 3, NULL, NULL);
+  snprintf(source, sizeof(source), setup, elements, elements, elements,
+           elements, repeats, "");
+  return with_body - best_run(source, 3, NULL, NULL);
+}
+
+static void report(const char *name, const char *version, long elements,
+                   int repeats, double seconds) {
+  printf("%-8s %-12s %8.2f ns/element\n", name, version,
+         seconds * 1e9 / ((double)elements * repeats));
+}
+
+int main(int argc, char *argv[]) {
+  long elements = argc > 1 ? strtol(argv[1], NULL, 10) : 100000;
+  int loop_repeats = 5;
+  int bulk_repeats = 100;
+  printf("%ld elements\n", elements);
+
+  const char *loops[][2] = {
+      {"add", "    var j = 0;\n"
+              "    while (j < len(a)) {\n"
+              "      expr c[j] = a[j] + b[j];\n"
+              "      expr j = j + 1;\n"
+              "    }\n"},
+      {"sum", "    var j = 0;\n"
+              "    while (j < len(a)) {\n"
+              "      expr total = total + a[j];\n"
+              "      expr j = j + 1;\n"
+              "    }\n"},
+      {"dot", "    var j = 0;\n"
+              "    while (j < len(a)) {\n"
+              "      expr total = total + a[j] * b[j];\n"
+              "      expr j = j + 1;\n"
+              "    }\n"},
+  };
+  const char *bulk[] = {
+      "    expr c = a + b;\n",
+      "    expr total = sum(a);\n",
+      "    expr total = dot(a, b);\n",
+  };
+
+  for (size_t i = 0; i < 3; i++) {
+    const char *name = loops[i][0];
+    report(name, "script loop", elements, loop_repeats,
+           time_body(elements, loop_repeats, loops[i][1]));
+    use_array_simd(false);
+    report(name, "scalar", elements, bulk_repeats,
+           time_body(elements, bulk_repeats, bulk[i]));
+    use_array_simd(true);
+    report(name, "avx2", elements, bulk_repeats,
+           time_body(elements, bulk_repeats, bulk[i]));
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Building a long string a piece at a time: a script concatenating with +
+// and then flattening the result, against appending to a builder and calling
+// build once. Then the builder's append throughput from C for strings and
+// numbers.
+//
+// usage: make bench && build/bench/bench_builder [pieces]
+#include "bench_util.h"
+#include "builder.h"
+#include "chunk.h"
+#include "object.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+  long pieces = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+  char source[1024];
+  printf("%ld pieces\n", pieces);
+
+  // find flattens the concatenated rope
+  snprintf(source, sizeof(source),
+           "{\n"
+           "  var s = \"GET /api/items \";\n"
+           "  var i = 1;\n"
+           "  while (i < %ld) {\n"
+           "    expr s = s + \"GET /api/items \";\n"
+           "    expr i = i + 1;\n"
+           "  }\n"
+           "  expr find(s, \"missing\");\n"
+           "}\n",
+           pieces);
+  double concatenate = best_run(source, 3, NULL, NULL);
+  printf("script +        %8.1f ns/piece\n", concatenate * 1e9 / pieces);
+
+  snprintf(source, sizeof(source),
+           "{\n"
+           "  var b = builder();\n"
+           "  var i = 0;\n"
+           "  while (i < %ld) {\n"
+           "    expr append(b, \"GET /api/items \");\n"
+           "    expr i = i + 1;\n"
+           "  }\n"
+           "  expr find(build(b), \"missing\");\n"
+           "}\n",
+           pieces);
+  double build = best_run(source, 3, NULL, NULL);
+  printf("script builder  %8.1f ns/piece  %.2fx\n", build * 1e9 / pieces,
+         concatenate / build);
+
+  VM vm;
+  init_vm(&vm);
+  ObjBuilder *builder = new_builder(&vm);
+  Value piece = OBJ_VAL(copy_string(&vm, "GET /api/items ", 15));
+  double start = now_seconds();
+  for (long i = 0; i < pieces; i++)
+    builder_append(builder, piece);
+  double seconds = now_seconds() - start;
+  printf("append string   %8.1f ns/op  %8.1f MB/s\n", seconds * 1e9 / pieces,
+         builder->length / seconds / 1e6);
+
+  builder->length = 0;
+  start = now_seconds();
+  for (long i = 0; i < pieces; i++)
+    builder_append(builder, NUMBER_VAL((double)i));
+  seconds = now_seconds() - start;
+  printf("append number   %8.1f ns/op  %8.1f MB/s\n", seconds * 1e9 / pieces,
+         builder->length / seconds / 1e6);
+  free_vm(&vm);
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Function call cost: recursive fib, a loop calling a small function against
+// the same loop with the body written inline, and a loop written as tail
+// recursion against a while loop and against the same recursion without the
+// tail call (which nests a frame per step, so it runs in rounds of a bounded
+// depth).
+//
+// usage: make bench && build/bench/bench_calls [iterations]
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ROUND_DEPTH 10000
+
+static double time_source(const char *format, long iterations) {
+  char source[1024];
+  snprintf(source, sizeof(source), format, iterations);
+  return best_run(source, 3, NULL, NULL);
+}
+
+static void report(const char *name, long operations, double seconds) {
+  printf("%-24s %8.1f ns/iteration\n", name, seconds * 1e9 / operations);
+}
+
+// calls made by fib(n)
+static long fib_calls(long n) {
+  long a = 1, b = 1;
+  for (long i = 1; i < n; i++) {
+    long next = a + b + 1;
+    a = b;
+    b = next;
+  }
+  return b;
+}
+
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 2000000;
+  // whole rounds of the nested recursion, and at least one
+  iterations -= iterations % ROUND_DEPTH;
+  if (iterations < ROUND_DEPTH)
+    iterations = ROUND_DEPTH;
+  printf("%ld iterations\n", iterations);
+
+  static const char *fib = "fun fib(n) {\n"
+                           "  if (n < 2) return n;\n"
+                           "  return fib(n - 1) + fib(n - 2);\n"
+                           "}\n"
+                           "expr fib(%ld);\n";
+  long fib_n = 25;
+  report("fib (per call)", fib_calls(fib_n), time_source(fib, fib_n));
+
+  static const char *called = "fun step(x, y) { return x + y; }\n"
+                              "{\n"
+                              "  var total = 0;\n"
+                              "  var i = 0;\n"
+                              "  while (i < %ld) {\n"
+                              "    expr total = step(total, i);\n"
+                              "    expr i = i + 1;\n"
+                              "  }\n"
+                              "}\n";
+  static const char *inlined = "{\n"
+                               "  var total = 0;\n"
+                               "  var i = 0;\n"
+                               "  while (i < %ld) {\n"
+                               "    expr total = total + i;\n"
+                               "    expr i = i + 1;\n"
+                               "  }\n"
+                               "}\n";
+  report("loop calling step", iterations, time_source(called, iterations));
+  report("loop inline", iterations, time_source(inlined, iterations));
+
+  static const char *tail = "fun count(n, total) {\n"
+                            "  if (n == 0) return total;\n"
+                            "  return count(n - 1, total + n);\n"
+                            "}\n"
+                            "expr count(%ld, 0);\n";
+  static const char *loop = "{\n"
+                            "  var n = %ld;\n"
+                            "  var total = 0;\n"
+                            "  while (n > 0) {\n"
+                            "    expr total = total + n;\n"
+                            "    expr n = n - 1;\n"
+                            "  }\n"
+                            "}\n";
+  // the same recursion with the addition after the call, ROUND_DEPTH deep at
+  // a time
+  char nested[1024];
+  snprintf(nested, sizeof(nested),
+           "fun count(n) {\n"
+           "  if (n == 0) return 0;\n"
+           "  return n + count(n - 1);\n"
+           "}\n"
+           "{\n"
+           "  var rounds = %%ld / %d;\n"
+           "  while (rounds > 0) {\n"
+           "    expr count(%d);\n"
+           "    expr rounds = rounds - 1;\n"
+           "  }\n"
+           "}\n",
+           ROUND_DEPTH, ROUND_DEPTH);
+  report("tail recursion", iterations, time_source(tail, iterations));
+  report("while loop", iterations, time_source(loop, iterations));
+  report("nested recursion", iterations, time_source(nested, iterations));
+  return 0;
+}
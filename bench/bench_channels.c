@@ -0,0 +1,171 @@
+// Producer/consumer throughput through channels. First the ring itself from
+// plain threads, against the same bounded ring behind a mutex, then scripts
+// running on isolates that pass numbers and strings between heaps.
+//
+// usage: make bench && build/bench/bench_channels [messages]
+#include "bench_util.h"
+#include "channel.h"
+#include "chunk.h"
+#include "isolate.h"
+#include "object.h"
+#include "vm.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RING_CAPACITY 1024
+
+typedef struct {
+  pthread_mutex_t lock;
+  size_t head;
+  size_t count;
+  Value values[RING_CAPACITY];
+} LockedRing;
+
+static bool locked_send(LockedRing *ring, Value value) {
+  pthread_mutex_lock(&ring->lock);
+  bool sent = ring->count < RING_CAPACITY;
+  if (sent) {
+    ring->values[(ring->head + ring->count) % RING_CAPACITY] = value;
+    ring->count++;
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return sent;
+}
+
+static bool locked_receive(LockedRing *ring, Value *value) {
+  pthread_mutex_lock(&ring->lock);
+  bool received = ring->count > 0;
+  if (received) {
+    *value = ring->values[ring->head];
+    ring->head = (ring->head + 1) % RING_CAPACITY;
+    ring->count--;
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return received;
+}
+
+typedef struct {
+  Channel *channel;
+  LockedRing *ring;
+  long messages;
+  bool producer;
+} RingThread;
+
+static void *run_ring_thread(void *argument) {
+  RingThread *thread = (RingThread *)argument;
+  // numbers never touch a heap, the vm is only there to satisfy the api
+  VM vm;
+  init_vm(&vm);
+  Value value;
+  for (long i = 0; i < thread->messages; i++) {
+    if (thread->producer) {
+      while (thread->channel != NULL
+                 ? !channel_try_send(thread->channel, &vm, NUMBER_VAL(i))
+                 : !locked_send(thread->ring, NUMBER_VAL(i)))
+        sched_yield();
+    } else {
+      while (thread->channel != NULL
+                 ? !channel_try_receive(thread->channel, &vm, &value)
+                 : !locked_receive(thread->ring, &value))
+        sched_yield();
+    }
+  }
+  free_vm(&vm);
+  return NULL;
+}
+
+// pairs producers and as many consumers over one queue, returns messages/s
+static double ring_throughput(bool lock_free, size_t pairs, long messages) {
+  Channel *channel = lock_free ? create_channel(RING_CAPACITY) : NULL;
+  LockedRing ring;
+  pthread_mutex_init(&ring.lock, NULL);
+  ring.head = 0;
+  ring.count = 0;
+
+  RingThread *threads = malloc(pairs * 2 * sizeof(RingThread));
+  pthread_t *ids = malloc(pairs * 2 * sizeof(pthread_t));
+  double start = now_seconds();
+  for (size_t i = 0; i < pairs * 2; i++) {
+    threads[i] = (RingThread){channel, &ring, messages, i % 2 == 0};
+    pthread_create(&ids[i], NULL, run_ring_thread, &threads[i]);
+  }
+  for (size_t i = 0; i < pairs * 2; i++)
+    pthread_join(ids[i], NULL);
+  double seconds = now_seconds() - start;
+
+  free(threads);
+  free(ids);
+  pthread_mutex_destroy(&ring.lock);
+  if (channel != NULL)
+    release_channel(channel);
+  return pairs * messages / seconds;
+}
+
+// isolate 2k sends to channel k and isolate 2k + 1 receives from it
+static void setup_pair(VM *vm, size_t index, void *user_data) {
+  Channel **channels = (Channel **)user_data;
+  Channel *channel = channels[index / 2];
+  retain_channel(channel);
+  define_global(vm, "ch", OBJ_VAL(new_channel_object(vm, channel)));
+  define_global(vm, "producer", BOOL_VAL(index % 2 == 0));
+}
+
+static double script_throughput(const char *message, size_t pairs,
+                                long messages) {
+  char source[1024];
+  snprintf(source, sizeof(source),
+           "var n = 0;\n"
+           "if (producer) {\n"
+           "  while (n < %ld) {\n"
+           "    expr send(ch, %s);\n"
+           "    expr n = n + 1;\n"
+           "  }\n"
+           "} else {\n"
+           "  while (n < %ld) {\n"
+           "    expr receive(ch);\n"
+           "    expr n = n + 1;\n"
+           "  }\n"
+           "}\n",
+           messages, message, messages);
+
+  VM compiler;
+  Chunk chunk;
+  init_vm(&compiler);
+  compile_source(&compiler, source, &chunk);
+  freeze_chunk(&chunk, &compiler);
+
+  Channel **channels = malloc(pairs * sizeof(Channel *));
+  for (size_t i = 0; i < pairs; i++)
+    channels[i] = create_channel(RING_CAPACITY);
+  double start = now_seconds();
+  run_bench_isolates(&chunk, pairs * 2, setup_pair, channels);
+  double seconds = now_seconds() - start;
+
+  for (size_t i = 0; i < pairs; i++)
+    release_channel(channels[i]);
+  free(channels);
+  free_vm(&compiler);
+  free_chunk(&chunk);
+  return pairs * messages / seconds;
+}
+
+int main(int argc, char *argv[]) {
+  long messages = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+  printf("%ld messages per producer, capacity %d\n", messages, RING_CAPACITY);
+
+  for (size_t pairs = 1; pairs <= 4; pairs *= 2) {
+    printf("%zu pair(s) ring lock-free %10.0f msg/s  mutex %10.0f msg/s\n",
+           pairs, ring_throughput(true, pairs, messages),
+           ring_throughput(false, pairs, messages));
+  }
+
+  long script_messages = messages / 10;
+  for (size_t pairs = 1; pairs <= 4; pairs *= 2) {
+    printf("%zu pair(s) script numbers %10.0f msg/s  strings %10.0f msg/s\n",
+           pairs, script_throughput("n", pairs, script_messages),
+           script_throughput("\"message\"", pairs, script_messages));
+  }
+  return 0;
+}
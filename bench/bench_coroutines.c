@@ -0,0 +1,54 @@
+// Measures the cost of a resume/yield round trip: a loop pulling values out
+// of a coroutine against the same loop producing the values inline.
+//
+// usage: make bench && build/bench/bench_coroutines [resumes]
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+  long resumes = argc > 1 ? strtol(argv[1], NULL, 10) : 2000000;
+  char source[512];
+
+  snprintf(source, sizeof(source),
+           "var gen = coroutine {\n"
+           "  var i = 0;\n"
+           "  while (True) {\n"
+           "    yield i;\n"
+           "    expr i = i + 1;\n"
+           "  }\n"
+           "};\n"
+           "var n = 0;\n"
+           "var v = 0;\n"
+           "while (n < %ld) {\n"
+           "  expr v = resume gen;\n"
+           "  expr n = n + 1;\n"
+           "}\n",
+           resumes);
+  double coroutine = best_run(source, 5, NULL, NULL);
+
+  // the generator's work done in the consuming loop itself
+  snprintf(source, sizeof(source),
+           "var i = 0;\n"
+           "var n = 0;\n"
+           "var v = 0;\n"
+           "while (n < %ld) {\n"
+           "  if (True) {\n"
+           "    expr v = i;\n"
+           "    expr i = i + 1;\n"
+           "  }\n"
+           "  expr n = n + 1;\n"
+           "}\n",
+           resumes);
+  double inline_loop = best_run(source, 5, NULL, NULL);
+
+  printf("%ld resumes\n", resumes);
+  printf("coroutine loop   %8.1f ns/iteration\n", coroutine * 1e9 / resumes);
+  printf("inline loop      %8.1f ns/iteration\n",
+         inline_loop * 1e9 / resumes);
+  printf("resume + yield   %8.1f ns\n",
+         (coroutine - inline_loop) * 1e9 / resumes);
+  return 0;
+}
@@ -0,0 +1,122 @@
+// Insert, lookup and delete throughput for dictionaries of a million entries:
+// the table directly with number and string keys (growing from empty and
+// reserved up front with dict(n)), and the same operations from a script
+// through the indexing opcodes.
+//
+// usage: make bench && build/bench/bench_dict [entries]
+#include "bench_util.h"
+#include "chunk.h"
+#include "hash_map.h"
+#include "object.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void report(const char *name, const char *keys, size_t operations,
+                   double seconds) {
+  printf("%-20s %-8s %8.1f ns/op %8.2f M ops/s\n", name, keys,
+         seconds * 1e9 / operations, operations / seconds / 1e6);
+}
+
+static void run_table(const char *keys_name, Value *keys, Value *missing,
+                      size_t count) {
+  Table table;
+  Value value;
+  volatile size_t found = 0;
+  double start;
+
+  init_hash_map(&table);
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    insert_value_entry(&table, keys[i], NUMBER_VAL(i));
+  report("insert (growing)", keys_name, count, now_seconds() - start);
+  free_hash_map(&table);
+
+  init_hash_map(&table);
+  reserve_hash_map(&table, count);
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    insert_value_entry(&table, keys[i], NUMBER_VAL(i));
+  report("insert (reserved)", keys_name, count, now_seconds() - start);
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    found += get_value_entry(&table, keys[(i * 7919) % count], &value);
+  report("get (hit)", keys_name, count, now_seconds() - start);
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    found += get_value_entry(&table, missing[i], &value);
+  report("get (miss)", keys_name, count, now_seconds() - start);
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    found += delete_value_entry(&table, keys[i]);
+  report("delete", keys_name, count, now_seconds() - start);
+  free_hash_map(&table);
+}
+
+// fills a dictionary with count entries (when fill is set) and then runs
+// body once per key, timed minus the same program with an empty body
+static double time_script(size_t count, bool fill, const char *body) {
+  static const char *setup = "{\n"
+                             "  var d = dict(%zu);\n"
+                             "  var found = 0;\n"
+                             "  var i = 0;\n"
+                             "  while (i < %zu) {\n"
+                             "%s"
+                             "    expr i = i + 1;\n"
+                             "  }\n"
+                             "  expr i = 0;\n"
+                             "  while (i < %zu) {\n"
+                             "%s"
+                             "    expr i = i + 1;\n"
+                             "  }\n"
+                             "}\n";
+  const char *insert = fill ? "    expr d[i] = i;\n" : "";
+  char source[1024];
+  snprintf(source, sizeof(source), setup, count, count, insert, count, body);
+  double with_body = best_run(source, 1, NULL, NULL);
+  snprintf(source, sizeof(source), setup, count, count, insert, count, "");
+  return with_body - best_run(source, 1, NULL, NULL);
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  VM vm;
+  init_vm(&vm);
+  printf("%zu entries\n", count);
+
+  Value *keys = malloc(count * sizeof(Value));
+  Value *missing = malloc(count * sizeof(Value));
+  for (size_t i = 0; i < count; i++) {
+    keys[i] = NUMBER_VAL(i);
+    missing[i] = NUMBER_VAL(i + count);
+  }
+  run_table("number", keys, missing, count);
+
+  char buffer[32];
+  for (size_t i = 0; i < count; i++) {
+    int length = snprintf(buffer, sizeof(buffer), "key%zu", i);
+    keys[i] = OBJ_VAL(copy_string(&vm, buffer, length));
+    length = snprintf(buffer, sizeof(buffer), "missing%zu", i);
+    missing[i] = OBJ_VAL(copy_string(&vm, buffer, length));
+  }
+  run_table("string", keys, missing, count);
+
+  // the script times include the interpreter's loop and indexing overhead
+  report("script insert", "number", count,
+         time_script(count, false, "    expr d[i] = i;\n"));
+  report("script get (hit)", "number", count,
+         time_script(count, true, "    expr found = d[i];\n"));
+  report("script get (miss)", "number", count,
+         time_script(count, true, "    expr found = d[-1 - i];\n"));
+  report("script delete", "number", count,
+         time_script(count, true, "    expr delete(d, i);\n"));
+
+  free(keys);
+  free(missing);
+  free_vm(&vm);
+  return 0;
+}
@@ -0,0 +1,95 @@
+// The embedding api: the cost of a script calling a C function registered
+// with tl_define_native (against the same loop doing the addition inline),
+// and of running a small compiled program again and again on one vm. Only
+// uses tinylang.h, and the shared harness for timing.
+//
+// usage: make bench && build/bench/bench_embed [calls]
+#include "bench_util.h"
+#include "tinylang.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *add(TlVm *vm, int arg_count, const TlValue *args,
+                       TlValue *result, void *user_data) {
+  if (!tl_is_number(args[0]) || !tl_is_number(args[1]))
+    return "add takes two numbers";
+  *result = tl_number(tl_as_number(args[0]) + tl_as_number(args[1]));
+  return NULL;
+}
+
+// a program that does not compile ends the benchmark
+static TlProgram *compile_program(const char *source) {
+  TlProgram *program = tl_compile(source);
+  if (program == NULL) {
+    fprintf(stderr, "benchmark script failed to compile:\n%s", source);
+    exit(1);
+  }
+  return program;
+}
+
+static void run_program(TlVm *vm) {
+  if (tl_run(vm) != TL_OK) {
+    fprintf(stderr, "benchmark script failed\n");
+    exit(1);
+  }
+}
+
+static double time_loop(const char *body, long calls) {
+  char source[512];
+  snprintf(source, sizeof(source),
+           "var i = 0;\n"
+           "var x = 0;\n"
+           "while (i < n) {\n"
+           "  %s\n"
+           "  expr i = i + 1;\n"
+           "}\n",
+           body);
+  TlProgram *program = compile_program(source);
+  TlVm *vm = tl_create_vm(program);
+  tl_define_native(vm, "add", add, 2, NULL);
+  tl_set_global(vm, "n", tl_number((double)calls));
+
+  double best = 1e9;
+  for (int round = 0; round < 3; round++) {
+    double start = now_seconds();
+    run_program(vm);
+    double seconds = now_seconds() - start;
+    if (seconds < best)
+      best = seconds;
+  }
+  TlValue x;
+  if (!tl_get_global(vm, "x", &x) || tl_as_number(x) != (double)calls) {
+    printf("benchmark script computed the wrong result\n");
+    exit(1);
+  }
+  tl_free_vm(vm);
+  tl_free_program(program);
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  long calls = argc > 1 ? strtol(argv[1], NULL, 10) : 5000000;
+  printf("%ld calls\n", calls);
+  double inline_seconds = time_loop("expr x = i + 1;", calls);
+  double native_seconds = time_loop("expr x = add(i, 1);", calls);
+  printf("inline +      %6.1f ns/iteration\n", inline_seconds * 1e9 / calls);
+  printf("native add()  %6.1f ns/iteration, %5.1f ns per call\n",
+         native_seconds * 1e9 / calls,
+         (native_seconds - inline_seconds) * 1e9 / calls);
+
+  // compile once, run many times
+  TlProgram *program = compile_program("var total = seed * 2;");
+  TlVm *vm = tl_create_vm(program);
+  long runs = calls / 50;
+  double start = now_seconds();
+  for (long i = 0; i < runs; i++) {
+    tl_set_global(vm, "seed", tl_number((double)i));
+    run_program(vm);
+  }
+  double seconds = now_seconds() - start;
+  printf("tl_run        %6.2f us per run of a one line program\n",
+         seconds * 1e6 / runs);
+  tl_free_vm(vm);
+  tl_free_program(program);
+  return 0;
+}
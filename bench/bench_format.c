@@ -0,0 +1,53 @@
+// A six part log message built in a loop, as a chain of + and as one
+// interpolated string compiled to a single OP_FORMAT, with string parts only
+// (the most + can do) and with a number in it.
+//
+// usage: make bench && build/bench/bench_format [messages]
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// runs body once per message, timed minus the empty loop
+static double time_body(long messages, const char *body) {
+  static const char *setup = "{\n"
+                             "  var user = \"ada\";\n"
+                             "  var action = \"login\";\n"
+                             "  var path = \"/api/session\";\n"
+                             "  var message = \"-\";\n"
+                             "  var i = 0;\n"
+                             "  while (i < %ld) {\n"
+                             "%s"
+                             "    expr i = i + 1;\n"
+                             "  }\n"
+                             "}\n";
+  char source[1024];
+  snprintf(source, sizeof(source), setup, messages, body);
+  double with_body = best_run(source, 3, NULL, NULL);
+  snprintf(source, sizeof(source), setup, messages, "");
+  return with_body - best_run(source, 3, NULL, NULL);
+}
+
+static void report(const char *name, long messages, double seconds) {
+  printf("%-28s %8.1f ns/message\n", name, seconds * 1e9 / messages);
+}
+
+int main(int argc, char *argv[]) {
+  long messages = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+  printf("%ld messages\n", messages);
+
+  double concatenate = time_body(
+      messages, "    expr message = \"user=\" + user + \" action=\" + action "
+                "+ \" path=\" + path;\n");
+  report("strings with +", messages, concatenate);
+  double format = time_body(
+      messages,
+      "    expr message = \"user={user} action={action} path={path}\";\n");
+  report("strings interpolated", messages, format);
+  printf("%-28s %8.2fx\n", "speedup", concatenate / format);
+  report("with a number interpolated", messages,
+         time_body(messages, "    expr message = \"user={user} "
+                             "action={action} attempt={i}\";\n"));
+  return 0;
+}
@@ -0,0 +1,235 @@
+// Compares the swiss table in hash_map.c against the previous linear probing
+// table (reproduced below as legacy_*) on insert, lookup and delete mixes, and
+// measures the longest single insert, which is where a resize would stall.
+//
+// usage: make bench && build/bench/bench_hash_map [entries]
+#include "bench_util.h"
+#include "hash_map.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  ObjString *key;
+  Value value;
+} LegacyEntry;
+
+typedef struct {
+  size_t count;
+  size_t capacity;
+  LegacyEntry *entries;
+} LegacyTable;
+
+#define LEGACY_MAX_LOAD 0.75
+
+static bool legacy_is_tombstone(LegacyEntry *entry) {
+  return entry->key == NULL && IS_BOOL(entry->value) && AS_BOOL(entry->value);
+}
+
+static LegacyEntry *legacy_find_entry(LegacyEntry *entries, size_t capacity,
+                                      ObjString *key) {
+  size_t index = key->hash % capacity;
+  LegacyEntry *tombstone = NULL;
+  for (;;) {
+    LegacyEntry *entry = &entries[index];
+    if (entry->key == NULL) {
+      if (!legacy_is_tombstone(entry))
+        return tombstone != NULL ? tombstone : entry;
+      if (tombstone == NULL)
+        tombstone = entry;
+    } else if (memcmp(entry->key->chars, key->chars, key->length) == 0) {
+      return entry;
+    }
+    index = (index + 1) % capacity;
+  }
+}
+
+static void legacy_grow(LegacyTable *table) {
+  size_t capacity = table->capacity < 8 ? 8 : table->capacity * 2;
+  LegacyEntry *entries = malloc(capacity * sizeof(LegacyEntry));
+  for (size_t i = 0; i < capacity; i++) {
+    entries[i].key = NULL;
+    entries[i].value = NIL_VAL;
+  }
+  size_t count = 0;
+  for (size_t i = 0; i < table->capacity; i++) {
+    LegacyEntry *entry = &table->entries[i];
+    if (entry->key == NULL)
+      continue;
+    LegacyEntry *dest = legacy_find_entry(entries, capacity, entry->key);
+    *dest = *entry;
+    count++;
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+  table->count = count;
+}
+
+static void legacy_insert(LegacyTable *table, ObjString *key, Value value) {
+  if (table->count + 1 > table->capacity * LEGACY_MAX_LOAD)
+    legacy_grow(table);
+  LegacyEntry *entry = legacy_find_entry(table->entries, table->capacity, key);
+  if (entry->key == NULL && !legacy_is_tombstone(entry))
+    table->count++;
+  entry->key = key;
+  entry->value = value;
+}
+
+static bool legacy_get(LegacyTable *table, ObjString *key, Value *value) {
+  LegacyEntry *entry = legacy_find_entry(table->entries, table->capacity, key);
+  if (entry->key == NULL)
+    return false;
+  *value = entry->value;
+  return true;
+}
+
+static void legacy_delete(LegacyTable *table, ObjString *key) {
+  LegacyEntry *entry = legacy_find_entry(table->entries, table->capacity, key);
+  if (entry->key != NULL) {
+    entry->key = NULL;
+    entry->value = BOOL_VAL(true);
+  }
+}
+
+static void report(const char *name, const char *table, size_t operations,
+                   double seconds) {
+  printf("%-22s %-7s %8.1f ns/op\n", name, table, seconds * 1e9 / operations);
+}
+
+static void report_pauses(const char *table, double *pauses, size_t count) {
+  double max = 0;
+  double total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += pauses[i];
+    if (pauses[i] > max)
+      max = pauses[i];
+  }
+  printf("%-22s %-7s %8.1f ns/op %10.1f us max pause\n", "insert (timed each)",
+         table, total * 1e9 / count, max * 1e6);
+}
+
+static ObjString **make_keys(VM *vm, size_t count, const char *prefix) {
+  ObjString **keys = malloc(count * sizeof(ObjString *));
+  char buffer[32];
+  for (size_t i = 0; i < count; i++) {
+    // fixed width keys, the legacy table treats a prefix as a match
+    int length = snprintf(buffer, sizeof(buffer), "%s%010zu", prefix, i);
+    keys[i] = copy_string(vm, buffer, length);
+  }
+  return keys;
+}
+
+static void shuffle(ObjString **keys, size_t count) {
+  for (size_t i = count - 1; i > 0; i--) {
+    size_t j = (size_t)rand() % (i + 1);
+    ObjString *tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  VM vm;
+  init_vm(&vm);
+  srand(42);
+
+  ObjString **keys = make_keys(&vm, count, "key");
+  ObjString **missing = make_keys(&vm, count, "missing");
+  ObjString **lookups = malloc(count * sizeof(ObjString *));
+  memcpy(lookups, keys, count * sizeof(ObjString *));
+  shuffle(lookups, count);
+  printf("%zu entries\n", count);
+
+  Table table;
+  init_hash_map(&table);
+  LegacyTable legacy = {0, 0, NULL};
+  Value value;
+  volatile size_t found = 0;
+  double start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    insert_entry(&table, keys[i], NUMBER_VAL(i));
+  report("insert", "swiss", count, now_seconds() - start);
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    legacy_insert(&legacy, keys[i], NUMBER_VAL(i));
+  report("insert", "legacy", count, now_seconds() - start);
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    found += get_entry(&table, lookups[i], &value);
+  report("get (hit)", "swiss", count, now_seconds() - start);
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    found += legacy_get(&legacy, lookups[i], &value);
+  report("get (hit)", "legacy", count, now_seconds() - start);
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    found += get_entry(&table, missing[i], &value);
+  report("get (miss)", "swiss", count, now_seconds() - start);
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    found += legacy_get(&legacy, missing[i], &value);
+  report("get (miss)", "legacy", count, now_seconds() - start);
+
+  // steady state churn: delete one key and insert another, then look up
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++) {
+    delete_entry(&table, keys[i]);
+    insert_entry(&table, missing[i], NUMBER_VAL(i));
+    found += get_entry(&table, lookups[i], &value);
+  }
+  report("delete/insert/get", "swiss", count * 3, now_seconds() - start);
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++) {
+    legacy_delete(&legacy, keys[i]);
+    legacy_insert(&legacy, missing[i], NUMBER_VAL(i));
+    found += legacy_get(&legacy, lookups[i], &value);
+  }
+  report("delete/insert/get", "legacy", count * 3, now_seconds() - start);
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    delete_entry(&table, missing[i]);
+  report("delete", "swiss", count, now_seconds() - start);
+  start = now_seconds();
+  for (size_t i = 0; i < count; i++)
+    legacy_delete(&legacy, missing[i]);
+  report("delete", "legacy", count, now_seconds() - start);
+
+  free_hash_map(&table);
+  free(legacy.entries);
+
+  // time every insert individually to find the worst resize stall
+  double *pauses = malloc(count * sizeof(double));
+  init_hash_map(&table);
+  for (size_t i = 0; i < count; i++) {
+    start = now_seconds();
+    insert_entry(&table, keys[i], NUMBER_VAL(i));
+    pauses[i] = now_seconds() - start;
+  }
+  report_pauses("swiss", pauses, count);
+  legacy = (LegacyTable){0, 0, NULL};
+  for (size_t i = 0; i < count; i++) {
+    start = now_seconds();
+    legacy_insert(&legacy, keys[i], NUMBER_VAL(i));
+    pauses[i] = now_seconds() - start;
+  }
+  report_pauses("legacy", pauses, count);
+
+  free_hash_map(&table);
+  free(legacy.entries);
+  free(pauses);
+  free(keys);
+  free(missing);
+  free(lookups);
+  free_vm(&vm);
+  return 0;
+}
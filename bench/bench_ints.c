@@ -0,0 +1,51 @@
+// Integer-heavy loops run once with integer variables and once with the same
+// values as doubles (made by dividing by 1): test.tl's LCG, which uses * +
+// and %, a loop summing i % 7, and a plain counting loop.
+//
+// usage: make bench && build/bench/bench_ints [iterations]
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// runs body in a loop of n iterations, with every variable an integer or a
+// double
+static double time_body(long iterations, const char *body, bool doubles) {
+  static const char *setup = "{\n"
+                             "  var one = 1%s;\n"
+                             "  var seed = 42%s;\n"
+                             "  var a = 1664525%s;\n"
+                             "  var c = 1013904223%s;\n"
+                             "  var m = 4294967296%s;\n"
+                             "  var seven = 7%s;\n"
+                             "  var total = 0%s;\n"
+                             "  var i = 0%s;\n"
+                             "  var n = %ld%s;\n"
+                             "  while (i < n) {\n"
+                             "%s"
+                             "    expr i = i + one;\n"
+                             "  }\n"
+                             "}\n";
+  const char *s = doubles ? " / 1" : "";
+  char source[1024];
+  snprintf(source, sizeof(source), setup, s, s, s, s, s, s, s, s, iterations,
+           s, body);
+  return best_run(source, 3, NULL, NULL);
+}
+
+static void report(const char *name, long iterations, const char *body) {
+  double ints = time_body(iterations, body, false);
+  double doubles = time_body(iterations, body, true);
+  printf("%-10s %8.1f ns/iteration ints %8.1f doubles %6.2fx\n", name,
+         ints * 1e9 / iterations, doubles * 1e9 / iterations, doubles / ints);
+}
+
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 5000000;
+  printf("%ld iterations\n", iterations);
+  report("lcg", iterations, "    expr seed = (a * seed + c) % m;\n");
+  report("sum mod", iterations, "    expr total = total + i % seven;\n");
+  report("count", iterations, "");
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Task I/O through the event loop, io_uring against the epoll fallback. Pairs
+// of tasks play ping-pong over two pipes, so every message is a read that
+// parks a task until the other side writes; more pairs means more operations
+// in flight at once. Then tasks read a regular file in 4KB chunks.
+//
+// usage: make bench && build/bench/bench_io [rounds]
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define FILE_SIZE (4 * 1024 * 1024)
+#define FILE_PATH "/tmp/tinylang_bench_io.txt"
+
+static void set_backend(VM *vm, void *data) {
+  vm->io_backend = *(IoBackend *)data;
+}
+
+static double run_script(char *source, IoBackend backend) {
+  return best_run(source, 1, set_backend, &backend);
+}
+
+// messages/s over pairs ping-pong pairs
+static double ping_pong(IoBackend backend, long pairs, long rounds) {
+  char source[2048];
+  snprintf(source, sizeof(source),
+           "var p = 0;\n"
+           "while (p < %ld) {\n"
+           "  var a = pipe();\n"
+           "  var b = pipe();\n"
+           "  spawn {\n"
+           "    var n = 0;\n"
+           "    while (n < %ld) {\n"
+           "      expr write(pipe_writer(a), \"ping\");\n"
+           "      expr read(b, 16);\n"
+           "      expr n = n + 1;\n"
+           "    }\n"
+           "  }\n"
+           "  spawn {\n"
+           "    var n = 0;\n"
+           "    while (n < %ld) {\n"
+           "      expr read(a, 16);\n"
+           "      expr write(pipe_writer(b), \"pong\");\n"
+           "      expr n = n + 1;\n"
+           "    }\n"
+           "  }\n"
+           "  expr p = p + 1;\n"
+           "}\n",
+           pairs, rounds, rounds);
+  return pairs * rounds * 2 / run_script(source, backend);
+}
+
+// MB/s with readers tasks each reading the whole file
+static double file_read(IoBackend backend, long readers) {
+  char source[1024];
+  snprintf(source, sizeof(source),
+           "var r = 0;\n"
+           "while (r < %ld) {\n"
+           "  spawn {\n"
+           "    var f = open(\"%s\", \"r\");\n"
+           "    while (read(f, 4096) != nil) {\n"
+           "    }\n"
+           "    expr close(f);\n"
+           "  }\n"
+           "  expr r = r + 1;\n"
+           "}\n",
+           readers, FILE_PATH);
+  return readers * (FILE_SIZE / 1e6) / run_script(source, backend);
+}
+
+int main(int argc, char *argv[]) {
+  long rounds = argc > 1 ? strtol(argv[1], NULL, 10) : 2000;
+  FILE *file = fopen(FILE_PATH, "w");
+  for (long i = 0; i < FILE_SIZE; i++)
+    fputc('a' + i % 26, file);
+  fclose(file);
+
+  printf("%ld round trips per pair\n", rounds);
+  for (long pairs = 1; pairs <= 256; pairs *= 16) {
+    printf("%3ld pair(s) io_uring %10.0f msg/s  epoll %10.0f msg/s\n", pairs,
+           ping_pong(IO_BACKEND_URING, pairs, rounds / pairs + 1),
+           ping_pong(IO_BACKEND_EPOLL, pairs, rounds / pairs + 1));
+  }
+  for (long readers = 1; readers <= 16; readers *= 4) {
+    printf("%3ld reader(s) io_uring %8.1f MB/s  epoll %8.1f MB/s\n", readers,
+           file_read(IO_BACKEND_URING, readers),
+           file_read(IO_BACKEND_EPOLL, readers));
+  }
+  unlink(FILE_PATH);
+  return 0;
+}
@@ -0,0 +1,51 @@
+// Compiles one script, freezes it and runs it on 1..N isolates at once (N is
+// the number of online cores, at least 4) to show how throughput scales when
+// every vm is independent.
+//
+// usage: make bench && build/bench/bench_isolates [iterations]
+#include "bench_util.h"
+#include "chunk.h"
+#include "isolate.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 200000;
+  char source[512];
+  snprintf(source, sizeof(source),
+           "var seed = isolate + 15;\n"
+           "var count = 0;\n"
+           "while (count < %ld) {\n"
+           "    expr seed = (1664525 * seed + 1013904223) %% 4294967296;\n"
+           "    expr count = count + 1;\n"
+           "};\n",
+           iterations);
+
+  VM compiler;
+  Chunk chunk;
+  init_vm(&compiler);
+  compile_source(&compiler, source, &chunk);
+  freeze_chunk(&chunk, &compiler);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t max_isolates = cores > 4 ? cores : 4;
+  printf("%ld online cores, %ld loop iterations per isolate\n", cores,
+         iterations);
+
+  double single = 0;
+  for (size_t count = 1; count <= max_isolates; count++) {
+    double start = now_seconds();
+    run_bench_isolates(&chunk, count, NULL, NULL);
+    double seconds = now_seconds() - start;
+    if (count == 1)
+      single = seconds;
+    printf("%2zu isolates %8.3fs %8.2f runs/s  speedup %.2fx\n", count,
+           seconds, count / seconds, count * single / seconds);
+  }
+
+  free_vm(&compiler);
+  free_chunk(&chunk);
+  return 0;
+}
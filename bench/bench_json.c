@@ -0,0 +1,153 @@
+// parse_json and to_json on a corpus of json lines: the structural index
+// alone with AVX2 and with the scalar fallback, whole parses with each, and
+// writing the parsed values back. Without a file it generates log events.
+//
+// usage: make bench && build/bench/bench_json [file.jsonl | megabytes]
+#include "bench_util.h"
+#include "json.h"
+#include "object.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *make_events(size_t bytes, size_t *length) {
+  static const char *levels[] = {"info", "info", "info", "warn", "error"};
+  char *corpus = malloc(bytes + 512);
+  size_t written = 0;
+  size_t events = 0;
+  while (written < bytes) {
+    written += sprintf(
+        corpus + written,
+        "{\"time\":\"2024-05-01T12:%02zu:%02zu.%03zuZ\",\"level\":\"%s\","
+        "\"host\":\"web-%zu\",\"request\":{\"method\":\"GET\",\"path\":"
+        "\"/api/items/%zu\",\"status\":%d,\"latency_ms\":%zu.%zu},"
+        "\"tags\":[\"edge\",\"v%zu\"],\"sizes\":[%zu,%zu,%zu],"
+        "\"message\":\"served \\\"item %zu\\\" from cache\",\"cached\":%s}\n",
+        events / 60 % 60, events % 60, events % 1000, levels[events % 5],
+        events % 16, events * 7, events % 10 == 0 ? 500 : 200, events % 250,
+        events % 10, events % 3, events * 31 % 4096, events % 512,
+        events % 64, events, events % 3 == 0 ? "true" : "false");
+    events++;
+  }
+  *length = written;
+  return corpus;
+}
+
+static char *read_corpus(const char *path, size_t *length) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  *length = (size_t)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *corpus = malloc(*length + 1);
+  *length = fread(corpus, 1, *length, file);
+  fclose(file);
+  return corpus;
+}
+
+static void report(const char *name, const char *version, size_t bytes,
+                   double seconds) {
+  printf("%-10s %-8s %8.2f GB/s\n", name, version, bytes / seconds / 1e9);
+}
+
+static double best_index(const char *corpus, size_t length,
+                         uint32_t *positions) {
+  double best = 0;
+  for (int i = 0; i < 5; i++) {
+    double start = now_seconds();
+    json_index(corpus, length, positions);
+    double seconds = now_seconds() - start;
+    if (i == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+// parses every line into values, which needs a vm of its own per run since
+// nothing it allocates is freed before free_vm
+static double parse_lines(VM *vm, char *corpus, size_t length,
+                          Value *values, size_t *count) {
+  ObjString *owner = copy_string(vm, corpus, length);
+  double start = now_seconds();
+  *count = 0;
+  size_t offset = 0;
+  while (offset < length) {
+    char *end = memchr(owner->chars + offset, '\n', length - offset);
+    size_t line_end = end == NULL ? length : (size_t)(end - owner->chars);
+    ObjString *line = new_string_view(vm, (Obj *)owner,
+                                      owner->chars + offset, line_end - offset);
+    size_t error_offset;
+    const char *error = json_parse(vm, line, &values[*count], &error_offset);
+    if (error != NULL) {
+      printf("line %zu: %s at offset %zu\n", *count + 1, error, error_offset);
+      exit(1);
+    }
+    (*count)++;
+    offset = line_end + 1;
+  }
+  return now_seconds() - start;
+}
+
+int main(int argc, char *argv[]) {
+  size_t length;
+  char *corpus;
+  if (argc > 1 && strtoul(argv[1], NULL, 10) == 0) {
+    corpus = read_corpus(argv[1], &length);
+    if (corpus == NULL) {
+      printf("can not read %s\n", argv[1]);
+      return 1;
+    }
+    printf("%s, %.1f MB\n", argv[1], length / 1e6);
+  } else {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 32;
+    corpus = make_events(megabytes * 1024 * 1024, &length);
+    printf("%zu MB of generated json lines\n", megabytes);
+  }
+
+  uint32_t *positions = malloc((length + 1) * sizeof(uint32_t));
+  use_json_simd(true);
+  report("index", "avx2", length, best_index(corpus, length, positions));
+  use_json_simd(false);
+  report("index", "scalar", length, best_index(corpus, length, positions));
+  free(positions);
+
+  size_t lines = 1;
+  for (size_t i = 0; i < length; i++)
+    lines += corpus[i] == '\n';
+  Value *values = malloc(lines * sizeof(Value));
+  size_t count;
+  const char *versions[] = {"avx2", "scalar"};
+  for (int version = 0; version < 2; version++) {
+    use_json_simd(version == 0);
+    double parse_best = 0, serialize_best = 0;
+    size_t written = 0;
+    for (int run = 0; run < 3; run++) {
+      VM vm;
+      init_vm(&vm);
+      double seconds = parse_lines(&vm, corpus, length, values, &count);
+      if (run == 0 || seconds < parse_best)
+        parse_best = seconds;
+
+      // writes the parsed values back out
+      written = 0;
+      double start = now_seconds();
+      for (size_t i = 0; i < count; i++) {
+        ObjString *json;
+        json_serialize(&vm, values[i], &json);
+        written += json->length;
+      }
+      seconds = now_seconds() - start;
+      if (run == 0 || seconds < serialize_best)
+        serialize_best = seconds;
+      free_vm(&vm);
+    }
+    report("parse", versions[version], length, parse_best);
+    report("serialize", versions[version], written, serialize_best);
+  }
+  printf("%zu lines\n", count);
+  free(values);
+  free(corpus);
+  return 0;
+}
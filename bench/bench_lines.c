@@ -0,0 +1,101 @@
+// Scanning a log file line by line: next_line's views into a mapped file
+// against getline copying every line into an interned string, then a script
+// counting lines through the builtins.
+//
+// usage: make bench && build/bench/bench_lines [megabytes]
+#include "bench_util.h"
+#include "chunk.h"
+#include "lines.h"
+#include "object.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_PATH "/tmp/tinylang_bench_lines.log"
+
+static size_t write_log(size_t bytes) {
+  FILE *file = fopen(FILE_PATH, "w");
+  size_t written = 0;
+  size_t lines = 0;
+  while (written < bytes) {
+    int length = fprintf(file,
+                         "2024-05-01T12:%02zu:%02zu host%zu GET /api/items/%zu "
+                         "status=%d bytes=%zu\n",
+                         lines / 60 % 60, lines % 60, lines % 16, lines * 7,
+                         lines % 10 == 0 ? 500 : 200, lines * 31 % 4096);
+    written += length;
+    lines++;
+  }
+  fclose(file);
+  return lines;
+}
+
+static double scan_views(size_t *count) {
+  VM vm;
+  init_vm(&vm);
+  Value path = OBJ_VAL(copy_string(&vm, FILE_PATH, strlen(FILE_PATH)));
+  Value lines;
+  double start = now_seconds();
+  lines_native(&vm, NULL, 1, &path, &lines);
+  Value line;
+  *count = 0;
+  for (;;) {
+    next_line_native(&vm, NULL, 1, &lines, &line);
+    if (IS_NIL(line))
+      break;
+    (*count)++;
+  }
+  double seconds = now_seconds() - start;
+  free_vm(&vm);
+  return seconds;
+}
+
+static double scan_getline(size_t *count) {
+  VM vm;
+  init_vm(&vm);
+  double start = now_seconds();
+  FILE *file = fopen(FILE_PATH, "r");
+  char *buffer = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  *count = 0;
+  while ((length = getline(&buffer, &capacity, file)) > 0) {
+    copy_string(&vm, buffer, length - (buffer[length - 1] == '\n'));
+    (*count)++;
+  }
+  fclose(file);
+  free(buffer);
+  double seconds = now_seconds() - start;
+  free_vm(&vm);
+  return seconds;
+}
+
+static double scan_script(void) {
+  char source[] = "var it = lines(\"" FILE_PATH "\");\n"
+                  "var count = 0;\n"
+                  "while (next_line(it) != nil) {\n"
+                  "  expr count = count + 1;\n"
+                  "}\n";
+  return best_run(source, 1, NULL, NULL);
+}
+
+int main(int argc, char *argv[]) {
+  size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+  size_t lines = write_log(megabytes * 1024 * 1024);
+  printf("%zu MB, %zu lines (file in page cache)\n", megabytes, lines);
+
+  size_t count;
+  double seconds = scan_views(&count);
+  printf("%-16s %8.1f Mlines/s %8.1f MB/s\n", "mmap views", count / seconds / 1e6,
+         megabytes / seconds);
+  seconds = scan_getline(&count);
+  printf("%-16s %8.1f Mlines/s %8.1f MB/s\n", "getline + copy",
+         count / seconds / 1e6, megabytes / seconds);
+  seconds = scan_script();
+  printf("%-16s %8.1f Mlines/s %8.1f MB/s\n", "script", lines / seconds / 1e6,
+         megabytes / seconds);
+  unlink(FILE_PATH);
+  return 0;
+}
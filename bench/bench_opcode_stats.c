@@ -0,0 +1,58 @@
+// Cost of --opcode-stats: recursive fib and test.tl's LCG loop run with
+// counting off and on, reported per executed instruction (the count comes
+// from the counting run).
+//
+// usage: make bench && build/bench/bench_opcode_stats [iterations]
+#include "bench_util.h"
+#include "chunk.h"
+#include "opcode_stats.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// counts each run's instructions into a fresh OpcodeStats, so *stats ends
+// up holding the last run's
+static void count_opcodes(VM *vm, void *data) {
+  OpcodeStats **stats = (OpcodeStats **)data;
+  if (*stats != NULL)
+    free_opcode_stats(*stats);
+  *stats = create_opcode_stats();
+  vm->opcode_stats = *stats;
+}
+
+static void report(const char *name, const char *format, long iterations) {
+  char source[1024];
+  snprintf(source, sizeof(source), format, iterations);
+  OpcodeStats *stats = NULL;
+  double counted = best_run(source, 3, count_opcodes, &stats);
+  double plain = best_run(source, 3, NULL, NULL);
+  uint64_t instructions = 0;
+  for (int i = 0; i < OPCODE_COUNT; i++)
+    instructions += stats->counts[i];
+  free_opcode_stats(stats);
+  printf("%-6s %12llu instructions %6.2f ns off %6.2f ns on %6.2fx\n", name,
+         (unsigned long long)instructions, plain * 1e9 / instructions,
+         counted * 1e9 / instructions, counted / plain);
+}
+
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+  report("fib",
+         "fun fib(n) {\n"
+         "  if (n < 2) return n;\n"
+         "  return fib(n - 1) + fib(n - 2);\n"
+         "}\n"
+         "expr fib(%ld);\n",
+         25);
+  report("lcg",
+         "{\n"
+         "  var seed = 42;\n"
+         "  var i = 0;\n"
+         "  while (i < %ld) {\n"
+         "    expr seed = (1664525 * seed + 1013904223) %% 4294967296;\n"
+         "    expr i = i + 1;\n"
+         "  }\n"
+         "}\n",
+         iterations);
+  return 0;
+}
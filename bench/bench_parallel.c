@@ -0,0 +1,58 @@
+// Runs the same reduction over an index range as a sequential while loop and
+// as a parallel loop on 1..N workers (N is the number of online cores, at
+// least 4).
+//
+// usage: make bench && build/bench/bench_parallel [iterations]
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void set_workers(VM *vm, void *data) {
+  vm->worker_count = *(size_t *)data;
+}
+
+// the fastest of a few runs of source on workers threads
+static double time_workers(const char *source, size_t workers) {
+  return best_run(source, 3, set_workers, &workers);
+}
+
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 2000000;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t max_workers = cores > 4 ? cores : 4;
+  char source[1024];
+  printf("%ld online cores, %ld iterations\n", cores, iterations);
+
+  // both versions keep the loop state in locals
+  snprintf(source, sizeof(source),
+           "{\n"
+           "  var total = 0;\n"
+           "  var i = 0;\n"
+           "  while (i < %ld) {\n"
+           "    expr total = total + (i * 2654435761) %% 4294967296;\n"
+           "    expr i = i + 1;\n"
+           "  }\n"
+           "}\n",
+           iterations);
+  double sequential = time_workers(source, 1);
+  printf("sequential       %8.3fs\n", sequential);
+
+  snprintf(source, sizeof(source),
+           "{\n"
+           "  var total = 0;\n"
+           "  parallel (i = 0, %ld) reduce (+ total) {\n"
+           "    expr total = total + (i * 2654435761) %% 4294967296;\n"
+           "  }\n"
+           "}\n",
+           iterations);
+  for (size_t workers = 1; workers <= max_workers; workers++) {
+    double seconds = time_workers(source, workers);
+    printf("parallel %2zu %s %8.3fs  speedup %.2fx\n", workers,
+           workers == 1 ? "worker " : "workers", seconds,
+           sequential / seconds);
+  }
+  return 0;
+}
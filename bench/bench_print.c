@@ -0,0 +1,88 @@
+// Lines per second through print: the previous path (stdio printf of
+// "%.01f" and a separate "\n" per line, under flockfile) against the vm's
+// output buffer with shortest round trip formatting, for integers,
+// fractions and strings. Output goes to /dev/null.
+//
+// usage: make bench && build/bench/bench_print [lines]
+#include "bench_util.h"
+#include "format_number.h"
+#include "object.h"
+#include "output.h"
+#include "vm.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void legacy_print(Value value) {
+  flockfile(stdout);
+  if (IS_NUMBER(value)) {
+    printf("%.01f", AS_NUMBER(value));
+  } else {
+    printf("%s", AS_CSTRING(value));
+  }
+  printf("\n");
+  funlockfile(stdout);
+}
+
+static Value make_value(VM *vm, const char *kind, long i, ObjString *string) {
+  if (strcmp(kind, "integers") == 0)
+    return NUMBER_VAL((double)i);
+  if (strcmp(kind, "fractions") == 0)
+    return NUMBER_VAL(i / 7.0);
+  return OBJ_VAL(string);
+}
+
+static double legacy_lines(VM *vm, const char *kind, long lines,
+                           ObjString *string) {
+  double start = now_seconds();
+  for (long i = 0; i < lines; i++)
+    legacy_print(make_value(vm, kind, i, string));
+  fflush(stdout);
+  return lines / (now_seconds() - start);
+}
+
+static double buffered_lines(VM *vm, const char *kind, long lines,
+                             ObjString *string, FlushPolicy policy) {
+  OutputBuffer output;
+  init_output(&output, STDOUT_FILENO, policy);
+  double start = now_seconds();
+  for (long i = 0; i < lines; i++)
+    output_line(&output, make_value(vm, kind, i, string));
+  free_output(&output);
+  return lines / (now_seconds() - start);
+}
+
+int main(int argc, char *argv[]) {
+  long lines = argc > 1 ? strtol(argv[1], NULL, 10) : 2000000;
+  VM vm;
+  init_vm(&vm);
+  const char *text = "GET /api/items/42 status=200";
+  ObjString *string = copy_string(&vm, text, strlen(text));
+
+  // results go to the terminal, the lines themselves to /dev/null
+  int terminal = dup(STDOUT_FILENO);
+  FILE *report = fdopen(terminal, "w");
+  int null = open("/dev/null", O_WRONLY);
+  fflush(stdout);
+  dup2(null, STDOUT_FILENO);
+  setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+
+  fprintf(report, "%ld lines\n", lines);
+  const char *kinds[] = {"integers", "fractions", "strings"};
+  for (size_t i = 0; i < 3; i++) {
+    double legacy = legacy_lines(&vm, kinds[i], lines, string);
+    double full = buffered_lines(&vm, kinds[i], lines, string, FLUSH_FULL);
+    double line = buffered_lines(&vm, kinds[i], lines, string, FLUSH_LINE);
+    fprintf(report,
+            "%-10s stdio %6.1f M/s  buffered %6.1f M/s  line flush %6.1f "
+            "M/s\n",
+            kinds[i], legacy / 1e6, full / 1e6, line / 1e6);
+  }
+
+  fclose(report);
+  close(null);
+  free_vm(&vm);
+  return 0;
+}
@@ -0,0 +1,85 @@
+// Cost of --profile: recursive fib and test.tl's LCG loop run without a
+// profile, with one set but its timer not started (the cost of the sampling
+// copy of the run loop) and sampled at a rate.
+//
+// usage: make bench && build/bench/bench_profile [iterations] [rate]
+#include "bench_util.h"
+#include "chunk.h"
+#include "profiler.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// compiles and runs source, returning the fastest of a few runs. With a
+// profile given it is set on the vm, and sampled when rate is not 0. samples
+// is set to the samples of the last run
+static double time_profiled(const char *source, bool profiled, int rate,
+                            long *samples) {
+  double best = 0;
+  for (int i = 0; i < 3; i++) {
+    VM vm;
+    Chunk chunk;
+    init_vm(&vm);
+    compile_source(&vm, source, &chunk);
+    Profile *profile = NULL;
+    if (profiled) {
+      profile = create_profile(rate);
+      vm.profile = profile;
+    }
+
+    if (rate > 0)
+      start_profile(profile);
+    double seconds = time_interpret(&vm, &chunk);
+    if (rate > 0)
+      stop_profile(profile);
+    if (i == 0 || seconds < best)
+      best = seconds;
+    if (profile != NULL) {
+      *samples = 0;
+      for (size_t j = 0; j < profile->sample_count; j++)
+        *samples += profile->samples[j].weight;
+      free_profile(profile);
+    }
+    free_vm(&vm);
+    free_chunk(&chunk);
+  }
+  return best;
+}
+
+static void report(const char *name, const char *format, long iterations,
+                   int rate) {
+  char source[1024];
+  snprintf(source, sizeof(source), format, iterations);
+  long samples = 0;
+  double plain = time_profiled(source, false, 0, NULL);
+  double idle = time_profiled(source, true, 0, &samples);
+  double sampled = time_profiled(source, true, rate, &samples);
+  printf("%-6s %8.1f ms off %8.1f ms unsampled (%5.3fx) %8.1f ms sampled "
+         "(%5.3fx, %ld samples)\n",
+         name, plain * 1e3, idle * 1e3, idle / plain, sampled * 1e3,
+         sampled / plain, samples);
+}
+
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 5000000;
+  int rate = argc > 2 ? (int)strtol(argv[2], NULL, 10) : DEFAULT_PROFILE_RATE;
+  printf("%d Hz asked for\n", rate);
+  report("fib",
+         "fun fib(n) {\n"
+         "  if (n < 2) return n;\n"
+         "  return fib(n - 1) + fib(n - 2);\n"
+         "}\n"
+         "expr fib(%ld);\n",
+         27, rate);
+  report("lcg",
+         "{\n"
+         "  var seed = 42;\n"
+         "  var i = 0;\n"
+         "  while (i < %ld) {\n"
+         "    expr seed = (1664525 * seed + 1013904223) %% 4294967296;\n"
+         "    expr i = i + 1;\n"
+         "  }\n"
+         "}\n",
+         iterations, rate);
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Throughput and distribution of hash_string against the FNV-1a hash it
+// replaced, both the original (strlen in the loop condition) and a length
+// aware version.
+//
+// usage: make bench && build/bench/bench_string_hash
+#include "bench_util.h"
+#include "object.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_PRIME_32 16777619
+#define FNV_OFFSET_32 2166136261U
+
+static uint32_t fnv_strlen(const char *s, size_t length) {
+  uint32_t hash = FNV_OFFSET_32, i;
+  for (i = 0; i < strlen(s); i++) {
+    hash = hash ^ (s[i]);
+    hash = hash * FNV_PRIME_32;
+  }
+  return hash;
+}
+
+static uint32_t fnv_length(const char *s, size_t length) {
+  uint32_t hash = FNV_OFFSET_32;
+  for (size_t i = 0; i < length; i++) {
+    hash = hash ^ (s[i]);
+    hash = hash * FNV_PRIME_32;
+  }
+  return hash;
+}
+
+typedef uint32_t (*HashFn)(const char *chars, size_t length);
+
+typedef struct {
+  const char *name;
+  HashFn hash;
+  // the strlen version is quadratic, skip it on long keys
+  size_t max_length;
+} Hasher;
+
+static const Hasher hashers[] = {
+    {"fnv (strlen)", fnv_strlen, 1024},
+    {"fnv (length)", fnv_length, SIZE_MAX},
+    {"hash_string", hash_string, SIZE_MAX},
+};
+#define HASHER_COUNT (sizeof(hashers) / sizeof(hashers[0]))
+
+static void bench_throughput(const Hasher *hasher, size_t length) {
+  char *buffer = malloc(length + 1);
+  for (size_t i = 0; i < length; i++)
+    buffer[i] = 'a' + i % 26;
+  buffer[length] = '\0';
+
+  size_t iterations = 64 * 1024 * 1024 / (length + 16);
+  if (hasher->hash == fnv_strlen)
+    iterations /= length;
+  volatile uint32_t sink = 0;
+  double start = now_seconds();
+  for (size_t i = 0; i < iterations; i++) {
+    buffer[0] = 'a' + i % 26;
+    sink ^= hasher->hash(buffer, length);
+  }
+  double seconds = now_seconds() - start;
+
+  printf("%-14s %6zu bytes %9.1f ns/hash %9.1f MB/s\n", hasher->name, length,
+         seconds * 1e9 / iterations, length * iterations / seconds / 1e6);
+  free(buffer);
+}
+
+static int compare_hashes(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// hashes sequential identifiers like the ones scripts generate and reports
+// full 32 bit collisions and how evenly they fill the hash table's groups
+// (bits 7 and up) and control bytes (low 7 bits)
+static void bench_quality(const Hasher *hasher, size_t count) {
+  const size_t group_count = 1 << 16;
+  uint32_t *hashes = malloc(count * sizeof(uint32_t));
+  size_t *groups = calloc(group_count, sizeof(size_t));
+  size_t fragments[128] = {0};
+  char buffer[32];
+
+  for (size_t i = 0; i < count; i++) {
+    int length = snprintf(buffer, sizeof(buffer), "var%zu", i);
+    hashes[i] = hasher->hash(buffer, length);
+    groups[(hashes[i] >> 7) & (group_count - 1)]++;
+    fragments[hashes[i] & 0x7f]++;
+  }
+
+  qsort(hashes, count, sizeof(uint32_t), compare_hashes);
+  size_t collisions = 0;
+  for (size_t i = 1; i < count; i++)
+    collisions += hashes[i] == hashes[i - 1];
+
+  double expected = (double)count / group_count;
+  double chi_squared = 0;
+  size_t max_group = 0;
+  for (size_t i = 0; i < group_count; i++) {
+    double difference = groups[i] - expected;
+    chi_squared += difference * difference / expected;
+    if (groups[i] > max_group)
+      max_group = groups[i];
+  }
+  double fragment_expected = (double)count / 128;
+  double fragment_chi_squared = 0;
+  for (size_t i = 0; i < 128; i++) {
+    double difference = fragments[i] - fragment_expected;
+    fragment_chi_squared += difference * difference / fragment_expected;
+  }
+
+  // chi squared divided by degrees of freedom is ~1.0 for a uniform hash
+  printf("%-14s %zu keys: %zu collisions, groups chi2/df %.2f (max %zu, "
+         "mean %.1f), h2 chi2/df %.2f\n",
+         hasher->name, count, collisions, chi_squared / (group_count - 1),
+         max_group, expected, fragment_chi_squared / 127);
+  free(hashes);
+  free(groups);
+}
+
+int main(void) {
+  const size_t lengths[] = {4, 8, 16, 32, 64, 256, 1024, 65536};
+  for (size_t h = 0; h < HASHER_COUNT; h++) {
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+      if (lengths[i] <= hashers[h].max_length)
+        bench_throughput(&hashers[h], lengths[i]);
+    }
+  }
+  printf("\n");
+  for (size_t h = 0; h < HASHER_COUNT; h++)
+    bench_quality(&hashers[h], 1000000);
+  return 0;
+}
@@ -0,0 +1,125 @@
+// The string builtins on a large log-like string: find with the AVX2 first
+// and last byte filter against the scalar memchr fallback and glibc's memmem,
+// and split and substring returning views against copying every piece into
+// an interned string.
+//
+// usage: make bench && build/bench/bench_strings [megabytes]
+#define _GNU_SOURCE
+#include "bench_util.h"
+#include "object.h"
+#include "string_ops.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *make_log(size_t bytes, size_t *length) {
+  char *log = malloc(bytes + 256);
+  size_t written = 0;
+  size_t lines = 0;
+  while (written < bytes) {
+    written += sprintf(log + written,
+                       "2024-05-01T12:%02zu:%02zu host%zu GET /api/items/%zu "
+                       "status=%d bytes=%zu\n",
+                       lines / 60 % 60, lines % 60, lines % 16, lines * 7,
+                       lines % 10 == 0 ? 500 : 200, lines * 31 % 4096);
+    lines++;
+  }
+  // the only match is at the very end
+  written += sprintf(log + written, "status=503\n");
+  *length = written;
+  return log;
+}
+
+static void report(const char *name, const char *version, size_t bytes,
+                   double seconds) {
+  printf("%-10s %-8s %8.2f GB/s\n", name, version, bytes / seconds / 1e9);
+}
+
+static double best_find(const char *log, size_t length, const char *needle,
+                        bool use_memmem, long *found) {
+  double best = 0;
+  for (int i = 0; i < 5; i++) {
+    double start = now_seconds();
+    if (use_memmem) {
+      char *match = memmem(log, length, needle, strlen(needle));
+      *found = match == NULL ? -1 : match - log;
+    } else {
+      *found = find_bytes(log, length, needle, strlen(needle), 0);
+    }
+    double seconds = now_seconds() - start;
+    if (i == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+  size_t length;
+  char *log = make_log(megabytes * 1024 * 1024, &length);
+  printf("%zu MB of log lines\n", megabytes);
+
+  long found;
+  const char *needle = "status=503";
+  use_string_simd(true);
+  report("find", "avx2", length, best_find(log, length, needle, false, &found));
+  use_string_simd(false);
+  report("find", "scalar", length,
+         best_find(log, length, needle, false, &found));
+  use_string_simd(true);
+  report("find", "memmem", length,
+         best_find(log, length, needle, true, &found));
+
+  VM vm;
+  init_vm(&vm);
+  Value args[2];
+  args[0] = OBJ_VAL(copy_string(&vm, log, length));
+  args[1] = OBJ_VAL(copy_string(&vm, "\n", 1));
+  Value pieces;
+  double start = now_seconds();
+  split_native(&vm, NULL, 2, args, &pieces);
+  double seconds = now_seconds() - start;
+  size_t count = AS_DICT(pieces)->table.count;
+  report("split", "views", length, seconds);
+  printf("%-10s %-8s %8.1f ns/piece\n", "split", "views",
+         seconds * 1e9 / count);
+
+  // the same pieces copied, as split would have to without views
+  start = now_seconds();
+  ObjString *string = AS_STRING(args[0]);
+  size_t offset = 0;
+  for (size_t i = 0; i < count; i++) {
+    long end = find_bytes(string->chars, string->length, "\n", 1, offset);
+    if (end < 0)
+      end = string->length;
+    copy_string(&vm, string->chars + offset, end - offset);
+    offset = end + 1;
+  }
+  seconds = now_seconds() - start;
+  report("split", "copies", length, seconds);
+  printf("%-10s %-8s %8.1f ns/piece\n", "split", "copies",
+         seconds * 1e9 / count);
+
+  // substrings of a fixed width at every offset of the first megabyte
+  size_t substrings = 1000000;
+  Value range[3] = {args[0], NUMBER_VAL(0), NUMBER_VAL(0)};
+  Value result;
+  start = now_seconds();
+  for (size_t i = 0; i < substrings; i++) {
+    range[1] = NUMBER_VAL(i);
+    range[2] = NUMBER_VAL(i + 40);
+    substring_native(&vm, NULL, 3, range, &result);
+  }
+  printf("%-10s %-8s %8.1f ns/op\n", "substring", "views",
+         (now_seconds() - start) * 1e9 / substrings);
+  start = now_seconds();
+  for (size_t i = 0; i < substrings; i++)
+    copy_string(&vm, string->chars + i, 40);
+  printf("%-10s %-8s %8.1f ns/op\n", "substring", "copies",
+         (now_seconds() - start) * 1e9 / substrings);
+
+  free_vm(&vm);
+  free(log);
+  return 0;
+}
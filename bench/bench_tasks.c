@@ -0,0 +1,111 @@
+// Measures the task scheduler: the cost of a spawn, the cost of a task
+// switch (a yield at a loop back-edge and the requeue that follows) and how a
+// fixed amount of work split across tasks scales with the number of workers.
+//
+// usage: make bench && build/bench/bench_tasks [spawns]
+#include "bench_util.h"
+#include "chunk.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  size_t workers;
+  int yield_interval;
+} TaskSettings;
+
+static void set_up_tasks(VM *vm, void *data) {
+  TaskSettings *settings = (TaskSettings *)data;
+  vm->worker_count = settings->workers;
+  vm->task_yield_interval = settings->yield_interval;
+}
+
+// the fastest of a few runs of source on workers threads, yielding every
+// yield_interval back-edges
+static double time_tasks(const char *source, size_t workers,
+                         int yield_interval) {
+  TaskSettings settings = {workers, yield_interval};
+  return best_run(source, 5, set_up_tasks, &settings);
+}
+
+// tasks tasks each running iterations loop iterations
+static void work_source(char *source, size_t size, long tasks,
+                        long iterations) {
+  snprintf(source, size,
+           "var t = 0;\n"
+           "while (t < %ld) {\n"
+           "  spawn {\n"
+           "    var n = 0;\n"
+           "    var seed = t;\n"
+           "    while (n < %ld) {\n"
+           "      expr seed = (1664525 * seed + 1013904223) %% 4294967296;\n"
+           "      expr n = n + 1;\n"
+           "    }\n"
+           "  }\n"
+           "  expr t = t + 1;\n"
+           "}\n",
+           tasks, iterations);
+}
+
+int main(int argc, char *argv[]) {
+  long spawns = argc > 1 ? strtol(argv[1], NULL, 10) : 200000;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t max_workers = cores > 4 ? cores : 4;
+  char source[1024];
+  printf("%ld online cores\n", cores);
+
+  // an empty task body: the loop cost is measured without spawning and
+  // subtracted
+  snprintf(source, sizeof(source),
+           "var t = 0;\n"
+           "while (t < %ld) {\n"
+           "  spawn { }\n"
+           "  expr t = t + 1;\n"
+           "}\n",
+           spawns);
+  double spawning = time_tasks(source, 1, DEFAULT_TASK_YIELD_INTERVAL);
+  snprintf(source, sizeof(source),
+           "var t = 0;\n"
+           "while (t < %ld) {\n"
+           "  expr t = t + 1;\n"
+           "}\n",
+           spawns);
+  double looping = time_tasks(source, 1, DEFAULT_TASK_YIELD_INTERVAL);
+  printf("spawn + run empty task  %8.1f ns\n",
+         (spawning - looping) * 1e9 / spawns);
+
+  // the same loops with a yield at every back-edge and with no yields at all.
+  // The loop body does no arithmetic whose speed depends on the data, the
+  // interleaved run would otherwise benefit from repeating the same inputs
+  long tasks = 64;
+  long iterations = spawns / 16;
+  snprintf(source, sizeof(source),
+           "var t = 0;\n"
+           "while (t < %ld) {\n"
+           "  spawn {\n"
+           "    var n = 0;\n"
+           "    while (n < %ld) {\n"
+           "      expr n = n + 1;\n"
+           "    }\n"
+           "  }\n"
+           "  expr t = t + 1;\n"
+           "}\n",
+           tasks, iterations);
+  double no_switch = time_tasks(source, 1, 0);
+  double every_edge = time_tasks(source, 1, 1);
+  printf("task switch             %8.1f ns (%ld switches)\n",
+         (every_edge - no_switch) * 1e9 / (tasks * iterations),
+         tasks * iterations);
+
+  work_source(source, sizeof(source), tasks, iterations);
+  double single = 0;
+  for (size_t workers = 1; workers <= max_workers; workers++) {
+    double seconds = time_tasks(source, workers, DEFAULT_TASK_YIELD_INTERVAL);
+    if (workers == 1)
+      single = seconds;
+    printf("%2zu workers %8.3fs  speedup %.2fx\n", workers, seconds,
+           single / seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "bench_util.h"
+#include "arena.h"
+#include "lexer.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+double now_seconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+void compile_source(VM *vm, const char *source, Chunk *chunk) {
+  Arena arena;
+  init_chunk(chunk);
+  init_arena(&arena);
+  TokenList token_list = scan_tokens(&arena, (char *)source);
+  bool compiled = compile(vm, &arena, &token_list, chunk);
+  free_arena(&arena);
+  if (!compiled) {
+    fprintf(stderr, "benchmark script failed to compile:\n%s", source);
+    exit(1);
+  }
+}
+
+double time_interpret(VM *vm, Chunk *chunk) {
+  double start = now_seconds();
+  InterpretResponse response = interpret(vm, chunk);
+  double seconds = now_seconds() - start;
+  if (response != INTERPRET_OK) {
+    fprintf(stderr, "benchmark script failed\n");
+    exit(1);
+  }
+  return seconds;
+}
+
+void run_bench_isolates(Chunk *chunk, size_t count, IsolateSetup setup,
+                        void *user_data) {
+  InterpretResponse *results =
+      (InterpretResponse *)malloc(count * sizeof(InterpretResponse));
+  bool succeeded = results != NULL &&
+                   run_isolates(chunk, count, setup, user_data, results);
+  for (size_t i = 0; succeeded && i < count; i++)
+    succeeded = results[i] == INTERPRET_OK;
+  free(results);
+  if (!succeeded) {
+    fprintf(stderr, "benchmark script failed\n");
+    exit(1);
+  }
+}
+
+double best_run(const char *source, int runs, BenchSetup setup, void *data) {
+  double best = 0;
+  for (int i = 0; i < runs; i++) {
+    VM vm;
+    Chunk chunk;
+    init_vm(&vm);
+    if (setup != NULL)
+      setup(&vm, data);
+    compile_source(&vm, source, &chunk);
+    double seconds = time_interpret(&vm, &chunk);
+    if (i == 0 || seconds < best)
+      best = seconds;
+    free_vm(&vm);
+    free_chunk(&chunk);
+  }
+  return best;
+}
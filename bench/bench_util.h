@@ -0,0 +1,29 @@
+#pragma once
+#include "chunk.h"
+#include "isolate.h"
+#include "vm.h"
+
+// The timing harness every benchmark shares. A script that fails to compile
+// or raises a runtime error ends the benchmark with status 1, so a broken
+// script is never reported as a timing.
+
+// wall clock seconds, for timing a stretch of code
+double now_seconds(void);
+
+// initializes chunk and compiles source into it for vm
+void compile_source(VM *vm, const char *source, Chunk *chunk);
+
+// runs chunk on vm, returning the wall time it took
+double time_interpret(VM *vm, Chunk *chunk);
+
+// runs frozen chunk on count isolates like run_isolates
+void run_bench_isolates(Chunk *chunk, size_t count, IsolateSetup setup,
+                        void *user_data);
+
+// sets up a fresh vm before source is compiled for it, for the settings a
+// benchmark varies between runs
+typedef void (*BenchSetup)(VM *vm, void *data);
+
+// compiles and runs source on a fresh vm runs times and returns the fastest
+// run, the machine is shared with everything else. setup may be NULL
+double best_run(const char *source, int runs, BenchSetup setup, void *data);
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Times building a string one character at a time in a while loop. With
+# flat concatenation every step copies the whole string (O(n^2) total), with
+# ropes each step is O(1) and the string is flattened once at the end.
+#
+# usage: bench/string_concat.sh [path to interpreter]
+INTERPRETER=${1:-./interpreter}
+SCRIPT=$(mktemp /tmp/string_concat.XXXXXX.tl)
+
+for n in 10000 20000 40000 80000 160000; do
+  cat >"$SCRIPT" <<TL
+var s = "x";
+var i = 0;
+while (i < $n) {
+    expr s = s + "x";
+    expr i = i + 1;
+};
+print(s + "y" == s + "y");
+TL
+  start=$(date +%s.%N)
+  "$INTERPRETER" "$SCRIPT" >/dev/null
+  end=$(date +%s.%N)
+  awk -v n="$n" -v start="$start" -v end="$end" \
+    'BEGIN { printf "n=%-8d %.3fs\n", n, end - start }'
+done
+
+rm -f "$SCRIPT"
@@ -0,0 +1,183 @@
+#include "builder.h"
+#include "format_number.h"
+#include "memory.h"
+#include "object.h"
+#include "output.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// makes room for size more characters and the terminator, doubling the
+// buffer so n appends cost O(n) copies in total
+static char *reserve_builder(ObjBuilder *builder, size_t size) {
+  size_t needed = builder->length + size + 1;
+  if (needed > builder->capacity) {
+    size_t capacity = builder->capacity;
+    while (capacity < needed)
+      capacity = get_new_array_capacity(capacity);
+    builder->chars = (char *)grow_array_size(builder->chars, capacity);
+    if (builder->chars == NULL) {
+      printf("ran out of memory when growing a string builder\n");
+      exit(1);
+    }
+    builder->capacity = capacity;
+  }
+  return builder->chars + builder->length;
+}
+
+// arrays and dictionaries are written as print shows them, with their
+// elements. That text is built once by format_value_text, their contents can
+// change between measuring and writing
+static bool is_collection(Value value) {
+  return IS_ARRAY(value) || IS_DICT(value);
+}
+
+// the text append and format write for value: a string's own characters, or
+// text formatted into scratch (OBJECT_TEXT_SIZE bytes). chars is NULL for a
+// rope, whose characters are copied with copy_rope_chars. Not for collections
+static size_t value_text(Value value, char *scratch, const char **chars) {
+  if (IS_STRING(value)) {
+    *chars = AS_STRING(value)->chars;
+    return AS_STRING(value)->length;
+  }
+  if (IS_ROPE(value)) {
+    *chars = NULL;
+    return AS_ROPE(value)->length;
+  }
+  *chars = scratch;
+  if (IS_NUMBER(value))
+    return format_number(AS_NUMBER(value), scratch);
+  if (IS_INT(value))
+    return format_integer(AS_INT(value), scratch);
+  if (IS_BOOL(value))
+    return snprintf(scratch, OBJECT_TEXT_SIZE, "%s",
+                    AS_BOOL(value) ? "true" : "false");
+  if (IS_NIL(value))
+    return snprintf(scratch, OBJECT_TEXT_SIZE, "NULL");
+  return format_object(value, scratch, OBJECT_TEXT_SIZE);
+}
+
+static void write_text(Value value, const char *chars, size_t length,
+                       char *dest) {
+  if (chars == NULL) {
+    copy_rope_chars(AS_ROPE(value), dest);
+  } else {
+    memcpy(dest, chars, length);
+  }
+}
+
+// strings and ropes are copied straight from their characters and numbers
+// formatted on the stack, no intermediate string is created
+void builder_append(ObjBuilder *builder, Value value) {
+  char scratch[OBJECT_TEXT_SIZE];
+  const char *chars;
+  char *collection = NULL;
+  size_t length;
+  if (is_collection(value)) {
+    collection = format_value_text(value, &length);
+    chars = collection;
+  } else {
+    length = value_text(value, scratch, &chars);
+  }
+  write_text(value, chars, length, reserve_builder(builder, length));
+  builder->length += length;
+  free(collection);
+}
+
+// the text of count values joined into one string. The total length is
+// computed first so the characters are allocated once
+Value format_values(VM *vm, Value *values, int count) {
+  char scratch[OBJECT_TEXT_SIZE];
+  const char *chars;
+  // the text of each collection, indexed like values. Only allocated when
+  // there is one
+  char **collections = NULL;
+  size_t *collection_lengths = NULL;
+  size_t length = 0;
+  for (int i = 0; i < count; i++) {
+    if (!is_collection(values[i])) {
+      length += value_text(values[i], scratch, &chars);
+      continue;
+    }
+    if (collections == NULL) {
+      collections = (char **)calloc(count, sizeof(char *));
+      collection_lengths = (size_t *)calloc(count, sizeof(size_t));
+      if (collections == NULL || collection_lengths == NULL) {
+        printf("ran out of memory when formatting a string\n");
+        exit(1);
+      }
+    }
+    collections[i] = format_value_text(values[i], &collection_lengths[i]);
+    length += collection_lengths[i];
+  }
+
+  char *text = (char *)malloc(length + 1);
+  if (text == NULL) {
+    printf("ran out of memory when formatting a string\n");
+    exit(1);
+  }
+  char *cursor = text;
+  for (int i = 0; i < count; i++) {
+    size_t part;
+    if (is_collection(values[i])) {
+      part = collection_lengths[i];
+      chars = collections[i];
+    } else {
+      part = value_text(values[i], scratch, &chars);
+    }
+    write_text(values[i], chars, part, cursor);
+    cursor += part;
+  }
+  text[length] = '\0';
+  if (collections != NULL) {
+    for (int i = 0; i < count; i++)
+      free(collections[i]);
+    free(collections);
+    free(collection_lengths);
+  }
+  return OBJ_VAL(take_string(vm, text, length));
+}
+
+NativeResult builder_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result) {
+  *result = OBJ_VAL(new_builder(vm));
+  return NATIVE_OK;
+}
+
+// append(builder, value) adds value's text and evaluates to the builder
+NativeResult append_native(VM *vm, Task *task, int arg_count, Value *args,
+                           Value *result) {
+  if (!IS_BUILDER(args[0])) {
+    log_vm_error(vm, task, "append expects a builder\n");
+    return NATIVE_ERROR;
+  }
+  ObjBuilder *builder = AS_BUILDER(args[0]);
+  lock_builder(vm, builder);
+  builder_append(builder, args[1]);
+  unlock_builder(vm, builder);
+  *result = args[0];
+  return NATIVE_OK;
+}
+
+// build(builder) is the text appended so far. The buffer becomes the
+// string's characters without being copied and the builder starts over empty
+NativeResult build_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result) {
+  if (!IS_BUILDER(args[0])) {
+    log_vm_error(vm, task, "build expects a builder\n");
+    return NATIVE_ERROR;
+  }
+  ObjBuilder *builder = AS_BUILDER(args[0]);
+  lock_builder(vm, builder);
+  reserve_builder(builder, 0);
+  builder->chars[builder->length] = '\0';
+  char *chars = builder->chars;
+  size_t length = builder->length;
+  builder->chars = NULL;
+  builder->length = 0;
+  builder->capacity = 0;
+  unlock_builder(vm, builder);
+  *result = OBJ_VAL(take_string(vm, chars, length));
+  return NATIVE_OK;
+}
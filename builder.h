@@ -0,0 +1,28 @@
+#pragma once
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <pthread.h>
+
+// append and build move a builder's buffer, so once a scheduler runs they and
+// len hold the builder's lock. Before that the program is single threaded and
+// the lock is skipped
+static inline void lock_builder(VM *vm, ObjBuilder *builder) {
+  if (vm->scheduler != NULL)
+    pthread_mutex_lock(&builder->lock);
+}
+
+static inline void unlock_builder(VM *vm, ObjBuilder *builder) {
+  if (vm->scheduler != NULL)
+    pthread_mutex_unlock(&builder->lock);
+}
+
+void builder_append(ObjBuilder *builder, Value value);
+Value format_values(VM *vm, Value *values, int count);
+
+NativeResult builder_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result);
+NativeResult append_native(VM *vm, Task *task, int arg_count, Value *args,
+                           Value *result);
+NativeResult build_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result);
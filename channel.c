@@ -0,0 +1,242 @@
+#include "channel.h"
+#include "object.h"
+#include "scheduler.h"
+#include "value.h"
+#include "vm.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// capacity is rounded up to a power of two (at least 2), it is at most
+// CHANNEL_MAX_CAPACITY
+Channel *create_channel(size_t capacity) {
+  size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+
+  Channel *channel = (Channel *)aligned_alloc(
+      CHANNEL_CACHE_LINE,
+      (sizeof(Channel) + CHANNEL_CACHE_LINE - 1) & ~(CHANNEL_CACHE_LINE - 1));
+  ChannelCell *cells = (ChannelCell *)malloc(size * sizeof(ChannelCell));
+  if (channel == NULL || cells == NULL) {
+    printf("ran out of memory when creating a channel\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < size; i++) {
+    atomic_init(&cells[i].sequence, i);
+  }
+  atomic_init(&channel->references, 1);
+  channel->mask = size - 1;
+  channel->cells = cells;
+  atomic_init(&channel->send_position, 0);
+  atomic_init(&channel->receive_position, 0);
+  return channel;
+}
+
+void retain_channel(Channel *channel) {
+  atomic_fetch_add_explicit(&channel->references, 1, memory_order_relaxed);
+}
+
+static void free_message(ChannelMessage *message) {
+  free(message->chars);
+  if (message->channel != NULL)
+    release_channel(message->channel);
+}
+
+void release_channel(Channel *channel) {
+  if (atomic_fetch_sub_explicit(&channel->references, 1,
+                                memory_order_acq_rel) != 1)
+    return;
+
+  // messages nobody received still own their payloads
+  size_t position = atomic_load(&channel->receive_position);
+  size_t end = atomic_load(&channel->send_position);
+  for (; position != end; position++) {
+    free_message(&channel->cells[position & channel->mask].message);
+  }
+  free(channel->cells);
+  free(channel);
+}
+
+// numbers, booleans, nil, strings and channels can cross between vms,
+// anything else (coroutines, natives) belongs to the sender's heap
+bool is_sendable_value(Value value) {
+  if (!IS_OBJ(value))
+    return true;
+  return is_string_value(value) || IS_CHANNEL(value);
+}
+
+static ChannelMessage pack_message(VM *vm, Value value) {
+  ChannelMessage message = {value, NULL, 0, NULL};
+  if (is_string_value(value)) {
+    ObjString *string = flatten_string(vm, value);
+    message.chars = (char *)malloc(string->length + 1);
+    if (message.chars == NULL) {
+      printf("ran out of memory when sending a string\n");
+      exit(1);
+    }
+    memcpy(message.chars, string->chars, string->length);
+    message.chars[string->length] = '\0';
+    message.length = string->length;
+  } else if (IS_CHANNEL(value)) {
+    message.channel = AS_CHANNEL(value)->channel;
+    retain_channel(message.channel);
+  }
+  return message;
+}
+
+// the receiving vm takes ownership of the message's payload
+static Value unpack_message(VM *vm, ChannelMessage *message) {
+  if (message->chars != NULL)
+    return OBJ_VAL(take_string(vm, message->chars, message->length));
+  if (message->channel != NULL)
+    return OBJ_VAL(new_channel_object(vm, message->channel));
+  return message->value;
+}
+
+// returns false without blocking when the channel is full. value must be
+// sendable
+bool channel_try_send(Channel *channel, VM *vm, Value value) {
+  size_t position =
+      atomic_load_explicit(&channel->send_position, memory_order_relaxed);
+  ChannelCell *cell;
+  for (;;) {
+    cell = &channel->cells[position & channel->mask];
+    size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &channel->send_position, &position, position + 1,
+              memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      return false;
+    } else {
+      position =
+          atomic_load_explicit(&channel->send_position, memory_order_relaxed);
+    }
+  }
+
+  cell->message = pack_message(vm, value);
+  atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+  return true;
+}
+
+// returns false without blocking when the channel is empty
+bool channel_try_receive(Channel *channel, VM *vm, Value *value) {
+  size_t position =
+      atomic_load_explicit(&channel->receive_position, memory_order_relaxed);
+  ChannelCell *cell;
+  for (;;) {
+    cell = &channel->cells[position & channel->mask];
+    size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &channel->receive_position, &position, position + 1,
+              memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      return false;
+    } else {
+      position = atomic_load_explicit(&channel->receive_position,
+                                      memory_order_relaxed);
+    }
+  }
+
+  // copy the message out and free the cell before building the value, the
+  // sender does not have to wait on the receiver's heap
+  ChannelMessage message = cell->message;
+  atomic_store_explicit(&cell->sequence, position + channel->mask + 1,
+                        memory_order_release);
+  *value = unpack_message(vm, &message);
+  return true;
+}
+
+// channel(capacity)
+NativeResult channel_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result) {
+  // checked as a double so the cast below is defined, integers up to the
+  // limit convert exactly
+  double capacity = IS_NUMERIC(args[0]) ? AS_DOUBLE(args[0]) : 0;
+  if (!(capacity >= 1 && capacity <= CHANNEL_MAX_CAPACITY) ||
+      capacity != floor(capacity)) {
+    log_vm_error(vm, task, "channel capacity must be an integer from 1 to "
+                           "16777216\n");
+    return NATIVE_ERROR;
+  }
+  Channel *channel = create_channel((size_t)capacity);
+  *result = OBJ_VAL(new_channel_object(vm, channel));
+  return NATIVE_OK;
+}
+
+// whether anything but the calling task could still send to or receive from
+// channel: a spawned task of this vm (the caller counts itself when it is one)
+// or another vm holding a reference
+static bool can_unblock(VM *vm, Channel *channel) {
+  return atomic_load(&channel->references) > 1 ||
+         (vm->scheduler != NULL &&
+          atomic_load(&vm->scheduler->live_tasks) > 0);
+}
+
+// send(channel, value) waits while the channel is full
+NativeResult send_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result) {
+  if (!IS_CHANNEL(args[0])) {
+    log_vm_error(vm, task, "can only send to a channel\n");
+    return NATIVE_ERROR;
+  }
+  if (!is_sendable_value(args[1])) {
+    log_vm_error(vm, task, "value cannot be sent over a channel\n");
+    return NATIVE_ERROR;
+  }
+  Channel *channel = AS_CHANNEL(args[0])->channel;
+  if (!channel_try_send(channel, vm, args[1])) {
+    if (can_unblock(vm, channel))
+      return NATIVE_BLOCKED;
+    // a task that finished after the first try may have made room
+    if (!channel_try_send(channel, vm, args[1])) {
+      log_vm_error(vm, task, "deadlock: send on a full channel that "
+                             "nothing else receives from\n");
+      return NATIVE_ERROR;
+    }
+  }
+  *result = NIL_VAL;
+  return NATIVE_OK;
+}
+
+// receive(channel) waits while the channel is empty
+NativeResult receive_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result) {
+  if (!IS_CHANNEL(args[0])) {
+    log_vm_error(vm, task, "can only receive from a channel\n");
+    return NATIVE_ERROR;
+  }
+  Channel *channel = AS_CHANNEL(args[0])->channel;
+  if (!channel_try_receive(channel, vm, result)) {
+    if (can_unblock(vm, channel))
+      return NATIVE_BLOCKED;
+    if (!channel_try_receive(channel, vm, result)) {
+      log_vm_error(vm, task, "deadlock: receive on an empty channel that "
+                             "nothing else sends to\n");
+      return NATIVE_ERROR;
+    }
+  }
+  return NATIVE_OK;
+}
+
+// try_receive(channel) evaluates to nil instead of waiting
+NativeResult try_receive_native(VM *vm, Task *task, int arg_count, Value *args,
+                                Value *result) {
+  if (!IS_CHANNEL(args[0])) {
+    log_vm_error(vm, task, "can only receive from a channel\n");
+    return NATIVE_ERROR;
+  }
+  if (!channel_try_receive(AS_CHANNEL(args[0])->channel, vm, result))
+    *result = NIL_VAL;
+  return NATIVE_OK;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A value in transit. Nothing in it points into the sending vm's heap:
+// strings travel as their own copy of the characters and channels as a
+// reference, both handed over to the receiving vm.
+typedef struct {
+  Value value;
+  char *chars;
+  int length;
+  Channel *channel;
+} ChannelMessage;
+
+typedef struct {
+  atomic_size_t sequence;
+  ChannelMessage message;
+} ChannelCell;
+
+#define CHANNEL_CACHE_LINE 64
+// the largest capacity channel() accepts, 2^24 cells
+#define CHANNEL_MAX_CAPACITY 16777216
+
+// Bounded multi-producer multi-consumer queue (Vyukov's ring): each cell's
+// sequence number says whether it is ready for the next send or receive, so
+// senders and receivers only contend on their own position counter.
+struct Channel {
+  atomic_size_t references;
+  size_t mask;
+  ChannelCell *cells;
+  _Alignas(CHANNEL_CACHE_LINE) atomic_size_t send_position;
+  _Alignas(CHANNEL_CACHE_LINE) atomic_size_t receive_position;
+};
+
+Channel *create_channel(size_t capacity);
+void retain_channel(Channel *channel);
+void release_channel(Channel *channel);
+bool is_sendable_value(Value value);
+bool channel_try_send(Channel *channel, VM *vm, Value value);
+bool channel_try_receive(Channel *channel, VM *vm, Value *value);
+
+NativeResult channel_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result);
+NativeResult send_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result);
+NativeResult receive_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result);
+NativeResult try_receive_native(VM *vm, Task *task, int arg_count, Value *args,
+                                Value *result);
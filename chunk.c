@@ -1,9 +1,12 @@
 #include "chunk.h"
+#include "arena.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 
@@ -12,27 +15,57 @@ void init_chunk(Chunk *chunk) {
   chunk->lines = NULL;
   chunk->count = 0;
   chunk->capacity = 0;
+  chunk->arena = NULL;
+  chunk->frozen = false;
+  chunk->objects = NULL;
+  chunk->name = NULL;
   init_value_array(&chunk->constants);
 }
 
+static void *grow_chunk_array(Chunk *chunk, void *array, size_t old_size,
+                              size_t new_size) {
+  if (chunk->arena != NULL) {
+    return arena_grow_array(chunk->arena, array, old_size, new_size);
+  }
+  return grow_array_size(array, new_size);
+}
+
 // returns the index of the added constant
 int add_constant(Chunk *chunk, Value value) {
-  add_value(&chunk->constants, value);
-  return chunk->constants.count - 1;
+  ValueArray *constants = &chunk->constants;
+  if (constants->capacity < constants->count + 1) {
+    size_t new_capacity = get_new_array_capacity(constants->capacity);
+    void *result =
+        grow_chunk_array(chunk, constants->values,
+                         constants->capacity * sizeof(Value),
+                         new_capacity * sizeof(Value));
+    if (result == NULL) {
+      printf("ran out of memory when writing to a value array\n");
+      exit(1);
+    }
+    constants->values = (Value *)result;
+    constants->capacity = new_capacity;
+  }
+
+  constants->values[constants->count++] = value;
+  return constants->count - 1;
 }
 
 void write_chunk(Chunk *chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
     size_t new_capacity = get_new_array_capacity(chunk->capacity);
     void *result =
-        grow_array_size(chunk->byte_code, new_capacity * sizeof(uint8_t));
+        grow_chunk_array(chunk, chunk->byte_code,
+                         chunk->capacity * sizeof(uint8_t),
+                         new_capacity * sizeof(uint8_t));
     if (result == NULL) {
       printf("ran out of memory when writing to a chunk\n");
       exit(1);
     }
     chunk->byte_code = (uint8_t *)result;
 
-    result = grow_array_size(chunk->lines, new_capacity * sizeof(int));
+    result = grow_chunk_array(chunk, chunk->lines, chunk->capacity * sizeof(int),
+                              new_capacity * sizeof(int));
     if (result == NULL) {
       printf("ran out of memory when writing to a chunk\n");
       exit(1);
@@ -47,12 +80,46 @@ void write_chunk(Chunk *chunk, uint8_t byte, int line) {
 }
 
 void free_chunk(Chunk *chunk) {
-  free_value_array(&chunk->constants);
-  free(chunk->byte_code);
-  free(chunk->lines);
+  // arena backed arrays are released together with the arena
+  if (chunk->arena == NULL) {
+    free_value_array(&chunk->constants);
+    free(chunk->byte_code);
+    free(chunk->lines);
+  }
+  free_objects(chunk->objects);
   init_chunk(chunk);
 }
 
+static void *copy_to_heap(void *array, size_t size) {
+  if (size == 0)
+    return NULL;
+
+  void *result = malloc(size);
+  if (result == NULL) {
+    printf("ran out of memory when moving a chunk to the heap\n");
+    exit(1);
+  }
+  memcpy(result, array, size);
+  return result;
+}
+
+// copies an arena backed chunk into exactly sized heap arrays so it can
+// outlive the compilation arena
+void move_chunk_to_heap(Chunk *chunk) {
+  if (chunk->arena == NULL)
+    return;
+
+  chunk->byte_code = copy_to_heap(chunk->byte_code, chunk->count);
+  chunk->lines = copy_to_heap(chunk->lines, chunk->count * sizeof(int));
+  chunk->capacity = chunk->count;
+
+  ValueArray *constants = &chunk->constants;
+  constants->values =
+      copy_to_heap(constants->values, constants->count * sizeof(Value));
+  constants->capacity = constants->count;
+  chunk->arena = NULL;
+}
+
 int print_simple_instruction(const char *instruction, size_t index) {
   printf("%s\n", instruction);
   return index + 1;
@@ -75,8 +142,88 @@ int print_jump_instruction(const char *instruction, Chunk *chunk, int index) {
   return index + 3;
 }
 
+int print_byte_instruction(const char *instruction, Chunk *chunk,
+                           size_t index) {
+  printf("%s slot: %d\n", instruction, chunk->byte_code[index + 1]);
+  return index + 2;
+}
+
+int print_call_instruction(const char *instruction, Chunk *chunk,
+                           size_t index) {
+  printf("%s args: %d\n", instruction, chunk->byte_code[index + 1]);
+  return index + 2;
+}
+
+int print_parallel_instruction(const char *instruction, Chunk *chunk,
+                               size_t index) {
+  uint16_t jump = (uint16_t)((chunk->byte_code[index + 1] << 8) |
+                             chunk->byte_code[index + 2]);
+  int reduction_count = chunk->byte_code[index + 4];
+  printf("%s jump location: %d locals: %d reductions: %d\n", instruction,
+         jump, chunk->byte_code[index + 3], reduction_count);
+  return index + 5 + reduction_count * 3;
+}
+
+int print_body_instruction(const char *instruction, Chunk *chunk,
+                            size_t index) {
+  uint16_t jump = (uint16_t)((chunk->byte_code[index + 1] << 8) |
+                             chunk->byte_code[index + 2]);
+  printf("%s jump location: %d locals: %d\n", instruction, jump,
+         chunk->byte_code[index + 3]);
+  return index + 4;
+}
+
 int get_line(Chunk *chunk, int index) { return chunk->lines[index]; }
 
+static const char *opcode_names[OPCODE_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_MOD] = "OP_MOD",
+    [OP_NOT] = "OP_NOT",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_POP] = "OP_POP",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_SPAWN] = "OP_SPAWN",
+    [OP_COROUTINE] = "OP_COROUTINE",
+    [OP_YIELD] = "OP_YIELD",
+    [OP_RESUME] = "OP_RESUME",
+    [OP_CALL] = "OP_CALL",
+    [OP_PARALLEL] = "OP_PARALLEL",
+    [OP_PARALLEL_JOIN] = "OP_PARALLEL_JOIN",
+    [OP_ARRAY] = "OP_ARRAY",
+    [OP_GET_INDEX] = "OP_GET_INDEX",
+    [OP_SET_INDEX] = "OP_SET_INDEX",
+    [OP_DICT] = "OP_DICT",
+    [OP_FORMAT] = "OP_FORMAT",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+};
+
+const char *opcode_name(uint8_t opcode) {
+  return opcode < OPCODE_COUNT ? opcode_names[opcode] : "OP_UNKNOWN";
+}
+
+const char *chunk_name(Chunk *chunk) {
+  return chunk->name != NULL ? chunk->name : "script";
+}
+
 int dissasemble_instruction(Chunk *chunk, size_t index) {
   int line = get_line(chunk, index);
   printf("Line: %d: %04d ", line, (int)index);
@@ -127,6 +274,36 @@ int dissasemble_instruction(Chunk *chunk, size_t index) {
     return print_jump_instruction("OP_JUMP", chunk, index);
   case OP_LOOP:
     return print_jump_instruction("OP_LOOP", chunk, index);
+  case OP_GET_LOCAL:
+    return print_byte_instruction("OP_GET_LOCAL", chunk, index);
+  case OP_SET_LOCAL:
+    return print_byte_instruction("OP_SET_LOCAL", chunk, index);
+  case OP_SPAWN:
+    return print_body_instruction("OP_SPAWN", chunk, index);
+  case OP_COROUTINE:
+    return print_body_instruction("OP_COROUTINE", chunk, index);
+  case OP_YIELD:
+    return print_simple_instruction("OP_YIELD", index);
+  case OP_RESUME:
+    return print_simple_instruction("OP_RESUME", index);
+  case OP_CALL:
+    return print_call_instruction("OP_CALL", chunk, index);
+  case OP_PARALLEL:
+    return print_parallel_instruction("OP_PARALLEL", chunk, index);
+  case OP_PARALLEL_JOIN:
+    return print_simple_instruction("OP_PARALLEL_JOIN", index);
+  case OP_ARRAY:
+    return print_byte_instruction("OP_ARRAY", chunk, index);
+  case OP_GET_INDEX:
+    return print_simple_instruction("OP_GET_INDEX", index);
+  case OP_SET_INDEX:
+    return print_simple_instruction("OP_SET_INDEX", index);
+  case OP_DICT:
+    return print_byte_instruction("OP_DICT", chunk, index);
+  case OP_FORMAT:
+    return print_byte_instruction("OP_FORMAT", chunk, index);
+  case OP_TAIL_CALL:
+    return print_call_instruction("OP_TAIL_CALL", chunk, index);
   default:
     printf("Unknown opcode %d\n", instruction);
     return index + 1;
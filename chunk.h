@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arena.h"
 #include "value.h"
 #include <stddef.h>
 #include <stdint.h>
@@ -10,6 +11,14 @@ typedef struct {
   uint8_t *byte_code;
   int *lines;
   ValueArray constants;
+  // set while the chunk is being compiled, arrays then live in the arena
+  Arena *arena;
+  // a frozen chunk owns the objects in its constant pool and is never written
+  // to again, any number of vms may execute it concurrently
+  bool frozen;
+  Obj *objects;
+  // the function's name in statistics and profiles, NULL for the program
+  const char *name;
 } Chunk;
 
 typedef enum {
@@ -36,13 +45,33 @@ typedef enum {
   OP_JUMP_IF_FALSE,
   OP_JUMP,
   OP_LOOP,
+  OP_GET_LOCAL,
+  OP_SET_LOCAL,
+  OP_SPAWN,
+  OP_COROUTINE,
+  OP_YIELD,
+  OP_RESUME,
+  OP_CALL,
+  OP_PARALLEL,
+  OP_PARALLEL_JOIN,
+  OP_ARRAY,
+  OP_GET_INDEX,
+  OP_SET_INDEX,
+  OP_DICT,
+  OP_FORMAT,
+  OP_TAIL_CALL,
 } OpCode;
 
+#define OPCODE_COUNT (OP_TAIL_CALL + 1)
+
 void init_chunk(Chunk *chunk);
 void write_chunk(Chunk *chunk, uint8_t byte, int line);
 void free_chunk(Chunk *chunk);
+void move_chunk_to_heap(Chunk *chunk);
 int print_simple_instruction(const char *instruction, size_t index);
 int dissasemble_instruction(Chunk *chunk, size_t index);
 void dissasemble_chunk(Chunk *chunk, const char *chunk_name);
 int add_constant(Chunk *chunk, Value value);
 int get_line(Chunk *chunk, int index);
+const char *opcode_name(uint8_t opcode);
+const char *chunk_name(Chunk *chunk);
@@ -0,0 +1,12 @@
+#include "cpu.h"
+
+bool cpu_has_avx2(void) {
+  static int supported = -1;
+  int cached = __atomic_load_n(&supported, __ATOMIC_RELAXED);
+  if (cached < 0) {
+    __builtin_cpu_init();
+    cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    __atomic_store_n(&supported, cached, __ATOMIC_RELAXED);
+  }
+  return cached;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdbool.h>
+
+// whether the processor runs AVX2, checked once. Modules with AVX2 kernels
+// combine it with a flag of their own that benchmarks clear to time the
+// scalar fallback
+bool cpu_has_avx2(void);
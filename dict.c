@@ -0,0 +1,77 @@
+#include "dict.h"
+#include "hash_map.h"
+#include "object.h"
+#include "vm.h"
+#include <math.h>
+
+// the table compares strings by identity, so string keys are stored as the
+// interned copy (ropes are flattened and views copied). Integral doubles are
+// stored as integers so d[1] and d[2 / 2] are the same entry. nil and nan can
+// not be keys, a lookup could never find them
+bool dict_key(VM *vm, Task *task, Value value, Value *key) {
+  if (IS_NIL(value) || (IS_NUMBER(value) && isnan(AS_NUMBER(value)))) {
+    log_vm_error(vm, task, "dictionary keys can not be nil or nan\n");
+    return false;
+  }
+  if (IS_NUMBER(value) && AS_NUMBER(value) == floor(AS_NUMBER(value)) &&
+      fabs(AS_NUMBER(value)) < 9223372036854775808.0) {
+    *key = INT_VAL((int64_t)AS_NUMBER(value));
+  } else if (is_string_value(value)) {
+    *key = OBJ_VAL(flatten_c_string(vm, value));
+  } else {
+    *key = value;
+  }
+  return true;
+}
+
+// ropes are flattened on the way in so printing a dictionary never needs the
+// vm's heap
+Value dict_value(VM *vm, Value value) {
+  return IS_ROPE(value) ? OBJ_VAL(flatten_string(vm, value)) : value;
+}
+
+static bool check_dict(VM *vm, Task *task, Value value) {
+  if (!IS_DICT(value)) {
+    log_vm_error(vm, task, "expected a dictionary\n");
+    return false;
+  }
+  return true;
+}
+
+// dict(n) is an empty dictionary with room for n entries
+NativeResult dict_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result) {
+  if (!IS_NUMERIC(args[0]) || AS_DOUBLE(args[0]) < 0) {
+    log_vm_error(vm, task, "dictionary size must be a non negative number\n");
+    return NATIVE_ERROR;
+  }
+  ObjDict *dict = new_dict(vm);
+  reserve_hash_map(&dict->table, (size_t)AS_DOUBLE(args[0]));
+  *result = OBJ_VAL(dict);
+  return NATIVE_OK;
+}
+
+NativeResult has_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result) {
+  Value key, value;
+  if (!check_dict(vm, task, args[0]) || !dict_key(vm, task, args[1], &key))
+    return NATIVE_ERROR;
+  ObjDict *dict = AS_DICT(args[0]);
+  lock_dict(vm, dict, false);
+  *result = BOOL_VAL(get_value_entry(&dict->table, key, &value));
+  unlock_dict(vm, dict);
+  return NATIVE_OK;
+}
+
+// delete(dict, key) evaluates to whether the key was there
+NativeResult delete_native(VM *vm, Task *task, int arg_count, Value *args,
+                           Value *result) {
+  Value key;
+  if (!check_dict(vm, task, args[0]) || !dict_key(vm, task, args[1], &key))
+    return NATIVE_ERROR;
+  ObjDict *dict = AS_DICT(args[0]);
+  lock_dict(vm, dict, true);
+  *result = BOOL_VAL(delete_value_entry(&dict->table, key));
+  unlock_dict(vm, dict);
+  return NATIVE_OK;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdbool.h>
+
+// a dictionary can be shared by spawned tasks and parallel loop chunks, so
+// once a scheduler runs every read of its table takes the lock shared and
+// every insert or delete takes it exclusively. Before that the program is
+// single threaded and the lock is skipped
+static inline void lock_dict(VM *vm, ObjDict *dict, bool write) {
+  if (vm->scheduler == NULL)
+    return;
+  if (write) {
+    pthread_rwlock_wrlock(&dict->lock);
+  } else {
+    pthread_rwlock_rdlock(&dict->lock);
+  }
+}
+
+static inline void unlock_dict(VM *vm, ObjDict *dict) {
+  if (vm->scheduler != NULL)
+    pthread_rwlock_unlock(&dict->lock);
+}
+
+bool dict_key(VM *vm, Task *task, Value value, Value *key);
+Value dict_value(VM *vm, Value value);
+
+NativeResult dict_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result);
+NativeResult has_native(VM *vm, Task *task, int arg_count, Value *args,
+                        Value *result);
+NativeResult delete_native(VM *vm, Task *task, int arg_count, Value *args,
+                           Value *result);
@@ -0,0 +1,604 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include "object.h"
+#include "scheduler.h"
+#include "vm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define EPOLL_BATCH 64
+
+static void complete_request(EventLoop *loop, IoRequest *request,
+                             ssize_t result) {
+  request->result = result;
+  if (request->task != NULL) {
+    // the scheduler's queue lock publishes the result to the worker that
+    // picks the task up
+    request->completed = true;
+    resume_task(loop->vm->scheduler, request->task);
+    return;
+  }
+  pthread_mutex_lock(&loop->wait_lock);
+  request->completed = true;
+  pthread_cond_broadcast(&loop->completed);
+  pthread_mutex_unlock(&loop->wait_lock);
+}
+
+// io_uring through the raw system calls, the rings are mapped once and every
+// submission is handed to the kernel straight away so the submission queue
+// never holds more than one entry
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static bool setup_ring(EventLoop *loop) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+  if (fd < 0)
+    return false;
+  // reads and writes at the file position (offset -1) need 5.6
+  if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+    close(fd);
+    return false;
+  }
+
+  loop->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  loop->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    if (loop->cq_ring_size > loop->sq_ring_size)
+      loop->sq_ring_size = loop->cq_ring_size;
+    loop->cq_ring_size = loop->sq_ring_size;
+  }
+  loop->sq_ring = mmap(NULL, loop->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (loop->sq_ring == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  loop->cq_ring = single_mmap
+                      ? loop->sq_ring
+                      : mmap(NULL, loop->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  loop->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  loop->sqes = loop->cq_ring == MAP_FAILED
+                   ? MAP_FAILED
+                   : mmap(NULL, loop->sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (loop->sqes == MAP_FAILED) {
+    if (loop->cq_ring != MAP_FAILED && !single_mmap)
+      munmap(loop->cq_ring, loop->cq_ring_size);
+    munmap(loop->sq_ring, loop->sq_ring_size);
+    close(fd);
+    return false;
+  }
+
+  char *sq = (char *)loop->sq_ring;
+  char *cq = (char *)loop->cq_ring;
+  loop->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  loop->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  loop->sq_array = (unsigned *)(sq + params.sq_off.array);
+  loop->cq_head = (unsigned *)(cq + params.cq_off.head);
+  loop->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  loop->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  loop->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  loop->ring_fd = fd;
+  return true;
+}
+
+static void free_ring(EventLoop *loop) {
+  munmap(loop->sqes, loop->sqes_size);
+  if (loop->cq_ring != loop->sq_ring)
+    munmap(loop->cq_ring, loop->cq_ring_size);
+  munmap(loop->sq_ring, loop->sq_ring_size);
+  close(loop->ring_fd);
+}
+
+// a NULL request is a no-op that stops the loop thread
+static void ring_submit(EventLoop *loop, IoRequest *request) {
+  pthread_mutex_lock(&loop->submit_lock);
+  unsigned tail = *loop->sq_tail;
+  unsigned index = tail & *loop->sq_mask;
+  struct io_uring_sqe *sqe = &loop->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  if (request == NULL) {
+    sqe->opcode = IORING_OP_NOP;
+  } else {
+    sqe->opcode =
+        request->operation == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t)(uintptr_t)request->buffer;
+    sqe->len = (uint32_t)request->length;
+    sqe->off = (uint64_t)-1;
+  }
+  sqe->user_data = (uint64_t)(uintptr_t)request;
+  loop->sq_array[index] = index;
+  __atomic_store_n(loop->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  int submitted;
+  do {
+    submitted = io_uring_enter(loop->ring_fd, 1, 0, 0);
+  } while (submitted < 0 && (errno == EINTR || errno == EAGAIN));
+  pthread_mutex_unlock(&loop->submit_lock);
+
+  if (submitted < 0 && request != NULL)
+    complete_request(loop, request, -errno);
+}
+
+static void *run_ring(void *argument) {
+  EventLoop *loop = (EventLoop *)argument;
+  bool stopping = false;
+  while (!stopping) {
+    if (io_uring_enter(loop->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR && errno != EBUSY) {
+      perror("io_uring_enter");
+      exit(1);
+    }
+    // a completion can only exist once its submitter is inside (or past) the
+    // locked section, so taking the lock orders the batch after the writes
+    // that set up its requests where tools like thread sanitizers can see it
+    pthread_mutex_lock(&loop->submit_lock);
+    unsigned head = *loop->cq_head;
+    unsigned tail = __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&loop->submit_lock);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &loop->cqes[head & *loop->cq_mask];
+      IoRequest *request = (IoRequest *)(uintptr_t)cqe->user_data;
+      if (request == NULL) {
+        stopping = true;
+      } else {
+        complete_request(loop, request, cqe->res);
+      }
+    }
+    __atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+// epoll: the operation is tried right away on a non blocking descriptor and
+// only handed to the loop thread when a pipe is not ready
+
+static ssize_t perform_io(IoRequest *request) {
+  ssize_t result = request->operation == IO_READ
+                       ? read(request->fd, request->buffer, request->length)
+                       : write(request->fd, request->buffer, request->length);
+  return result < 0 ? -errno : result;
+}
+
+static bool setup_epoll(EventLoop *loop) {
+  loop->waiters = NULL;
+  loop->waiters_capacity = 0;
+  pthread_mutex_init(&loop->waiters_lock, NULL);
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0)
+    return false;
+  loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  struct epoll_event event = {.events = EPOLLIN, .data.fd = loop->wake_fd};
+  if (loop->wake_fd < 0 ||
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) < 0) {
+    if (loop->wake_fd >= 0)
+      close(loop->wake_fd);
+    close(loop->epoll_fd);
+    return false;
+  }
+  return true;
+}
+
+static IoWaiters *get_waiters(EventLoop *loop, int fd) {
+  if (fd >= loop->waiters_capacity) {
+    int capacity = loop->waiters_capacity < 16 ? 16 : loop->waiters_capacity;
+    while (capacity <= fd)
+      capacity *= 2;
+    IoWaiters *waiters =
+        (IoWaiters *)realloc(loop->waiters, capacity * sizeof(IoWaiters));
+    if (waiters == NULL) {
+      printf("ran out of memory when waiting on a descriptor\n");
+      exit(1);
+    }
+    memset(waiters + loop->waiters_capacity, 0,
+           (capacity - loop->waiters_capacity) * sizeof(IoWaiters));
+    loop->waiters = waiters;
+    loop->waiters_capacity = capacity;
+  }
+  return &loop->waiters[fd];
+}
+
+static uint32_t request_events(IoRequest *request) {
+  return request->operation == IO_READ ? EPOLLIN : EPOLLOUT;
+}
+
+// what the requests waiting on a descriptor need it to become
+static uint32_t waiting_events(IoWaiters *waiters) {
+  uint32_t events = 0;
+  for (IoRequest *request = waiters->head; request != NULL;
+       request = request->next)
+    events |= request_events(request);
+  return events;
+}
+
+// one shot, so the descriptor is disarmed again until the loop thread has
+// retried its waiters and re-armed it
+static int arm_epoll(EventLoop *loop, int fd, uint32_t events, int op) {
+  struct epoll_event event;
+  event.events = events | EPOLLONESHOT;
+  event.data.fd = fd;
+  if (epoll_ctl(loop->epoll_fd, op, fd, &event) == 0)
+    return 0;
+  if (op == EPOLL_CTL_ADD && errno == EEXIST)
+    return arm_epoll(loop, fd, events, EPOLL_CTL_MOD);
+  if (op == EPOLL_CTL_MOD && errno == ENOENT)
+    return arm_epoll(loop, fd, events, EPOLL_CTL_ADD);
+  return -errno;
+}
+
+// completes a chain of requests linked through next, outside waiters_lock
+static void complete_chain(EventLoop *loop, IoRequest *request) {
+  while (request != NULL) {
+    IoRequest *next = request->next;
+    request->next = NULL;
+    complete_request(loop, request, request->result);
+    request = next;
+  }
+}
+
+// retries the waiting requests of fd oldest first until one would block,
+// which is left waiting with the rest behind it. Any that failed to re-arm
+// are failed too. Returns the ones that finished, linked through next
+static IoRequest *retry_waiters(EventLoop *loop, int fd, IoWaiters *waiters) {
+  IoRequest *done = NULL;
+  IoRequest **done_tail = &done;
+  while (waiters->head != NULL) {
+    IoRequest *request = waiters->head;
+    ssize_t result = perform_io(request);
+    if (result == -EAGAIN) {
+      int error = arm_epoll(loop, fd, waiting_events(waiters), EPOLL_CTL_MOD);
+      if (error == 0)
+        break;
+      result = error;
+    }
+    waiters->head = request->next;
+    if (waiters->head == NULL)
+      waiters->tail = NULL;
+    request->result = result;
+    request->next = NULL;
+    *done_tail = request;
+    done_tail = &request->next;
+  }
+  return done;
+}
+
+// a request for a descriptor others already wait on queues behind them, so
+// several tasks can read or write one pipe and each is resumed in turn
+static void epoll_submit(EventLoop *loop, IoRequest *request) {
+  int flags = fcntl(request->fd, F_GETFL);
+  if (flags >= 0 && !(flags & O_NONBLOCK))
+    fcntl(request->fd, F_SETFL, flags | O_NONBLOCK);
+  request->next = NULL;
+
+  pthread_mutex_lock(&loop->waiters_lock);
+  IoWaiters *waiters = get_waiters(loop, request->fd);
+  uint32_t events = waiting_events(waiters);
+  ssize_t result = 0;
+  bool waiting = false;
+  if (waiters->head == NULL) {
+    result = perform_io(request);
+    if (result == -EAGAIN) {
+      result = arm_epoll(loop, request->fd, request_events(request),
+                         EPOLL_CTL_ADD);
+      waiting = result == 0;
+    }
+  } else {
+    // a write queued behind reads (or the other way round) needs the
+    // descriptor armed for both
+    if (!(events & request_events(request)))
+      result = arm_epoll(loop, request->fd, events | request_events(request),
+                         EPOLL_CTL_MOD);
+    waiting = result == 0;
+  }
+  if (waiting) {
+    // the loop thread retries it once the descriptor is ready
+    if (waiters->head == NULL) {
+      waiters->head = request;
+    } else {
+      waiters->tail->next = request;
+    }
+    waiters->tail = request;
+  }
+  pthread_mutex_unlock(&loop->waiters_lock);
+  if (!waiting)
+    complete_request(loop, request, result);
+}
+
+static void *run_epoll(void *argument) {
+  EventLoop *loop = (EventLoop *)argument;
+  struct epoll_event events[EPOLL_BATCH];
+  for (;;) {
+    int count = epoll_wait(loop->epoll_fd, events, EPOLL_BATCH, -1);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+      int fd = events[i].data.fd;
+      if (fd == loop->wake_fd)
+        return NULL;
+      pthread_mutex_lock(&loop->waiters_lock);
+      IoRequest *done = retry_waiters(loop, fd, get_waiters(loop, fd));
+      pthread_mutex_unlock(&loop->waiters_lock);
+      complete_chain(loop, done);
+    }
+  }
+}
+
+static EventLoop *create_event_loop(VM *vm) {
+  EventLoop *loop = (EventLoop *)malloc(sizeof(EventLoop));
+  if (loop == NULL) {
+    printf("ran out of memory when starting the event loop\n");
+    exit(1);
+  }
+  loop->vm = vm;
+  pthread_mutex_init(&loop->submit_lock, NULL);
+  pthread_mutex_init(&loop->wait_lock, NULL);
+  pthread_cond_init(&loop->completed, NULL);
+
+  loop->backend = vm->io_backend;
+  if (loop->backend == IO_BACKEND_URING && !setup_ring(loop))
+    loop->backend = IO_BACKEND_EPOLL;
+  if (loop->backend == IO_BACKEND_EPOLL && !setup_epoll(loop)) {
+    perror("epoll");
+    exit(1);
+  }
+  if (pthread_create(&loop->thread, NULL,
+                     loop->backend == IO_BACKEND_URING ? run_ring : run_epoll,
+                     loop) != 0) {
+    printf("could not start the event loop thread\n");
+    exit(1);
+  }
+  return loop;
+}
+
+// the loop is started by the first I/O a program does
+EventLoop *get_event_loop(VM *vm) {
+  EventLoop *loop = __atomic_load_n(&vm->event_loop, __ATOMIC_ACQUIRE);
+  if (loop != NULL)
+    return loop;
+  lock_heap(vm);
+  loop = __atomic_load_n(&vm->event_loop, __ATOMIC_ACQUIRE);
+  if (loop == NULL) {
+    loop = create_event_loop(vm);
+    __atomic_store_n(&vm->event_loop, loop, __ATOMIC_RELEASE);
+  }
+  unlock_heap(vm);
+  return loop;
+}
+
+// called once nothing is waiting on the loop any more
+void free_event_loop(EventLoop *loop) {
+  if (loop->backend == IO_BACKEND_URING) {
+    ring_submit(loop, NULL);
+  } else {
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0)
+      perror("eventfd");
+  }
+  pthread_join(loop->thread, NULL);
+
+  if (loop->backend == IO_BACKEND_URING) {
+    free_ring(loop);
+  } else {
+    close(loop->wake_fd);
+    close(loop->epoll_fd);
+    free(loop->waiters);
+    pthread_mutex_destroy(&loop->waiters_lock);
+  }
+  pthread_mutex_destroy(&loop->submit_lock);
+  pthread_mutex_destroy(&loop->wait_lock);
+  pthread_cond_destroy(&loop->completed);
+  free(loop);
+}
+
+// starts the operation for a task that has already been parked. The task is
+// rescheduled on completion and may be running again before this returns
+void submit_io(EventLoop *loop, IoRequest *request, Task *task) {
+  request->task = task;
+  request->completed = false;
+  if (loop->backend == IO_BACKEND_URING) {
+    ring_submit(loop, request);
+  } else {
+    epoll_submit(loop, request);
+  }
+}
+
+// for the main task, which has no scheduler to park it on
+void submit_io_and_wait(EventLoop *loop, IoRequest *request) {
+  submit_io(loop, request, NULL);
+  pthread_mutex_lock(&loop->wait_lock);
+  while (!request->completed) {
+    pthread_cond_wait(&loop->completed, &loop->wait_lock);
+  }
+  pthread_mutex_unlock(&loop->wait_lock);
+}
+
+// the natives. read and write park the calling task on their first call and
+// pick the result up when the vm repeats the call after the completion
+
+static IoRequest *create_io_request(IoOperation operation, int fd,
+                                    char *buffer, size_t length) {
+  IoRequest *request = (IoRequest *)malloc(sizeof(IoRequest));
+  if (request == NULL) {
+    printf("ran out of memory when starting I/O\n");
+    exit(1);
+  }
+  request->operation = operation;
+  request->fd = fd;
+  request->buffer = buffer;
+  request->length = length;
+  request->result = 0;
+  request->completed = false;
+  request->task = NULL;
+  return request;
+}
+
+// the finished request of a repeated call, NULL on the first call
+static IoRequest *take_completed_io(Task *task) {
+  IoRequest *request = task->io;
+  if (request == NULL || !request->completed)
+    return NULL;
+  task->io = NULL;
+  return request;
+}
+
+static bool check_open_file(VM *vm, Task *task, Value value) {
+  if (!IS_FILE(value)) {
+    log_vm_error(vm, task, "expected a file\n");
+    return false;
+  }
+  if (AS_FILE(value)->fd < 0) {
+    log_vm_error(vm, task, "file is closed\n");
+    return false;
+  }
+  return true;
+}
+
+// open(path, mode) with mode "r", "w" or "a", nil when the file cannot be
+// opened
+NativeResult open_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result) {
+  if (!is_string_value(args[0]) || !is_string_value(args[1])) {
+    log_vm_error(vm, task, "open takes a path and a mode\n");
+    return NATIVE_ERROR;
+  }
+  const char *mode = flatten_c_string(vm, args[1])->chars;
+  int flags;
+  if (strcmp(mode, "r") == 0) {
+    flags = O_RDONLY;
+  } else if (strcmp(mode, "w") == 0) {
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  } else if (strcmp(mode, "a") == 0) {
+    flags = O_WRONLY | O_CREAT | O_APPEND;
+  } else {
+    log_vm_error(vm, task, "open mode must be \"r\", \"w\" or \"a\"\n");
+    return NATIVE_ERROR;
+  }
+  int fd =
+      open(flatten_c_string(vm, args[0])->chars, flags | O_CLOEXEC, 0644);
+  *result = fd < 0 ? NIL_VAL : OBJ_VAL(new_file(vm, fd));
+  return NATIVE_OK;
+}
+
+NativeResult close_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result) {
+  if (!check_open_file(vm, task, args[0]))
+    return NATIVE_ERROR;
+  close_file(AS_FILE(args[0]));
+  *result = NIL_VAL;
+  return NATIVE_OK;
+}
+
+// read(file, count) reads up to count bytes, nil at end of file
+NativeResult read_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result) {
+  IoRequest *request = take_completed_io(task);
+  if (request != NULL) {
+    ssize_t count = request->result;
+    char *chars = request->buffer;
+    free(request);
+    if (count < 0) {
+      free(chars);
+      log_vm_error(vm, task, "read failed\n");
+      return NATIVE_ERROR;
+    }
+    if (count == 0) {
+      free(chars);
+      *result = NIL_VAL;
+      return NATIVE_OK;
+    }
+    chars[count] = '\0';
+    *result = OBJ_VAL(take_string(vm, chars, count));
+    return NATIVE_OK;
+  }
+
+  if (!check_open_file(vm, task, args[0]))
+    return NATIVE_ERROR;
+  if (!IS_NUMERIC(args[1]) || AS_DOUBLE(args[1]) < 1) {
+    log_vm_error(vm, task, "read count must be a positive number\n");
+    return NATIVE_ERROR;
+  }
+  size_t length = (size_t)AS_DOUBLE(args[1]);
+  char *buffer = (char *)malloc(length + 1);
+  if (buffer == NULL) {
+    printf("ran out of memory when reading\n");
+    exit(1);
+  }
+  task->io = create_io_request(IO_READ, AS_FILE(args[0])->fd, buffer, length);
+  return NATIVE_SUSPENDED;
+}
+
+// write(file, string) evaluates to the number of bytes written
+NativeResult write_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result) {
+  IoRequest *request = take_completed_io(task);
+  if (request != NULL) {
+    ssize_t count = request->result;
+    free(request);
+    if (count < 0) {
+      log_vm_error(vm, task, "write failed\n");
+      return NATIVE_ERROR;
+    }
+    *result = INT_VAL((int64_t)count);
+    return NATIVE_OK;
+  }
+
+  if (!check_open_file(vm, task, args[0]))
+    return NATIVE_ERROR;
+  if (!is_string_value(args[1])) {
+    log_vm_error(vm, task, "can only write strings\n");
+    return NATIVE_ERROR;
+  }
+  // strings live as long as the vm, the buffer outlasts the operation
+  ObjString *string = flatten_string(vm, args[1]);
+  task->io = create_io_request(IO_WRITE, AS_FILE(args[0])->fd, string->chars,
+                               string->length);
+  return NATIVE_SUSPENDED;
+}
+
+// pipe() evaluates to the read end, pipe_writer(pipe) to its write end
+NativeResult pipe_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0) {
+    log_vm_error(vm, task, "could not create a pipe\n");
+    return NATIVE_ERROR;
+  }
+  ObjFile *reader = new_file(vm, fds[0]);
+  reader->writer = new_file(vm, fds[1]);
+  *result = OBJ_VAL(reader);
+  return NATIVE_OK;
+}
+
+NativeResult pipe_writer_native(VM *vm, Task *task, int arg_count, Value *args,
+                                Value *result) {
+  if (!IS_FILE(args[0]) || AS_FILE(args[0])->writer == NULL) {
+    log_vm_error(vm, task, "expected a pipe\n");
+    return NATIVE_ERROR;
+  }
+  *result = OBJ_VAL(AS_FILE(args[0])->writer);
+  return NATIVE_OK;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef enum {
+  IO_READ,
+  IO_WRITE,
+} IoOperation;
+
+// One read or write in flight. A task that issues one is parked until it
+// completes and then repeats the native call, which picks up the result.
+struct IoRequest {
+  IoOperation operation;
+  int fd;
+  char *buffer;
+  size_t length;
+  // bytes transferred or -errno, valid once completed is set
+  ssize_t result;
+  bool completed;
+  // the parked task to reschedule, NULL when a thread waits for the result
+  Task *task;
+  // epoll: the next request waiting on the same descriptor
+  IoRequest *next;
+};
+
+// epoll: the requests waiting for one descriptor to become ready, oldest
+// first. They are retried in order whenever it does
+typedef struct {
+  IoRequest *head;
+  IoRequest *tail;
+} IoWaiters;
+
+// Completes I/O on a thread of its own so any number of tasks can have
+// operations in flight. io_uring is used when the kernel allows it, otherwise
+// the loop waits on epoll for pipes to become ready (regular files are always
+// ready and are read or written directly).
+struct EventLoop {
+  VM *vm;
+  IoBackend backend;
+  pthread_t thread;
+
+  // io_uring
+  int ring_fd;
+  pthread_mutex_t submit_lock;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+
+  // epoll
+  int epoll_fd;
+  int wake_fd;
+  // indexed by descriptor, taken with waiters_lock
+  IoWaiters *waiters;
+  int waiters_capacity;
+  pthread_mutex_t waiters_lock;
+
+  // threads waiting on a request without a task to park
+  pthread_mutex_t wait_lock;
+  pthread_cond_t completed;
+};
+
+#define IO_RING_ENTRIES 256
+
+EventLoop *get_event_loop(VM *vm);
+void free_event_loop(EventLoop *loop);
+void submit_io(EventLoop *loop, IoRequest *request, Task *task);
+void submit_io_and_wait(EventLoop *loop, IoRequest *request);
+
+NativeResult open_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result);
+NativeResult close_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result);
+NativeResult read_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result);
+NativeResult write_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result);
+NativeResult pipe_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result);
+NativeResult pipe_writer_native(VM *vm, Task *task, int arg_count, Value *args,
+                                Value *result);
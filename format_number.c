@@ -0,0 +1,366 @@
+#include "format_number.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+// with Integers"): scales the double and the boundaries of its rounding
+// interval by a cached power of ten so the digits can be generated with 64
+// bit integer arithmetic. The output always reads back as the same double and
+// is the shortest such output for all but a tiny fraction of inputs
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+typedef struct {
+  uint64_t f;
+  int16_t binary_exponent;
+  int16_t decimal_exponent;
+} CachedPower;
+
+// 10^k for k = -348, -340, ..., 340 as normalized 64 bit significands
+static const CachedPower CACHED_POWERS[] = {
+    {0xfa8fd5a0081c0288ull, -1220, -348},
+    {0xbaaee17fa23ebf76ull, -1193, -340},
+    {0x8b16fb203055ac76ull, -1166, -332},
+    {0xcf42894a5dce35eaull, -1140, -324},
+    {0x9a6bb0aa55653b2dull, -1113, -316},
+    {0xe61acf033d1a45dfull, -1087, -308},
+    {0xab70fe17c79ac6caull, -1060, -300},
+    {0xff77b1fcbebcdc4full, -1034, -292},
+    {0xbe5691ef416bd60cull, -1007, -284},
+    {0x8dd01fad907ffc3cull, -980, -276},
+    {0xd3515c2831559a83ull, -954, -268},
+    {0x9d71ac8fada6c9b5ull, -927, -260},
+    {0xea9c227723ee8bcbull, -901, -252},
+    {0xaecc49914078536dull, -874, -244},
+    {0x823c12795db6ce57ull, -847, -236},
+    {0xc21094364dfb5637ull, -821, -228},
+    {0x9096ea6f3848984full, -794, -220},
+    {0xd77485cb25823ac7ull, -768, -212},
+    {0xa086cfcd97bf97f4ull, -741, -204},
+    {0xef340a98172aace5ull, -715, -196},
+    {0xb23867fb2a35b28eull, -688, -188},
+    {0x84c8d4dfd2c63f3bull, -661, -180},
+    {0xc5dd44271ad3cdbaull, -635, -172},
+    {0x936b9fcebb25c996ull, -608, -164},
+    {0xdbac6c247d62a584ull, -582, -156},
+    {0xa3ab66580d5fdaf6ull, -555, -148},
+    {0xf3e2f893dec3f126ull, -529, -140},
+    {0xb5b5ada8aaff80b8ull, -502, -132},
+    {0x87625f056c7c4a8bull, -475, -124},
+    {0xc9bcff6034c13053ull, -449, -116},
+    {0x964e858c91ba2655ull, -422, -108},
+    {0xdff9772470297ebdull, -396, -100},
+    {0xa6dfbd9fb8e5b88full, -369, -92},
+    {0xf8a95fcf88747d94ull, -343, -84},
+    {0xb94470938fa89bcfull, -316, -76},
+    {0x8a08f0f8bf0f156bull, -289, -68},
+    {0xcdb02555653131b6ull, -263, -60},
+    {0x993fe2c6d07b7facull, -236, -52},
+    {0xe45c10c42a2b3b06ull, -210, -44},
+    {0xaa242499697392d3ull, -183, -36},
+    {0xfd87b5f28300ca0eull, -157, -28},
+    {0xbce5086492111aebull, -130, -20},
+    {0x8cbccc096f5088ccull, -103, -12},
+    {0xd1b71758e219652cull, -77, -4},
+    {0x9c40000000000000ull, -50, 4},
+    {0xe8d4a51000000000ull, -24, 12},
+    {0xad78ebc5ac620000ull, 3, 20},
+    {0x813f3978f8940984ull, 30, 28},
+    {0xc097ce7bc90715b3ull, 56, 36},
+    {0x8f7e32ce7bea5c70ull, 83, 44},
+    {0xd5d238a4abe98068ull, 109, 52},
+    {0x9f4f2726179a2245ull, 136, 60},
+    {0xed63a231d4c4fb27ull, 162, 68},
+    {0xb0de65388cc8ada8ull, 189, 76},
+    {0x83c7088e1aab65dbull, 216, 84},
+    {0xc45d1df942711d9aull, 242, 92},
+    {0x924d692ca61be758ull, 269, 100},
+    {0xda01ee641a708deaull, 295, 108},
+    {0xa26da3999aef774aull, 322, 116},
+    {0xf209787bb47d6b85ull, 348, 124},
+    {0xb454e4a179dd1877ull, 375, 132},
+    {0x865b86925b9bc5c2ull, 402, 140},
+    {0xc83553c5c8965d3dull, 428, 148},
+    {0x952ab45cfa97a0b3ull, 455, 156},
+    {0xde469fbd99a05fe3ull, 481, 164},
+    {0xa59bc234db398c25ull, 508, 172},
+    {0xf6c69a72a3989f5cull, 534, 180},
+    {0xb7dcbf5354e9beceull, 561, 188},
+    {0x88fcf317f22241e2ull, 588, 196},
+    {0xcc20ce9bd35c78a5ull, 614, 204},
+    {0x98165af37b2153dfull, 641, 212},
+    {0xe2a0b5dc971f303aull, 667, 220},
+    {0xa8d9d1535ce3b396ull, 694, 228},
+    {0xfb9b7cd9a4a7443cull, 720, 236},
+    {0xbb764c4ca7a44410ull, 747, 244},
+    {0x8bab8eefb6409c1aull, 774, 252},
+    {0xd01fef10a657842cull, 800, 260},
+    {0x9b10a4e5e9913129ull, 827, 268},
+    {0xe7109bfba19c0c9dull, 853, 276},
+    {0xac2820d9623bf429ull, 880, 284},
+    {0x80444b5e7aa7cf85ull, 907, 292},
+    {0xbf21e44003acdd2dull, 933, 300},
+    {0x8e679c2f5e44ff8full, 960, 308},
+    {0xd433179d9c8cb841ull, 986, 316},
+    {0x9e19db92b4e31ba9ull, 1013, 324},
+    {0xeb96bf6ebadf77d9ull, 1039, 332},
+    {0xaf87023b9bf0ee6bull, 1066, 340},
+};
+
+static const uint64_t POWERS_OF_TEN[] = {1ull,
+                                         10ull,
+                                         100ull,
+                                         1000ull,
+                                         10000ull,
+                                         100000ull,
+                                         1000000ull,
+                                         10000000ull,
+                                         100000000ull,
+                                         1000000000ull,
+                                         10000000000ull,
+                                         100000000000ull,
+                                         1000000000000ull,
+                                         10000000000000ull,
+                                         100000000000000ull,
+                                         1000000000000000ull,
+                                         10000000000000000ull,
+                                         100000000000000000ull,
+                                         1000000000000000000ull,
+                                         10000000000000000000ull};
+
+#define SIGNIFICAND_BITS 52
+#define HIDDEN_BIT (1ull << SIGNIFICAND_BITS)
+#define SIGNIFICAND_MASK (HIDDEN_BIT - 1)
+#define EXPONENT_BIAS (1023 + SIGNIFICAND_BITS)
+
+static DiyFp double_to_diy_fp(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int biased_exponent = (int)((bits >> SIGNIFICAND_BITS) & 0x7ff);
+  uint64_t significand = bits & SIGNIFICAND_MASK;
+  if (biased_exponent != 0)
+    return (DiyFp){significand + HIDDEN_BIT, biased_exponent - EXPONENT_BIAS};
+  return (DiyFp){significand, 1 - EXPONENT_BIAS};
+}
+
+static DiyFp normalize(DiyFp value) {
+  int shift = __builtin_clzll(value.f);
+  return (DiyFp){value.f << shift, value.e - shift};
+}
+
+// rounded product of the significands, the low 64 bits only decide rounding
+static DiyFp multiply(DiyFp a, DiyFp b) {
+  __uint128_t product = (__uint128_t)a.f * b.f;
+  uint64_t high = (uint64_t)(product >> 64);
+  uint64_t low = (uint64_t)product;
+  return (DiyFp){high + (low >> 63), a.e + b.e + 64};
+}
+
+// the neighbours halfway to the next double below and above, sharing the
+// upper one's exponent
+static void boundaries(DiyFp value, DiyFp *minus, DiyFp *plus) {
+  *plus = normalize((DiyFp){(value.f << 1) + 1, value.e - 1});
+  // the gap below a power of two is half the gap above
+  *minus = value.f == HIDDEN_BIT ? (DiyFp){(value.f << 2) - 1, value.e - 2}
+                                 : (DiyFp){(value.f << 1) - 1, value.e - 1};
+  minus->f <<= minus->e - plus->e;
+  minus->e = plus->e;
+}
+
+// a cached power c with -60 <= e + c.e <= -32, so the integral part of the
+// scaled value fits in 32 bits
+static CachedPower cached_power(int e, int *k) {
+  double estimate = (-61 - e) * 0.30102999566398114 + 347;
+  int power = (int)estimate;
+  if (estimate - power > 0.0)
+    power++;
+  size_t index = (size_t)((power >> 3) + 1);
+  *k = -(-348 + (int)index * 8);
+  return CACHED_POWERS[index];
+}
+
+static int count_digits(uint32_t n) {
+  int digits = 1;
+  while (n >= 10) {
+    n /= 10;
+    digits++;
+  }
+  return digits;
+}
+
+// moves the last digit down while that brings it closer to the exact value
+// and stays inside the rounding interval
+static void round_last_digit(char *digits, int length, uint64_t delta,
+                             uint64_t rest, uint64_t ten_kappa,
+                             uint64_t distance) {
+  while (rest < distance && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < distance ||
+          distance - rest > rest + ten_kappa - distance)) {
+    digits[length - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static int generate_digits(DiyFp w, DiyFp upper, uint64_t delta, char *digits,
+                           int *k) {
+  DiyFp one = {1ull << -upper.e, upper.e};
+  uint64_t distance = upper.f - w.f;
+  uint32_t integral = (uint32_t)(upper.f >> -one.e);
+  uint64_t fraction = upper.f & (one.f - 1);
+  int kappa = count_digits(integral);
+  int length = 0;
+
+  while (kappa > 0) {
+    uint32_t divisor = (uint32_t)POWERS_OF_TEN[kappa - 1];
+    uint32_t digit = integral / divisor;
+    integral %= divisor;
+    if (digit != 0 || length != 0)
+      digits[length++] = (char)('0' + digit);
+    kappa--;
+    uint64_t rest = ((uint64_t)integral << -one.e) + fraction;
+    if (rest <= delta) {
+      *k += kappa;
+      round_last_digit(digits, length, delta, rest,
+                       POWERS_OF_TEN[kappa] << -one.e, distance);
+      return length;
+    }
+  }
+
+  for (;;) {
+    fraction *= 10;
+    delta *= 10;
+    char digit = (char)(fraction >> -one.e);
+    if (digit != 0 || length != 0)
+      digits[length++] = (char)('0' + digit);
+    fraction &= one.f - 1;
+    kappa--;
+    if (fraction < delta) {
+      *k += kappa;
+      int index = -kappa;
+      round_last_digit(digits, length, delta, fraction, one.f,
+                       index < 20 ? distance * POWERS_OF_TEN[index] : 0);
+      return length;
+    }
+  }
+}
+
+// the shortest digits of a positive finite value, which equals
+// digits * 10^exponent
+static int grisu2(double value, char *digits, int *exponent) {
+  DiyFp v = double_to_diy_fp(value);
+  DiyFp minus, plus;
+  boundaries(v, &minus, &plus);
+
+  int k;
+  CachedPower power = cached_power(plus.e, &k);
+  DiyFp c = {power.f, power.binary_exponent};
+  DiyFp w = multiply(normalize(v), c);
+  DiyFp upper = multiply(plus, c);
+  DiyFp lower = multiply(minus, c);
+  // shrink the interval by one unit on each side for the rounding error of
+  // the products
+  lower.f++;
+  upper.f--;
+  *exponent = k;
+  return generate_digits(w, upper, upper.f - lower.f, digits, exponent);
+}
+
+static int write_uint(uint64_t value, char *buffer) {
+  char reversed[20];
+  int length = 0;
+  do {
+    reversed[length++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  for (int i = 0; i < length; i++)
+    buffer[i] = reversed[length - 1 - i];
+  return length;
+}
+
+// places the decimal point: plain notation for exponents a reader can take
+// in at a glance, scientific notation beyond that
+static int write_decimal(const char *digits, int length, int exponent,
+                         char *buffer) {
+  int point = length + exponent;
+  int written = 0;
+  if (exponent >= 0 && point <= 21) {
+    memcpy(buffer, digits, length);
+    memset(buffer + length, '0', exponent);
+    written = point;
+    memcpy(buffer + written, ".0", 2);
+    return written + 2;
+  }
+  if (point > 0 && point <= 21) {
+    memcpy(buffer, digits, point);
+    buffer[point] = '.';
+    memcpy(buffer + point + 1, digits + point, length - point);
+    return length + 1;
+  }
+  if (point > -6 && point <= 0) {
+    memcpy(buffer, "0.", 2);
+    memset(buffer + 2, '0', -point);
+    memcpy(buffer + 2 - point, digits, length);
+    return 2 - point + length;
+  }
+
+  buffer[written++] = digits[0];
+  if (length > 1) {
+    buffer[written++] = '.';
+    memcpy(buffer + written, digits + 1, length - 1);
+    written += length - 1;
+  }
+  buffer[written++] = 'e';
+  int power = point - 1;
+  if (power < 0) {
+    buffer[written++] = '-';
+    power = -power;
+  }
+  return written + write_uint((uint64_t)power, buffer + written);
+}
+
+int format_number(double value, char *buffer) {
+  int written = 0;
+  if (isnan(value)) {
+    memcpy(buffer, "nan", 4);
+    return 3;
+  }
+  if (signbit(value)) {
+    buffer[written++] = '-';
+    value = -value;
+  }
+  if (isinf(value)) {
+    memcpy(buffer + written, "inf", 4);
+    return written + 3;
+  }
+
+  // integers are most of what scripts print and need no digit search
+  if (value < 9007199254740992.0 && value == (double)(uint64_t)value) {
+    written += write_uint((uint64_t)value, buffer + written);
+    memcpy(buffer + written, ".0", 3);
+    return written + 2;
+  }
+
+  char digits[24];
+  int exponent;
+  int length = grisu2(value, digits, &exponent);
+  written += write_decimal(digits, length, exponent, buffer + written);
+  buffer[written] = '\0';
+  return written;
+}
+
+int format_integer(int64_t value, char *buffer) {
+  int written = 0;
+  uint64_t magnitude = (uint64_t)value;
+  if (value < 0) {
+    buffer[written++] = '-';
+    magnitude = 0 - magnitude;
+  }
+  written += write_uint(magnitude, buffer + written);
+  buffer[written] = '\0';
+  return written;
+}
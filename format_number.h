@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+// longest output: sign, 17 digits, point, "e-324" and the terminator
+#define FORMAT_NUMBER_SIZE 32
+
+// writes the shortest decimal that reads back as value, null terminated, and
+// returns its length. Integral values keep a ".0" suffix
+int format_number(double value, char *buffer);
+// writes value in decimal without a fractional part, null terminated, and
+// returns its length
+int format_integer(int64_t value, char *buffer);
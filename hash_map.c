@@ -3,129 +3,417 @@
 #include "object.h"
 #include "value.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Allocate more space one 75 percent full
-#define TABLE_MAX_LOAD 0.75
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GROUP_WIDTH 16
+// rehash once 7/8 of the slots are used (live entries or tombstones)
+#define TABLE_MAX_LOAD_NUMERATOR 7
+#define TABLE_MAX_LOAD_DENOMINATOR 8
+
+#define CONTROL_EMPTY ((int8_t)-128)
+#define CONTROL_DELETED ((int8_t)-2)
+
+// the high bits pick the group, the low 7 bits are stored in the control byte
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((int8_t)((hash) & 0x7f))
+
+// old slots moved into the new array by each insert or delete during a resize.
+// The new array has room for at least twice the live entries so the migration
+// always finishes before it fills up
+#define TABLE_MIGRATE_BATCH 64
+
+#define NOT_FOUND SIZE_MAX
+
+typedef uint32_t GroupMask;
+
+static size_t max_load(size_t capacity) {
+  return capacity / TABLE_MAX_LOAD_DENOMINATOR * TABLE_MAX_LOAD_NUMERATOR;
+}
+
+#ifdef __SSE2__
+static GroupMask match_byte(const int8_t *group, int8_t byte) {
+  __m128i control = _mm_loadu_si128((const __m128i *)group);
+  return (GroupMask)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(control, _mm_set1_epi8(byte)));
+}
+
+// EMPTY and DELETED are the only control bytes with the sign bit set
+static GroupMask match_empty_or_deleted(const int8_t *group) {
+  __m128i control = _mm_loadu_si128((const __m128i *)group);
+  return (GroupMask)_mm_movemask_epi8(control);
+}
+#else
+static GroupMask match_byte(const int8_t *group, int8_t byte) {
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    if (group[i] == byte)
+      mask |= (GroupMask)1 << i;
+  }
+  return mask;
+}
+
+static GroupMask match_empty_or_deleted(const int8_t *group) {
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    if (group[i] < 0)
+      mask |= (GroupMask)1 << i;
+  }
+  return mask;
+}
+#endif
+
+static GroupMask match_empty(const int8_t *group) {
+  return match_byte(group, CONTROL_EMPTY);
+}
+
+static int lowest_bit(GroupMask mask) { return __builtin_ctz(mask); }
+
+// groups are visited in triangular order which covers every group when the
+// number of groups is a power of two
+typedef struct {
+  size_t mask;
+  size_t group;
+  size_t step;
+} ProbeSequence;
+
+static ProbeSequence start_probe(TableSlots *slots, uint32_t hash) {
+  size_t mask = slots->capacity / GROUP_WIDTH - 1;
+  return (ProbeSequence){mask, H1(hash) & mask, 0};
+}
+
+static void next_probe(ProbeSequence *probe) {
+  probe->step++;
+  probe->group = (probe->group + probe->step) & probe->mask;
+}
+
+static void init_slots(TableSlots *slots) {
+  slots->capacity = 0;
+  slots->control = NULL;
+  slots->entries = NULL;
+}
+
+static void free_slots(TableSlots *slots) {
+  free(slots->control);
+  free(slots->entries);
+  init_slots(slots);
+}
+
+static void allocate_slots(TableSlots *slots, size_t capacity) {
+  slots->control = (int8_t *)malloc(capacity);
+  slots->entries = (Entry *)malloc(capacity * sizeof(Entry));
+  if (slots->control == NULL || slots->entries == NULL) {
+    printf("failed to allocate memory when inserting into hash map\n");
+    exit(1);
+  }
+  memset(slots->control, CONTROL_EMPTY, capacity);
+  slots->capacity = capacity;
+}
 
 void init_hash_map(Table *table) {
   table->count = 0;
-  table->capacity = 0;
-  table->entries = NULL;
+  table->growth_left = 0;
+  table->migrate_index = 0;
+  init_slots(&table->slots);
+  init_slots(&table->old_slots);
 }
 
 void free_hash_map(Table *table) {
-  if (table->entries) {
-    free(table->entries);
-  }
+  free_slots(&table->slots);
+  free_slots(&table->old_slots);
   init_hash_map(table);
 }
 
-static void create_tombstone_entry(Entry *entry) {
-  entry->value = BOOL_VAL(true);
-  entry->key = NULL;
+bool is_table_resizing(Table *table) { return table->old_slots.capacity != 0; }
+
+// string keys are interned and other objects compare by identity
+static inline bool key_matches(const Entry *entry, Value key) {
+  if (entry->key_type != key.type)
+    return false;
+  switch (key.type) {
+  case VAL_OBJ:
+    return entry->key_as.obj == AS_OBJ(key);
+  case VAL_NUMBER:
+    return entry->key_as.number == AS_NUMBER(key);
+  case VAL_BOOL:
+    return entry->key_as.boolean == AS_BOOL(key);
+  case VAL_INT:
+    return entry->key_as.integer == AS_INT(key);
+  default:
+    return true;
+  }
+}
+
+static Entry make_entry(Value key, uint32_t hash, Value value) {
+  Entry entry;
+  entry.key_type = key.type;
+  entry.hash = hash;
+  memcpy(&entry.key_as, &key.as, sizeof(entry.key_as));
+  entry.value = value;
+  return entry;
 }
 
-static bool is_tombstone_entry(Entry *entry) {
-  return (entry->key == NULL &&
-          (IS_BOOL(entry->value) && AS_BOOL(entry->value)));
+static uint32_t mix_bits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  bits *= 0xc4ceb9fe1a85ec53ULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
 }
 
-Entry *find_entry(Entry *entries, size_t capacity, ObjString *key) {
-  int index = key->hash % capacity;
-  Entry *tombstone = NULL;
+// strings reuse the hash computed when they were interned
+uint32_t hash_value(Value value) {
+  switch (value.type) {
+  case VAL_BOOL:
+    return AS_BOOL(value) ? 0x9e3779b9u : 0x7f4a7c15u;
+  case VAL_NUMBER: {
+    // 0 and -0 are the same key
+    double number = AS_NUMBER(value) == 0 ? 0 : AS_NUMBER(value);
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return mix_bits(bits);
+  }
+  case VAL_INT:
+    return mix_bits((uint64_t)AS_INT(value));
+  case VAL_OBJ:
+    if (IS_STRING(value))
+      return AS_STRING(value)->hash;
+    return mix_bits((uint64_t)(uintptr_t)AS_OBJ(value));
+  default:
+    return 0;
+  }
+}
 
+static size_t find_slot(TableSlots *slots, Value key, uint32_t hash) {
+  if (slots->capacity == 0)
+    return NOT_FOUND;
+
+  ProbeSequence probe = start_probe(slots, hash);
   for (;;) {
-    Entry *entry = &entries[index];
-
-    if (entry->key == NULL) {
-      // if we reach a empty entry return latest tombstone for reuse
-      if (!is_tombstone_entry(entry)) {
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        if (tombstone == NULL)
-          tombstone = entry;
-      }
-    } else if (memcmp(entry->key->chars, key->chars, key->length) == 0) {
-      return entry;
+    const int8_t *group = &slots->control[probe.group * GROUP_WIDTH];
+    GroupMask matches = match_byte(group, H2(hash));
+    while (matches) {
+      size_t index = probe.group * GROUP_WIDTH + lowest_bit(matches);
+      Entry *entry = &slots->entries[index];
+      if (entry->hash == hash && key_matches(entry, key))
+        return index;
+      matches &= matches - 1;
     }
 
-    index = (index + 1) % capacity;
+    // a key would never have been placed past a group with an empty slot
+    if (match_empty(group))
+      return NOT_FOUND;
+    next_probe(&probe);
+  }
+}
+
+static size_t find_insert_slot(TableSlots *slots, uint32_t hash) {
+  ProbeSequence probe = start_probe(slots, hash);
+  for (;;) {
+    GroupMask free_slots =
+        match_empty_or_deleted(&slots->control[probe.group * GROUP_WIDTH]);
+    if (free_slots)
+      return probe.group * GROUP_WIDTH + lowest_bit(free_slots);
+    next_probe(&probe);
+  }
+}
+
+// marks a slot as free. If the group still has an empty slot no probe sequence
+// ever continued past it, so the slot can go straight back to empty instead of
+// becoming a tombstone. Returns true if the slot became empty
+static bool clear_slot(TableSlots *slots, size_t index) {
+  size_t group = index / GROUP_WIDTH * GROUP_WIDTH;
+  slots->entries[index].key_type = VAL_NIL;
+  if (match_empty(&slots->control[group])) {
+    slots->control[index] = CONTROL_EMPTY;
+    return true;
   }
+  slots->control[index] = CONTROL_DELETED;
+  return false;
 }
 
-void clear_table(Entry *entries, size_t capacity) {
-  for (int i = 0; i < capacity; i++) {
-    entries[i].key = NULL;
-    entries[i].value = NIL_VAL;
+// places an entry known not to be in the table into an empty slot, the caller
+// has checked growth_left
+static void place_entry(Table *table, Entry entry) {
+  TableSlots *slots = &table->slots;
+  size_t index = find_insert_slot(slots, entry.hash);
+  if (slots->control[index] == CONTROL_EMPTY)
+    table->growth_left--;
+  slots->control[index] = H2(entry.hash);
+  slots->entries[index] = entry;
+}
+
+// moves up to limit old slots into the current slots, releasing the old
+// arrays once every slot has been visited
+static void migrate_slots(Table *table, size_t limit) {
+  TableSlots *old_slots = &table->old_slots;
+  size_t end = table->migrate_index + limit;
+  if (end > old_slots->capacity)
+    end = old_slots->capacity;
+
+  for (size_t i = table->migrate_index; i < end; i++) {
+    if (old_slots->control[i] >= 0) {
+      place_entry(table, old_slots->entries[i]);
+      // lookups still probe the old slots, they must not find a stale copy
+      old_slots->control[i] = CONTROL_DELETED;
+    }
+  }
+
+  table->migrate_index = end;
+  if (end == old_slots->capacity) {
+    free_slots(old_slots);
+    table->migrate_index = 0;
   }
 }
 
-// returns number of entries
-size_t copy_entries(Table *table, Entry *entries, size_t capacity) {
-  size_t count = 0;
-  for (int i = 0; i < table->capacity; i++) {
-    Entry *entry = &table->entries[i];
-    // skips over tombstones to not waste space
-    if (entry->key == NULL)
-      continue;
+// swaps in freshly allocated slots and starts moving entries over. Tables that
+// are mostly tombstones are rehashed at the same size
+static void start_resize(Table *table) {
+  if (is_table_resizing(table))
+    migrate_slots(table, table->old_slots.capacity);
 
-    Entry *dest = find_entry(entries, capacity, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
-    count++;
+  size_t capacity = table->slots.capacity;
+  if (capacity == 0) {
+    capacity = GROUP_WIDTH;
+  } else if (table->count + 1 > max_load(capacity) / 2) {
+    capacity = get_new_array_capacity(capacity);
   }
-  return count;
+
+  table->old_slots = table->slots;
+  table->migrate_index = 0;
+  allocate_slots(&table->slots, capacity);
+  table->growth_left = max_load(capacity);
 }
 
-void grow_table(Table *table) {
-  size_t capacity = get_new_array_capacity(table->capacity);
-  Entry *entries = (Entry *)malloc(capacity * sizeof(Entry));
-  if (entries == NULL) {
-    printf("failed to allocate memory when inserting into hash map\n");
-    exit(1);
+// room for count entries without rehashing, for tables whose final size is
+// known up front
+void reserve_hash_map(Table *table, size_t count) {
+  if (count <= max_load(table->slots.capacity) || table->count > 0)
+    return;
+  size_t capacity = GROUP_WIDTH;
+  while (max_load(capacity) < count)
+    capacity *= 2;
+  free_slots(&table->slots);
+  allocate_slots(&table->slots, capacity);
+  table->growth_left = max_load(capacity);
+}
+
+// returns true if the key was not already in the table
+static bool insert_hashed(Table *table, Value key, uint32_t hash,
+                          Value value) {
+  if (is_table_resizing(table))
+    migrate_slots(table, TABLE_MIGRATE_BATCH);
+
+  size_t index = find_slot(&table->slots, key, hash);
+  if (index != NOT_FOUND) {
+    table->slots.entries[index].value = value;
+    return false;
+  }
+  // not migrated yet, updating in place is fine as it will be moved as is
+  if (is_table_resizing(table)) {
+    index = find_slot(&table->old_slots, key, hash);
+    if (index != NOT_FOUND) {
+      table->old_slots.entries[index].value = value;
+      return false;
+    }
   }
-  clear_table(entries, capacity);
-  // TODO: is there a better way to create new hashmap without recopying all
-  // previous entries
-  size_t num_entries = copy_entries(table, entries, capacity);
 
-  free_hash_map(table);
-  table->entries = entries;
-  table->capacity = capacity;
-  table->count = num_entries;
+  if (table->slots.capacity == 0) {
+    start_resize(table);
+  }
+  index = find_insert_slot(&table->slots, hash);
+  // reusing a tombstone does not eat into the load budget
+  if (table->slots.control[index] == CONTROL_EMPTY &&
+      table->growth_left == 0) {
+    start_resize(table);
+  }
+
+  place_entry(table, make_entry(key, hash, value));
+  table->count++;
+  return true;
 }
 
 bool insert_entry(Table *table, ObjString *key, Value value) {
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-    grow_table(table);
-  }
+  return insert_hashed(table, OBJ_VAL(key), key->hash, value);
+}
 
-  Entry *entry = find_entry(table->entries, table->capacity, key);
-  bool is_new_key = entry->key == NULL;
-  // if not a tombstone and a new key
-  if (is_new_key && !is_tombstone_entry(entry))
-    table->count++;
+// any key but nil, strings must be interned (flat and not a view)
+bool insert_value_entry(Table *table, Value key, Value value) {
+  return insert_hashed(table, key, hash_value(key), value);
+}
+
+static Entry *find_entry(Table *table, Value key, uint32_t hash) {
+  if (table->count == 0)
+    return NULL;
+
+  size_t index = find_slot(&table->slots, key, hash);
+  if (index != NOT_FOUND)
+    return &table->slots.entries[index];
 
-  entry->value = value;
-  entry->key = key;
-  return is_new_key;
+  if (is_table_resizing(table)) {
+    index = find_slot(&table->old_slots, key, hash);
+    if (index != NOT_FOUND)
+      return &table->old_slots.entries[index];
+  }
+  return NULL;
 }
 
+// lookups never migrate so concurrent readers are safe
 bool get_entry(Table *table, ObjString *key, Value *value) {
   if (table->count <= 0) {
     printf("Failed to retrieve entry, no entries in table\n");
     return false;
   }
 
-  Entry *entry = find_entry(table->entries, table->capacity, key);
-  bool is_key_match = entry->key != NULL;
-  if (is_key_match) {
-    *value = entry->value;
+  Entry *entry = find_entry(table, OBJ_VAL(key), key->hash);
+  if (entry == NULL)
+    return false;
+
+  *value = entry->value;
+  return true;
+}
+
+bool get_value_entry(Table *table, Value key, Value *value) {
+  Entry *entry = find_entry(table, key, hash_value(key));
+  if (entry == NULL)
+    return false;
+
+  *value = entry->value;
+  return true;
+}
+
+static bool delete_hashed(Table *table, Value key, uint32_t hash) {
+  if (table->count == 0)
+    return false;
+
+  if (is_table_resizing(table))
+    migrate_slots(table, TABLE_MIGRATE_BATCH);
+
+  size_t index = find_slot(&table->slots, key, hash);
+  if (index != NOT_FOUND) {
+    if (clear_slot(&table->slots, index))
+      table->growth_left++;
+    table->count--;
+    return true;
+  }
+
+  if (is_table_resizing(table)) {
+    index = find_slot(&table->old_slots, key, hash);
+    if (index != NOT_FOUND) {
+      // the migration only looks at control bytes so any free marker will do
+      clear_slot(&table->old_slots, index);
+      table->count--;
+      return true;
+    }
   }
-  return is_key_match;
+  return false;
 }
 
 bool delete_entry(Table *table, ObjString *key) {
@@ -133,13 +421,67 @@ bool delete_entry(Table *table, ObjString *key) {
     printf("Failed to delete entry, no entries in table\n");
     return false;
   }
+  return delete_hashed(table, OBJ_VAL(key), key->hash);
+}
+
+bool delete_value_entry(Table *table, Value key) {
+  return delete_hashed(table, key, hash_value(key));
+}
+
+// walks the live entries, old slots first while a resize is in progress.
+// position starts at 0, NULL marks the end. The table must not change during
+// the walk
+Entry *next_entry(Table *table, size_t *position) {
+  TableSlots *parts[2] = {&table->old_slots, &table->slots};
+  size_t offset = 0;
+  for (int part = 0; part < 2; part++) {
+    TableSlots *slots = parts[part];
+    while (*position < offset + slots->capacity) {
+      size_t index = (*position)++ - offset;
+      if (slots->control[index] >= 0)
+        return &slots->entries[index];
+    }
+    offset += slots->capacity;
+  }
+  return NULL;
+}
+
+static ObjString *find_string_in_slots(TableSlots *slots, const char *chars,
+                                       size_t length, uint32_t hash) {
+  if (slots->capacity == 0)
+    return NULL;
 
-  Entry *entry = find_entry(table->entries, table->capacity, key);
-  bool key_found = entry->key != NULL;
-  if (key_found) {
-    // add tombstone entry
-    create_tombstone_entry(entry);
+  ProbeSequence probe = start_probe(slots, hash);
+  for (;;) {
+    const int8_t *group = &slots->control[probe.group * GROUP_WIDTH];
+    GroupMask matches = match_byte(group, H2(hash));
+    while (matches) {
+      Entry *entry =
+          &slots->entries[probe.group * GROUP_WIDTH + lowest_bit(matches)];
+      ObjString *key = (ObjString *)entry->key_as.obj;
+      if (entry->hash == hash && key->length == length &&
+          memcmp(key->chars, chars, length) == 0) {
+        return key;
+      }
+      matches &= matches - 1;
+    }
+
+    if (match_empty(group))
+      return NULL;
+    next_probe(&probe);
   }
+}
+
+// looks up an interned string by its contents, this is the only place where
+// keys are compared character by character
+ObjString *find_string(Table *table, const char *chars, size_t length,
+                       uint32_t hash) {
+  if (table->count == 0)
+    return NULL;
 
-  return key_found;
+  ObjString *string =
+      find_string_in_slots(&table->slots, chars, length, hash);
+  if (string == NULL && is_table_resizing(table))
+    string = find_string_in_slots(&table->old_slots, chars, length, hash);
+  return string;
 }
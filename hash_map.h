@@ -1,24 +1,66 @@
 #pragma once
 
 #include "value.h"
+#include <stdint.h>
+#include <string.h>
 
+// keys are strings for globals and the intern table, any value but nil for
+// dictionaries. String keys are interned so they compare by identity. The key
+// is split into its type and payload so the hash fits in what would be the
+// key's padding, keeping an entry at 32 bytes
 typedef struct {
-  ObjString *key;
+  ValueType key_type;
+  uint32_t hash;
+  union {
+    bool boolean;
+    double number;
+    Obj *obj;
+    int64_t integer;
+  } key_as;
   Value value;
 } Entry;
 
+static inline Value entry_key(const Entry *entry) {
+  Value key;
+  key.type = entry->key_type;
+  memcpy(&key.as, &entry->key_as, sizeof(key.as));
+  return key;
+}
+
 typedef struct {
-  size_t count;
   size_t capacity;
+  int8_t *control;
   Entry *entries;
+} TableSlots;
+
+// Open addressing table in the style of a swiss table. Each slot has a control
+// byte holding either EMPTY, DELETED or the low 7 bits of the key's hash, the
+// control bytes are probed a group of 16 slots at a time and entries are only
+// touched when their hash fragment matches. Full hashes are stored next to the
+// keys so rehashing never dereferences a key.
+//
+// Resizing is incremental: the previous slots are kept in old_slots and every
+// insert or delete moves a bounded number of them over, lookups check both.
+typedef struct {
+  size_t count;
+  // inserts into empty slots left before the table has to be rehashed
+  size_t growth_left;
+  TableSlots slots;
+  TableSlots old_slots;
+  size_t migrate_index;
 } Table;
 
 void init_hash_map(Table *table);
 void free_hash_map(Table *table);
-Entry *find_entry(Entry *entries, size_t capacity, ObjString *key);
-void clear_table(Entry *entries, size_t capacity);
-size_t copy_entries(Table *table, Entry *entries, size_t capacity);
-void grow_table(Table *table);
 bool insert_entry(Table *table, ObjString *key, Value value);
 bool get_entry(Table *table, ObjString *key, Value *value);
 bool delete_entry(Table *table, ObjString *key);
+bool is_table_resizing(Table *table);
+void reserve_hash_map(Table *table, size_t count);
+uint32_t hash_value(Value value);
+bool insert_value_entry(Table *table, Value key, Value value);
+bool get_value_entry(Table *table, Value key, Value *value);
+bool delete_value_entry(Table *table, Value key);
+Entry *next_entry(Table *table, size_t *position);
+ObjString *find_string(Table *table, const char *chars, size_t length,
+                       uint32_t hash);
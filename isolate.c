@@ -0,0 +1,61 @@
+#include "isolate.h"
+#include "chunk.h"
+#include "value.h"
+#include "vm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void *run_isolate(void *argument) {
+  Isolate *isolate = (Isolate *)argument;
+  VM vm;
+  init_vm(&vm);
+  intern_chunk_strings(&vm, isolate->chunk);
+  define_global(&vm, "isolate", INT_VAL(isolate->index));
+  if (isolate->setup != NULL) {
+    isolate->setup(&vm, isolate->index, isolate->user_data);
+  }
+  isolate->result = interpret(&vm, isolate->chunk);
+  free_vm(&vm);
+  return NULL;
+}
+
+// runs count isolates over a frozen chunk and waits for all of them. Each one
+// sees a global `isolate` holding its index. Returns false if a thread could
+// not be started, results (optional) receives each isolate's outcome
+bool run_isolates(Chunk *chunk, size_t count, IsolateSetup setup,
+                  void *user_data, InterpretResponse *results) {
+  if (!chunk->frozen) {
+    fprintf(stderr, "isolates can only run a frozen chunk\n");
+    return false;
+  }
+
+  Isolate *isolates = (Isolate *)malloc(count * sizeof(Isolate));
+  if (isolates == NULL) {
+    printf("ran out of memory when creating isolates\n");
+    exit(1);
+  }
+
+  size_t started = 0;
+  for (; started < count; started++) {
+    Isolate *isolate = &isolates[started];
+    isolate->index = started;
+    isolate->chunk = chunk;
+    isolate->setup = setup;
+    isolate->user_data = user_data;
+    isolate->result = RUNTIME_ERROR;
+    if (pthread_create(&isolate->thread, NULL, run_isolate, isolate) != 0) {
+      fprintf(stderr, "failed to start isolate %zu\n", started);
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(isolates[i].thread, NULL);
+    if (results != NULL)
+      results[i] = isolates[i].result;
+  }
+
+  free(isolates);
+  return started == count;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "chunk.h"
+#include "vm.h"
+#include <pthread.h>
+
+// called on the isolate's thread before the chunk runs, typically to define
+// the globals that hold this isolate's input
+typedef void (*IsolateSetup)(VM *vm, size_t index, void *user_data);
+
+// A vm running a frozen chunk on its own thread. The chunk is shared, the
+// stack, globals and heap are private to the isolate
+typedef struct {
+  pthread_t thread;
+  size_t index;
+  Chunk *chunk;
+  IsolateSetup setup;
+  void *user_data;
+  InterpretResponse result;
+} Isolate;
+
+bool run_isolates(Chunk *chunk, size_t count, IsolateSetup setup,
+                  void *user_data, InterpretResponse *results);
@@ -0,0 +1,842 @@
+#include "json.h"
+#include "array.h"
+#include "cpu.h"
+#include "dict.h"
+#include "format_number.h"
+#include "hash_map.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+#include <immintrin.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// cleared by use_json_simd(false)
+static int simd_enabled = 1;
+
+void use_json_simd(bool enabled) {
+  __atomic_store_n(&simd_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+static bool has_avx2(void) {
+  return __atomic_load_n(&simd_enabled, __ATOMIC_RELAXED) && cpu_has_avx2();
+}
+
+// Parsing runs in two passes, like simdjson. The first finds every structural
+// character 64 bytes at a time without branching on the input, the second
+// walks those offsets and only touches the bytes of values.
+
+typedef struct {
+  // 1 when the previous block ended in a backslash that escapes this block's
+  // first byte
+  uint64_t prev_escaped;
+  // all ones when the previous block ended inside a string
+  uint64_t prev_in_string;
+} IndexState;
+
+// bit i of the result is the xor of bits 0..i
+static uint64_t prefix_xor(uint64_t bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+// the structural bits of a 64 byte block. A quote is escaped when an odd run
+// of backslashes ends right before it, which the add below finds for every
+// run at once: adding a run's start bit carries through the run, and whether
+// the carry lands on an odd or even bit gives its parity. Every byte from an
+// unescaped quote up to the next one is inside a string
+static uint64_t block_structurals(IndexState *state, uint64_t backslash,
+                                  uint64_t quote, uint64_t operators) {
+  const uint64_t even_bits = 0x5555555555555555ULL;
+  backslash &= ~state->prev_escaped;
+  uint64_t follows_escape = backslash << 1 | state->prev_escaped;
+  uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+  uint64_t even_sequences;
+  state->prev_escaped =
+      __builtin_add_overflow(odd_starts, backslash, &even_sequences);
+  uint64_t escaped = (even_bits ^ (even_sequences << 1)) & follows_escape;
+
+  quote &= ~escaped;
+  uint64_t in_string = prefix_xor(quote) ^ state->prev_in_string;
+  state->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+  return (operators & ~in_string) | quote;
+}
+
+static size_t flatten_bits(uint32_t *positions, size_t count, size_t base,
+                           uint64_t bits) {
+  while (bits) {
+    positions[count++] = (uint32_t)(base + __builtin_ctzll(bits));
+    bits &= bits - 1;
+  }
+  return count;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+block_mask(__m256i low, __m256i high, __m256i byte) {
+  uint32_t low_mask =
+      (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, byte));
+  uint32_t high_mask =
+      (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, byte));
+  return (uint64_t)high_mask << 32 | low_mask;
+}
+
+// classifies a 64 byte block with two 32 byte loads. Setting bit 0x20 folds
+// [ and ] onto { and }, so the six operators take four compares
+__attribute__((target("avx2"))) static size_t
+index_avx2(const char *text, size_t length, uint32_t *positions,
+           IndexState *state) {
+  __m256i case_bit = _mm256_set1_epi8(0x20);
+  size_t count = 0;
+  for (size_t i = 0; i + 64 <= length; i += 64) {
+    __m256i low = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i high = _mm256_loadu_si256((const __m256i *)(text + i + 32));
+    __m256i folded_low = _mm256_or_si256(low, case_bit);
+    __m256i folded_high = _mm256_or_si256(high, case_bit);
+    uint64_t operators =
+        block_mask(folded_low, folded_high, _mm256_set1_epi8('{')) |
+        block_mask(folded_low, folded_high, _mm256_set1_epi8('}')) |
+        block_mask(low, high, _mm256_set1_epi8(':')) |
+        block_mask(low, high, _mm256_set1_epi8(','));
+    uint64_t structurals = block_structurals(
+        state, block_mask(low, high, _mm256_set1_epi8('\\')),
+        block_mask(low, high, _mm256_set1_epi8('"')), operators);
+    count = flatten_bits(positions, count, i, structurals);
+  }
+  return count;
+}
+
+static bool is_operator(char c) {
+  return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+}
+
+long json_index(const char *text, size_t length, uint32_t *positions) {
+  IndexState state = {0, 0};
+  size_t count = 0;
+  size_t i = 0;
+  if (has_avx2()) {
+    count = index_avx2(text, length, positions, &state);
+    i = length - length % 64;
+  }
+
+  // the scalar fallback, and the last partial block after avx2. It follows
+  // the same rules byte by byte so both give the same index for any input
+  bool in_string = state.prev_in_string != 0;
+  bool escaped = state.prev_escaped != 0;
+  for (; i < length; i++) {
+    char c = text[i];
+    bool was_escaped = escaped;
+    escaped = c == '\\' && !was_escaped;
+    if (c == '"') {
+      if (!was_escaped) {
+        in_string = !in_string;
+        positions[count++] = (uint32_t)i;
+      }
+    } else if (!in_string && is_operator(c)) {
+      positions[count++] = (uint32_t)i;
+    }
+  }
+  return in_string ? -1 : (long)count;
+}
+
+typedef struct {
+  VM *vm;
+  // what string values point into, they are views of the text
+  Obj *owner;
+  const char *chars;
+  size_t length;
+  uint32_t *positions;
+  size_t count;
+  // the next structural to consume
+  size_t next;
+  // the offset just past everything consumed so far
+  size_t cursor;
+  const char *error;
+  size_t error_offset;
+  // elements of the arrays being parsed, the innermost array's last
+  Value *values;
+  size_t value_count;
+  size_t value_capacity;
+  // unescaped strings and numbers for strtod, as long as the text
+  char *scratch;
+} JsonParser;
+
+static bool fail(JsonParser *parser, const char *error, size_t offset) {
+  parser->error = error;
+  parser->error_offset = offset;
+  return false;
+}
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static size_t skip_space(JsonParser *parser, size_t offset) {
+  while (offset < parser->length && is_space(parser->chars[offset]))
+    offset++;
+  return offset;
+}
+
+// the offset of the next structural, the end of the text after the last
+static size_t next_position(JsonParser *parser) {
+  return parser->next < parser->count ? parser->positions[parser->next]
+                                      : parser->length;
+}
+
+// consumes the structural c when only whitespace comes before it
+static bool match(JsonParser *parser, char c) {
+  size_t position = next_position(parser);
+  if (position == parser->length || parser->chars[position] != c ||
+      skip_space(parser, parser->cursor) != position)
+    return false;
+  parser->next++;
+  parser->cursor = position + 1;
+  return true;
+}
+
+static void push_value(JsonParser *parser, Value value) {
+  if (parser->value_count == parser->value_capacity) {
+    parser->value_capacity = get_new_array_capacity(parser->value_capacity);
+    parser->values = (Value *)grow_array_size(
+        parser->values, parser->value_capacity * sizeof(Value));
+    if (parser->values == NULL) {
+      printf("ran out of memory when parsing json\n");
+      exit(1);
+    }
+  }
+  parser->values[parser->value_count++] = value;
+}
+
+static bool read_hex(const char *chars, size_t length, uint32_t *code) {
+  if (length < 4)
+    return false;
+  *code = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = chars[i];
+    uint32_t digit;
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+      digit = (c | 0x20) - 'a' + 10;
+    else
+      return false;
+    *code = *code << 4 | digit;
+  }
+  return true;
+}
+
+static size_t encode_utf8(uint32_t code, char *dest) {
+  if (code < 0x80) {
+    dest[0] = (char)code;
+    return 1;
+  }
+  if (code < 0x800) {
+    dest[0] = (char)(0xc0 | code >> 6);
+    dest[1] = (char)(0x80 | (code & 0x3f));
+    return 2;
+  }
+  if (code < 0x10000) {
+    dest[0] = (char)(0xe0 | code >> 12);
+    dest[1] = (char)(0x80 | (code >> 6 & 0x3f));
+    dest[2] = (char)(0x80 | (code & 0x3f));
+    return 3;
+  }
+  dest[0] = (char)(0xf0 | code >> 18);
+  dest[1] = (char)(0x80 | (code >> 12 & 0x3f));
+  dest[2] = (char)(0x80 | (code >> 6 & 0x3f));
+  dest[3] = (char)(0x80 | (code & 0x3f));
+  return 4;
+}
+
+// writes the string between the quotes with its escapes replaced into
+// scratch, which never needs more room than the escaped string took
+static bool unescape(JsonParser *parser, const char *chars, size_t length,
+                     size_t *unescaped_length) {
+  char *dest = parser->scratch;
+  size_t i = 0;
+  while (i < length) {
+    const char *backslash = (const char *)memchr(chars + i, '\\', length - i);
+    size_t run =
+        backslash == NULL ? length - i : (size_t)(backslash - chars) - i;
+    memcpy(dest, chars + i, run);
+    dest += run;
+    i += run;
+    if (backslash == NULL)
+      break;
+
+    // the index never ends a string on an escaping backslash, so a
+    // character follows it
+    size_t offset = (size_t)(chars - parser->chars) + i;
+    char c = chars[i + 1];
+    i += 2;
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      *dest++ = c;
+      break;
+    case 'b':
+      *dest++ = '\b';
+      break;
+    case 'f':
+      *dest++ = '\f';
+      break;
+    case 'n':
+      *dest++ = '\n';
+      break;
+    case 'r':
+      *dest++ = '\r';
+      break;
+    case 't':
+      *dest++ = '\t';
+      break;
+    case 'u': {
+      uint32_t code, low;
+      if (!read_hex(chars + i, length - i, &code))
+        return fail(parser, "invalid unicode escape", offset);
+      i += 4;
+      if (code >= 0xdc00 && code < 0xe000)
+        return fail(parser, "invalid unicode escape", offset);
+      if (code >= 0xd800 && code < 0xdc00) {
+        // a surrogate pair for a code point past the first 64k
+        if (i + 6 > length || chars[i] != '\\' || chars[i + 1] != 'u' ||
+            !read_hex(chars + i + 2, length - i - 2, &low) || low < 0xdc00 ||
+            low >= 0xe000)
+          return fail(parser, "invalid unicode escape", offset);
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        i += 6;
+      }
+      dest += encode_utf8(code, dest);
+      break;
+    }
+    default:
+      return fail(parser, "invalid escape", offset);
+    }
+  }
+  *unescaped_length = (size_t)(dest - parser->scratch);
+  return true;
+}
+
+// a string starting at the next structural, which is its opening quote. The
+// closing quote is the structural after it. Values without escapes are views
+// of the text, keys are interned like every dictionary key
+static bool parse_string(JsonParser *parser, bool key, Value *value) {
+  size_t open = parser->positions[parser->next];
+  size_t close = parser->positions[parser->next + 1];
+  parser->next += 2;
+  parser->cursor = close + 1;
+
+  const char *chars = parser->chars + open + 1;
+  size_t length = close - open - 1;
+  if (memchr(chars, '\\', length) == NULL) {
+    *value = key ? OBJ_VAL(copy_string(parser->vm, chars, length))
+                 : OBJ_VAL(new_string_view(parser->vm, parser->owner,
+                                           (char *)chars, length));
+    return true;
+  }
+  size_t unescaped_length;
+  if (!unescape(parser, chars, length, &unescaped_length))
+    return false;
+  *value = OBJ_VAL(copy_string(parser->vm, parser->scratch, unescaped_length));
+  return true;
+}
+
+// checks the json number grammar while collecting the digits. Integers that
+// fit in 64 bits become integers. Up to 19 digits and a small exponent
+// convert exactly with one multiply or divide by
+// a power of ten, which every double represents exactly up to 1e22
+static bool parse_number(JsonParser *parser, size_t start, size_t length,
+                         Value *value) {
+  static const double powers_of_ten[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *text = parser->chars + start;
+  size_t i = 0;
+  bool negative = text[0] == '-';
+  if (negative)
+    i++;
+  if (i == length || !is_digit(text[i]))
+    return fail(parser, "invalid number", start);
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool integral = true;
+  if (text[i] == '0') {
+    i++;
+  } else {
+    for (; i < length && is_digit(text[i]); i++, digits++)
+      mantissa = mantissa * 10 + (uint64_t)(text[i] - '0');
+  }
+  if (i < length && text[i] == '.') {
+    integral = false;
+    size_t first = ++i;
+    for (; i < length && is_digit(text[i]); i++, digits++, exponent--)
+      mantissa = mantissa * 10 + (uint64_t)(text[i] - '0');
+    if (i == first)
+      return fail(parser, "invalid number", start);
+  }
+  if (i < length && (text[i] | 0x20) == 'e') {
+    integral = false;
+    i++;
+    bool negative_exponent = i < length && text[i] == '-';
+    if (i < length && (text[i] == '-' || text[i] == '+'))
+      i++;
+    size_t first = i;
+    int written = 0;
+    for (; i < length && is_digit(text[i]); i++) {
+      if (written < 100000)
+        written = written * 10 + (text[i] - '0');
+    }
+    if (i == first)
+      return fail(parser, "invalid number", start);
+    exponent += negative_exponent ? -written : written;
+  }
+  if (i != length)
+    return fail(parser, "invalid number", start);
+
+  if (integral && digits <= 19 && mantissa <= (uint64_t)INT64_MAX) {
+    *value = INT_VAL(negative ? -(int64_t)mantissa : (int64_t)mantissa);
+    return true;
+  }
+  if (digits <= 19 && mantissa <= (1ULL << 53) && exponent >= -22 &&
+      exponent <= 22) {
+    double number = (double)mantissa;
+    number = exponent < 0 ? number / powers_of_ten[-exponent]
+                          : number * powers_of_ten[exponent];
+    *value = NUMBER_VAL(negative ? -number : number);
+    return true;
+  }
+  // everything else goes through strtod, which needs a terminated copy
+  memcpy(parser->scratch, text, length);
+  parser->scratch[length] = '\0';
+  *value = NUMBER_VAL(strtod(parser->scratch, NULL));
+  return true;
+}
+
+// true, false, null or a number, which run from start to the next structural
+static bool parse_scalar(JsonParser *parser, size_t start, Value *value) {
+  size_t end = next_position(parser);
+  while (end > start && is_space(parser->chars[end - 1]))
+    end--;
+  parser->cursor = end;
+
+  const char *text = parser->chars + start;
+  size_t length = end - start;
+  if (length == 4 && memcmp(text, "true", 4) == 0) {
+    *value = BOOL_VAL(true);
+  } else if (length == 5 && memcmp(text, "false", 5) == 0) {
+    *value = BOOL_VAL(false);
+  } else if (length == 4 && memcmp(text, "null", 4) == 0) {
+    *value = NIL_VAL;
+  } else if (text[0] == '-' || is_digit(text[0])) {
+    return parse_number(parser, start, length, value);
+  } else {
+    return fail(parser, "expected a value", start);
+  }
+  return true;
+}
+
+static bool parse_value(JsonParser *parser, int depth, Value *value);
+
+static bool parse_object(JsonParser *parser, int depth, Value *value) {
+  if (depth > JSON_MAX_DEPTH)
+    return fail(parser, "nested too deeply", parser->positions[parser->next]);
+  parser->cursor = parser->positions[parser->next++] + 1;
+  ObjDict *dict = new_dict(parser->vm);
+  *value = OBJ_VAL(dict);
+  if (match(parser, '}'))
+    return true;
+
+  do {
+    Value key, member;
+    size_t start = skip_space(parser, parser->cursor);
+    if (start == parser->length || next_position(parser) != start ||
+        parser->chars[start] != '"')
+      return fail(parser, "expected a string key", start);
+    if (!parse_string(parser, true, &key))
+      return false;
+    if (!match(parser, ':'))
+      return fail(parser, "expected ':'", skip_space(parser, parser->cursor));
+    if (!parse_value(parser, depth, &member))
+      return false;
+    insert_value_entry(&dict->table, key, member);
+  } while (match(parser, ','));
+
+  if (!match(parser, '}'))
+    return fail(parser, "expected ',' or '}'",
+                skip_space(parser, parser->cursor));
+  return true;
+}
+
+// arrays of numbers become unboxed arrays, any other array a dictionary from
+// 0, 1, ... to its elements, as split returns
+static bool parse_array(JsonParser *parser, int depth, Value *value) {
+  if (depth > JSON_MAX_DEPTH)
+    return fail(parser, "nested too deeply", parser->positions[parser->next]);
+  parser->cursor = parser->positions[parser->next++] + 1;
+  size_t first = parser->value_count;
+  if (!match(parser, ']')) {
+    do {
+      Value element;
+      if (!parse_value(parser, depth, &element))
+        return false;
+      push_value(parser, element);
+    } while (match(parser, ','));
+    if (!match(parser, ']'))
+      return fail(parser, "expected ',' or ']'",
+                  skip_space(parser, parser->cursor));
+  }
+
+  Value *elements = parser->values + first;
+  size_t count = parser->value_count - first;
+  bool numbers = true;
+  for (size_t i = 0; i < count && numbers; i++)
+    numbers = IS_NUMERIC(elements[i]);
+  if (numbers) {
+    ObjArray *array = new_array(parser->vm, count);
+    for (size_t i = 0; i < count; i++)
+      array->values[i] = AS_DOUBLE(elements[i]);
+    array->count = count;
+    *value = OBJ_VAL(array);
+  } else {
+    ObjDict *dict = new_dict(parser->vm);
+    reserve_hash_map(&dict->table, count);
+    for (size_t i = 0; i < count; i++)
+      insert_value_entry(&dict->table, INT_VAL((int64_t)i), elements[i]);
+    *value = OBJ_VAL(dict);
+  }
+  parser->value_count = first;
+  return true;
+}
+
+static bool parse_value(JsonParser *parser, int depth, Value *value) {
+  size_t start = skip_space(parser, parser->cursor);
+  if (start == parser->length)
+    return fail(parser, "expected a value", start);
+  if (next_position(parser) != start)
+    return parse_scalar(parser, start, value);
+  switch (parser->chars[start]) {
+  case '"':
+    return parse_string(parser, false, value);
+  case '{':
+    return parse_object(parser, depth + 1, value);
+  case '[':
+    return parse_array(parser, depth + 1, value);
+  default:
+    return fail(parser, "expected a value", start);
+  }
+}
+
+const char *json_parse(VM *vm, ObjString *text, Value *result,
+                       size_t *error_offset) {
+  *error_offset = 0;
+  if (text->length >= UINT32_MAX)
+    return "text is too long";
+  JsonParser parser = {
+      .vm = vm,
+      .owner = text->owner != NULL ? text->owner : (Obj *)text,
+      .chars = text->chars,
+      .length = text->length,
+  };
+  parser.positions = (uint32_t *)malloc((text->length + 1) * sizeof(uint32_t));
+  parser.scratch = (char *)malloc(text->length + 1);
+  if (parser.positions == NULL || parser.scratch == NULL) {
+    printf("ran out of memory when parsing json\n");
+    exit(1);
+  }
+
+  long count = json_index(parser.chars, parser.length, parser.positions);
+  if (count < 0) {
+    fail(&parser, "unterminated string", parser.length);
+  } else {
+    parser.count = (size_t)count;
+    if (parse_value(&parser, 0, result) &&
+        skip_space(&parser, parser.cursor) != parser.length)
+      fail(&parser, "unexpected text after the value",
+           skip_space(&parser, parser.cursor));
+  }
+  free(parser.positions);
+  free(parser.scratch);
+  free(parser.values);
+  *error_offset = parser.error_offset;
+  return parser.error;
+}
+
+typedef struct {
+  VM *vm;
+  char *chars;
+  size_t length;
+  size_t capacity;
+} JsonWriter;
+
+// makes room for size more characters and the terminator
+static char *reserve(JsonWriter *writer, size_t size) {
+  size_t needed = writer->length + size + 1;
+  if (needed > writer->capacity) {
+    size_t capacity = writer->capacity;
+    while (capacity < needed)
+      capacity = get_new_array_capacity(capacity);
+    writer->chars = (char *)grow_array_size(writer->chars, capacity);
+    if (writer->chars == NULL) {
+      printf("ran out of memory when writing json\n");
+      exit(1);
+    }
+    writer->capacity = capacity;
+  }
+  return writer->chars + writer->length;
+}
+
+static void write_chars(JsonWriter *writer, const char *chars, size_t length) {
+  memcpy(reserve(writer, length), chars, length);
+  writer->length += length;
+}
+
+static bool needs_escape(unsigned char c) {
+  return c == '"' || c == '\\' || c < 0x20;
+}
+
+// how many bytes at the start of chars go into a json string as they are
+__attribute__((target("avx2"))) static size_t
+plain_prefix_avx2(const char *chars, size_t length) {
+  __m256i quote = _mm256_set1_epi8('"');
+  __m256i backslash = _mm256_set1_epi8('\\');
+  __m256i control = _mm256_set1_epi8(0x1f);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(chars + i));
+    // max(byte, 0x1f) == 0x1f exactly for the control characters
+    __m256i special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, quote),
+                        _mm256_cmpeq_epi8(bytes, backslash)),
+        _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, control), control));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  while (i < length && !needs_escape((unsigned char)chars[i]))
+    i++;
+  return i;
+}
+
+static size_t plain_prefix(const char *chars, size_t length) {
+  if (has_avx2())
+    return plain_prefix_avx2(chars, length);
+  size_t i = 0;
+  while (i < length && !needs_escape((unsigned char)chars[i]))
+    i++;
+  return i;
+}
+
+static void write_string(JsonWriter *writer, const char *chars,
+                         size_t length) {
+  write_chars(writer, "\"", 1);
+  size_t i = 0;
+  for (;;) {
+    size_t run = plain_prefix(chars + i, length - i);
+    write_chars(writer, chars + i, run);
+    i += run;
+    if (i == length)
+      break;
+
+    unsigned char c = (unsigned char)chars[i++];
+    char escape[8];
+    switch (c) {
+    case '"':
+      write_chars(writer, "\\\"", 2);
+      break;
+    case '\\':
+      write_chars(writer, "\\\\", 2);
+      break;
+    case '\n':
+      write_chars(writer, "\\n", 2);
+      break;
+    case '\r':
+      write_chars(writer, "\\r", 2);
+      break;
+    case '\t':
+      write_chars(writer, "\\t", 2);
+      break;
+    default:
+      write_chars(writer, escape,
+                  snprintf(escape, sizeof(escape), "\\u%04x", c));
+      break;
+    }
+  }
+  write_chars(writer, "\"", 1);
+}
+
+// json has no infinities or nan, they are written as null like javascript
+// does. Integral values drop the ".0" print keeps
+static void write_double(JsonWriter *writer, double number) {
+  if (!isfinite(number)) {
+    write_chars(writer, "null", 4);
+    return;
+  }
+  char buffer[FORMAT_NUMBER_SIZE];
+  int length = format_number(number, buffer);
+  if (length >= 2 && buffer[length - 2] == '.' && buffer[length - 1] == '0')
+    length -= 2;
+  write_chars(writer, buffer, length);
+}
+
+static void write_number(JsonWriter *writer, Value number) {
+  if (IS_INT(number)) {
+    char buffer[FORMAT_NUMBER_SIZE];
+    write_chars(writer, buffer, format_integer(AS_INT(number), buffer));
+  } else {
+    write_double(writer, AS_NUMBER(number));
+  }
+}
+
+// dictionaries with the keys 0 to count - 1, like the ones split and
+// parse_json return, are written as json arrays
+static bool is_list(Table *table) {
+  if (table->count == 0)
+    return false;
+  size_t position = 0;
+  Entry *entry;
+  while ((entry = next_entry(table, &position)) != NULL) {
+    Value key = entry_key(entry);
+    if (!IS_INT(key) || AS_INT(key) < 0 ||
+        (size_t)AS_INT(key) >= table->count)
+      return false;
+  }
+  return true;
+}
+
+static const char *write_value(JsonWriter *writer, Value value, int depth);
+
+static const char *write_dict(JsonWriter *writer, Table *table, int depth) {
+  const char *error;
+  if (is_list(table)) {
+    write_chars(writer, "[", 1);
+    for (size_t i = 0; i < table->count; i++) {
+      Value element;
+      get_value_entry(table, INT_VAL((int64_t)i), &element);
+      if (i > 0)
+        write_chars(writer, ",", 1);
+      if ((error = write_value(writer, element, depth + 1)) != NULL)
+        return error;
+    }
+    write_chars(writer, "]", 1);
+    return NULL;
+  }
+
+  // json keys are strings, numbers and booleans are written as their text
+  write_chars(writer, "{", 1);
+  size_t position = 0;
+  Entry *entry;
+  bool first = true;
+  while ((entry = next_entry(table, &position)) != NULL) {
+    Value key = entry_key(entry);
+    if (!first)
+      write_chars(writer, ",", 1);
+    first = false;
+    if (IS_STRING(key)) {
+      write_string(writer, AS_STRING(key)->chars, AS_STRING(key)->length);
+    } else if (IS_NUMERIC(key)) {
+      write_chars(writer, "\"", 1);
+      write_number(writer, key);
+      write_chars(writer, "\"", 1);
+    } else {
+      write_chars(writer, AS_BOOL(key) ? "\"true\"" : "\"false\"",
+                  AS_BOOL(key) ? 6 : 7);
+    }
+    write_chars(writer, ":", 1);
+    if ((error = write_value(writer, entry->value, depth + 1)) != NULL)
+      return error;
+  }
+  write_chars(writer, "}", 1);
+  return NULL;
+}
+
+static const char *write_value(JsonWriter *writer, Value value, int depth) {
+  if (depth > JSON_MAX_DEPTH)
+    return "value is nested too deeply or contains itself";
+  if (IS_NIL(value)) {
+    write_chars(writer, "null", 4);
+  } else if (IS_BOOL(value)) {
+    write_chars(writer, AS_BOOL(value) ? "true" : "false",
+                AS_BOOL(value) ? 4 : 5);
+  } else if (IS_NUMERIC(value)) {
+    write_number(writer, value);
+  } else if (is_string_value(value)) {
+    ObjString *string = flatten_string(writer->vm, value);
+    write_string(writer, string->chars, string->length);
+  } else if (IS_ARRAY(value)) {
+    ObjArray *array = AS_ARRAY(value);
+    lock_array(writer->vm, array, false);
+    write_chars(writer, "[", 1);
+    for (size_t i = 0; i < array->count; i++) {
+      if (i > 0)
+        write_chars(writer, ",", 1);
+      write_double(writer, array->values[i]);
+    }
+    write_chars(writer, "]", 1);
+    unlock_array(writer->vm, array);
+  } else if (IS_DICT(value)) {
+    ObjDict *dict = AS_DICT(value);
+    lock_dict(writer->vm, dict, false);
+    const char *error = write_dict(writer, &dict->table, depth);
+    unlock_dict(writer->vm, dict);
+    return error;
+  } else {
+    return "only nil, booleans, numbers, strings, arrays and dictionaries can "
+           "be written as json";
+  }
+  return NULL;
+}
+
+const char *json_serialize(VM *vm, Value value, ObjString **result) {
+  JsonWriter writer = {vm, NULL, 0, 0};
+  const char *error = write_value(&writer, value, 0);
+  if (error != NULL) {
+    free(writer.chars);
+    return error;
+  }
+  reserve(&writer, 0)[0] = '\0';
+  *result = take_string(vm, writer.chars, writer.length);
+  return NULL;
+}
+
+// parse_json(text) is the value text holds: dictionaries for objects, arrays
+// or dictionaries for arrays, and views of text for strings without escapes
+NativeResult parse_json_native(VM *vm, Task *task, int arg_count, Value *args,
+                               Value *result) {
+  if (!is_string_value(args[0])) {
+    log_vm_error(vm, task, "parse_json expects a string\n");
+    return NATIVE_ERROR;
+  }
+  size_t offset;
+  const char *error =
+      json_parse(vm, flatten_string(vm, args[0]), result, &offset);
+  if (error != NULL) {
+    char message[128];
+    snprintf(message, sizeof(message), "invalid json at offset %zu: %s\n",
+             offset, error);
+    log_vm_error(vm, task, message);
+    return NATIVE_ERROR;
+  }
+  return NATIVE_OK;
+}
+
+NativeResult to_json_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result) {
+  ObjString *json;
+  const char *error = json_serialize(vm, args[0], &json);
+  if (error != NULL) {
+    char message[128];
+    snprintf(message, sizeof(message), "%s\n", error);
+    log_vm_error(vm, task, message);
+    return NATIVE_ERROR;
+  }
+  *result = OBJ_VAL(json);
+  return NATIVE_OK;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// structures deeper than this are rejected by the parser and the serializer,
+// which also stops a dictionary that contains itself
+#define JSON_MAX_DEPTH 512
+
+// the structural index and string escaping use AVX2 when the cpu has it,
+// false forces the scalar fallback (for benchmarks)
+void use_json_simd(bool enabled);
+// writes the offsets of the structural characters of text to positions: every
+// {}[]:, outside strings and every unescaped quote. positions needs room for
+// length entries. Returns how many, or -1 when a string is not terminated
+long json_index(const char *text, size_t length, uint32_t *positions);
+// NULL on success, otherwise what is wrong with text and where
+const char *json_parse(VM *vm, ObjString *text, Value *result,
+                       size_t *error_offset);
+// NULL on success, otherwise why value can not be written as json
+const char *json_serialize(VM *vm, Value value, ObjString **result);
+
+NativeResult parse_json_native(VM *vm, Task *task, int arg_count, Value *args,
+                               Value *result);
+NativeResult to_json_native(VM *vm, Task *task, int arg_count, Value *args,
+                            Value *result);
@@ -1,45 +1,38 @@
 #include "lexer.h"
-#include "chunk.h"
-#include "hash_map.h"
+#include "arena.h"
 #include "log_error.h"
-#include "object.h"
-#include "parser.h"
-#include "stack.h"
-#include "value.h"
-#include "vm.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// lexeme is not copied, it must point at a string literal or arena memory
 Token create_token(TokenType type, char *lexeme, Literal literal, int line) {
   Token token;
   token.type = type;
-  token.lexeme = strdup(lexeme);
+  token.lexeme = lexeme;
+  token.length = strlen(lexeme);
   token.literal = literal;
   token.line = line;
   return token;
 }
 
-TokenList create_token_list(size_t capacity) {
+TokenList create_token_list(Arena *arena, size_t capacity) {
   TokenList token_list;
-  token_list.tokens = (Token *)malloc(sizeof(Token) * capacity);
+  token_list.tokens = (Token *)arena_alloc(arena, sizeof(Token) * capacity);
   token_list.count = 0;
   token_list.capacity = capacity;
+  token_list.arena = arena;
   return token_list;
 }
 
-void free_token_list(TokenList *token_list) { free(token_list->tokens); }
-
 void add_token(TokenList *token_list, Token token) {
   if (token_list->count >= token_list->capacity) {
+    size_t old_size = token_list->capacity * sizeof(Token);
     token_list->capacity *= 2;
-    token_list->tokens =
-        realloc(token_list->tokens, token_list->capacity * sizeof(Token));
-    if (token_list->tokens == NULL) {
-      fprintf(stderr, "Memory allocation failed\n");
-      exit(1);
-    }
+    token_list->tokens = arena_grow_array(token_list->arena, token_list->tokens,
+                                          old_size,
+                                          token_list->capacity * sizeof(Token));
   }
   token_list->tokens[token_list->count++] = token;
 }
@@ -48,23 +41,28 @@ bool is_digit(char character) {
   return ('0' <= character) && (character <= '9');
 }
 
-Token handle_number(char **current_char, int line) {
+Token handle_number(Arena *arena, char **current_char, int line) {
   char buffer[256];
   int length = 0;
+  int64_t value = 0;
   while (**current_char && is_digit(**current_char)) {
     if (length > sizeof(buffer) - 1) {
       log_error(line, "Number cannot be longer than 256 characters");
       exit(1);
     }
 
+    if (value >= 0 &&
+        (__builtin_mul_overflow(value, 10, &value) ||
+         __builtin_add_overflow(value, **current_char - '0', &value)))
+      value = -1;
     buffer[length++] = **current_char;
     (*current_char)++;
   }
 
   (*current_char)--;
   buffer[length] = '\0';
-  int value = atoi(buffer);
-  return create_token(NUMBER, buffer, (Literal){.int_value = value}, line);
+  return create_token(NUMBER, arena_copy_string(arena, buffer, length),
+                      (Literal){.int_value = value}, line);
 }
 
 bool is_alpha(char character) {
@@ -76,7 +74,7 @@ bool is_alphanumeric(char character) {
   return is_digit(character) || is_alpha(character);
 }
 
-Token handle_identifier(char **current_char, int line) {
+Token handle_identifier(Arena *arena, char **current_char, int line) {
   char buffer[256];
   int length = 0;
 
@@ -95,40 +93,92 @@ Token handle_identifier(char **current_char, int line) {
   // TODO: MOVE TO A HASHMAP
   Token token;
   if (strcmp(buffer, "var") == 0) {
-    token = create_token(VAR, buffer, (Literal){0}, line);
+    token = create_token(VAR, "var", (Literal){0}, line);
   } else if (strcmp(buffer, "False") == 0) {
-    token = create_token(FALSE, buffer, (Literal){.bool_value = false}, line);
+    token = create_token(FALSE, "False", (Literal){.bool_value = false}, line);
   } else if (strcmp(buffer, "True") == 0) {
-    token = create_token(TRUE, buffer, (Literal){.bool_value = true}, line);
+    token = create_token(TRUE, "True", (Literal){.bool_value = true}, line);
   } else if (strcmp(buffer, "else") == 0) {
-    token = create_token(ELSE, buffer, (Literal){0}, line);
+    token = create_token(ELSE, "else", (Literal){0}, line);
   } else if (strcmp(buffer, "if") == 0) {
-    token = create_token(IF, buffer, (Literal){0}, line);
+    token = create_token(IF, "if", (Literal){0}, line);
   } else if (strcmp(buffer, "nil") == 0) {
-    token = create_token(NIL, buffer, (Literal){0}, line);
+    token = create_token(NIL, "nil", (Literal){0}, line);
   } else if (strcmp(buffer, "return") == 0) {
-    token = create_token(NIL, buffer, (Literal){0}, line);
+    token = create_token(RETURN, "return", (Literal){0}, line);
   } else if (strcmp(buffer, "print") == 0) {
-    token = create_token(PRINT, buffer, (Literal){0}, line);
+    token = create_token(PRINT, "print", (Literal){0}, line);
   } else if (strcmp(buffer, "while") == 0) {
-    token = create_token(WHILE, buffer, (Literal){0}, line);
+    token = create_token(WHILE, "while", (Literal){0}, line);
   } else if (strcmp(buffer, "expr") == 0) {
-    token = create_token(EXPR, buffer, (Literal){0}, line);
+    token = create_token(EXPR, "expr", (Literal){0}, line);
+  } else if (strcmp(buffer, "spawn") == 0) {
+    token = create_token(SPAWN, "spawn", (Literal){0}, line);
+  } else if (strcmp(buffer, "coroutine") == 0) {
+    token = create_token(COROUTINE, "coroutine", (Literal){0}, line);
+  } else if (strcmp(buffer, "yield") == 0) {
+    token = create_token(YIELD, "yield", (Literal){0}, line);
+  } else if (strcmp(buffer, "resume") == 0) {
+    token = create_token(RESUME, "resume", (Literal){0}, line);
+  } else if (strcmp(buffer, "parallel") == 0) {
+    token = create_token(PARALLEL, "parallel", (Literal){0}, line);
+  } else if (strcmp(buffer, "reduce") == 0) {
+    token = create_token(REDUCE, "reduce", (Literal){0}, line);
+  } else if (strcmp(buffer, "fun") == 0) {
+    token = create_token(FUN, "fun", (Literal){0}, line);
   } else {
-    token = create_token(IDENTIFIER, buffer, (Literal){.string_value = buffer},
+    char *lexeme = arena_copy_string(arena, buffer, length);
+    token = create_token(IDENTIFIER, lexeme, (Literal){.string_value = lexeme},
                          line);
   }
   return token;
 }
 
-Token handle_string(char **current_char, int line) {
+static char *scan_source(Arena *arena, TokenList *token_list,
+                         char *current_char, int *line,
+                         bool in_interpolation);
+
+static Token string_part(Arena *arena, TokenType type, char *buffer,
+                         int length, int line) {
+  char *lexeme = arena_copy_string(arena, buffer, length);
+  return create_token(type, lexeme, (Literal){.string_value = lexeme}, line);
+}
+
+// a string with {expression} parts becomes an INTERPOLATION token for the
+// text before each part, followed by the part's tokens, and a STRING token
+// for the text after the last one. "{{" is a literal brace
+void handle_string(Arena *arena, TokenList *token_list, char **current_char,
+                   int *line) {
   char buffer[256];
   int length = 0;
+  bool interpolated = false;
 
   (*current_char)++;
   while (**current_char && **current_char != '"') {
+    if (**current_char == '{' && look_ahead(*current_char) != '{') {
+      add_token(token_list,
+                string_part(arena, INTERPOLATION, buffer, length, *line));
+      length = 0;
+      interpolated = true;
+      size_t token_count = token_list->count;
+      *current_char =
+          scan_source(arena, token_list, *current_char + 1, line, true);
+      if (**current_char != '}') {
+        log_error(*line, "unterminated interpolation in string");
+        exit(1);
+      }
+      if (token_list->count == token_count) {
+        log_error(*line, "empty interpolation in string");
+        exit(1);
+      }
+      (*current_char)++;
+      continue;
+    }
+    if (**current_char == '{')
+      (*current_char)++;
+
     if (length > sizeof(buffer) - 1) {
-      log_error(line, "string cannot be longer than 256 characters");
+      log_error(*line, "string cannot be longer than 256 characters");
       exit(1);
     }
 
@@ -137,18 +187,16 @@ Token handle_string(char **current_char, int line) {
   }
 
   if (!**current_char) {
-    log_error(line, "unterminated string");
+    log_error(*line, "unterminated string");
     exit(1);
   }
 
-  if (length <= 0) {
-    log_error(line, "cannot have empty string\n");
+  if (length <= 0 && !interpolated) {
+    log_error(*line, "cannot have empty string\n");
     exit(1);
   }
 
-  buffer[length] = '\0';
-  return create_token(STRING, buffer, (Literal){.string_value = strdup(buffer)},
-                      line);
+  add_token(token_list, string_part(arena, STRING, buffer, length, *line));
 }
 
 char look_ahead(char *current_char) { return *(current_char + 1); }
@@ -157,74 +205,101 @@ bool is_next_character_match(char **current_char, char value) {
   return look_ahead(*current_char) == value;
 }
 
-TokenList scan_tokens(char *program) {
-  const int initial_token_list_size = 100;
-  TokenList token_list = create_token_list(initial_token_list_size);
-
-  int line = 1;
-
-  char *current_char = program;
+// adds the tokens of the source at current_char and returns where it stopped:
+// the end of the program, or inside an interpolation the '}' closing it
+static char *scan_source(Arena *arena, TokenList *token_list,
+                         char *current_char, int *line_number,
+                         bool in_interpolation) {
+  int line = *line_number;
+  // braces opened inside an interpolation (e.g. a dictionary literal)
+  int depth = 0;
   while (*current_char) {
     switch (*current_char) {
     case ';': {
       Token token = create_token(SEMICOLON, ";", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
+      break;
+    }
+    case ',': {
+      Token token = create_token(COMMA, ",", (Literal){0}, line);
+      add_token(token_list, token);
       break;
     }
     case '=': {
       Token token;
       if (is_next_character_match(&current_char, '=')) {
-        Token token = create_token(EQUAL_EQUAL, "==", (Literal){0}, line);
+        token = create_token(EQUAL_EQUAL, "==", (Literal){0}, line);
         current_char++;
       } else {
-        Token token = create_token(EQUAL, "=", (Literal){0}, line);
+        token = create_token(EQUAL, "=", (Literal){0}, line);
       }
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '(': {
       Token token = create_token(LEFT_PAREN, "(", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case ')': {
       Token token = create_token(RIGHT_PAREN, ")", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '{': {
+      depth++;
       Token token = create_token(LEFT_BRACKET, "{", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '}': {
+      if (in_interpolation && depth == 0) {
+        *line_number = line;
+        return current_char;
+      }
+      depth--;
       Token token = create_token(RIGHT_BRACKET, "}", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
+      break;
+    }
+    case ':': {
+      Token token = create_token(COLON, ":", (Literal){0}, line);
+      add_token(token_list, token);
+      break;
+    }
+    case '[': {
+      Token token = create_token(LEFT_SQUARE, "[", (Literal){0}, line);
+      add_token(token_list, token);
+      break;
+    }
+    case ']': {
+      Token token = create_token(RIGHT_SQUARE, "]", (Literal){0}, line);
+      add_token(token_list, token);
       break;
     }
     case '-': {
       Token token = create_token(MINUS, "-", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '+': {
       Token token = create_token(PLUS, "+", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '/': {
       Token token = create_token(SLASH, "/", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '*': {
       Token token = create_token(STAR, "*", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '%': {
       Token token = create_token(MOD, "%", (Literal){0}, line);
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '!': {
@@ -235,7 +310,7 @@ TokenList scan_tokens(char *program) {
       } else {
         token = create_token(BANG, "!", (Literal){0}, line);
       }
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '<': {
@@ -246,7 +321,7 @@ TokenList scan_tokens(char *program) {
       } else {
         token = create_token(LESS, "<", (Literal){0}, line);
       }
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     case '>': {
@@ -257,7 +332,7 @@ TokenList scan_tokens(char *program) {
       } else {
         token = create_token(GREATER, ">", (Literal){0}, line);
       }
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
 
@@ -268,28 +343,37 @@ TokenList scan_tokens(char *program) {
     case '\n':
       line++;
       break;
-    case '"': {
-      Token token = handle_string(&current_char, line);
-      add_token(&token_list, token);
+    case '"':
+      handle_string(arena, token_list, &current_char, &line);
       break;
-    }
     default: {
       Token token;
       if (is_digit(*current_char)) {
-        Token token = handle_number(&current_char, line);
+        token = handle_number(arena, &current_char, line);
       } else if (is_alpha(*current_char)) {
-        Token token = handle_identifier(&current_char, line);
+        token = handle_identifier(arena, &current_char, line);
       } else {
         log_error(line, "failed to handle value");
         exit(1);
       }
-      add_token(&token_list, token);
+      add_token(token_list, token);
       break;
     }
     }
     current_char++;
   }
 
+  *line_number = line;
+  return current_char;
+}
+
+TokenList scan_tokens(Arena *arena, char *program) {
+  const int initial_token_list_size = 100;
+  TokenList token_list = create_token_list(arena, initial_token_list_size);
+
+  int line = 1;
+  scan_source(arena, &token_list, program, &line, false);
+
   Token token = create_token(END, "", (Literal){0}, line);
   add_token(&token_list, token);
   return token_list;
@@ -300,9 +384,10 @@ void print_token(Token *token) {
 
   switch (token->type) {
   case NUMBER:
-    printf("Literal: %d", token->literal.int_value);
+    printf("Literal: %lld", (long long)token->literal.int_value);
     break;
   case STRING:
+  case INTERPOLATION:
     printf("Literal: %s", token->literal.string_value);
     break;
   case TRUE:
@@ -348,24 +433,3 @@ char *read_file(const char *filename) {
   fclose(file);
   return content;
 }
-
-int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    fprintf(stderr, "provide a path to file\n");
-    return 1;
-  }
-
-  char *program = read_file(argv[1]);
-  TokenList token_list = scan_tokens(program);
-  // print_token_list(&token_list);
-
-  Chunk chunk;
-  VM vm;
-
-  init_chunk(&chunk);
-  init_vm(&vm);
-  compile(&vm, &token_list, &chunk);
-  interpret(&vm, &chunk);
-  free_vm(&vm);
-  free_chunk(&chunk);
-}
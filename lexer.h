@@ -1,13 +1,19 @@
 #pragma once
+#include "arena.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum {
   LEFT_PAREN,
   RIGHT_PAREN,
   LEFT_BRACKET,
   RIGHT_BRACKET,
+  LEFT_SQUARE,
+  RIGHT_SQUARE,
   SEMICOLON,
+  COLON,
+  COMMA,
 
   // math
   MINUS,
@@ -29,6 +35,8 @@ typedef enum {
   NUMBER,
   IDENTIFIER,
   STRING,
+  // the text before an {expression} in a string
+  INTERPOLATION,
 
   // keywords
   VAR,
@@ -41,13 +49,21 @@ typedef enum {
   RETURN,
   WHILE,
   EXPR,
+  SPAWN,
+  COROUTINE,
+  YIELD,
+  RESUME,
+  PARALLEL,
+  REDUCE,
+  FUN,
 
   ERROR,
   END,
 } TokenType;
 
 typedef union {
-  int int_value;
+  // -1 when the literal does not fit in 64 bits
+  int64_t int_value;
   char *string_value;
   bool bool_value;
   void *null_value;
@@ -56,6 +72,7 @@ typedef union {
 typedef struct {
   TokenType type;
   char *lexeme;
+  int length;
   Literal literal;
   int line;
 } Token;
@@ -64,21 +81,22 @@ typedef struct {
   Token *tokens;
   size_t count;
   size_t capacity;
+  Arena *arena;
 } TokenList;
 
 Token create_token(TokenType type, char *lexeme, Literal literal, int line);
-TokenList create_token_list(size_t capacity);
-void free_token_list(TokenList *token_list);
+TokenList create_token_list(Arena *arena, size_t capacity);
 void add_token(TokenList *token_list, Token token);
 bool is_digit(char character);
-Token handle_number(char **current_char, int line);
+Token handle_number(Arena *arena, char **current_char, int line);
 bool is_alpha(char character);
 bool is_alphanumeric(char character);
-Token handle_identifier(char **current_char, int line);
-Token handle_string(char **current_char, int line);
+Token handle_identifier(Arena *arena, char **current_char, int line);
+void handle_string(Arena *arena, TokenList *token_list, char **current_char,
+                   int *line);
 char look_ahead(char *current_char);
 bool is_next_character_match(char **current_char, char value);
-TokenList scan_tokens(char *program);
+TokenList scan_tokens(Arena *arena, char *program);
 void print_token(Token *token);
 void print_token_list(TokenList *token_list);
 char *read_file(const char *filename);
@@ -0,0 +1,93 @@
+#include "lines.h"
+#include "object.h"
+#include "vm.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// lines(path) maps the file for reading, nil when it cannot be opened
+NativeResult lines_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result) {
+  if (!is_string_value(args[0])) {
+    log_vm_error(vm, task, "lines takes a path\n");
+    return NATIVE_ERROR;
+  }
+  int fd = open(flatten_c_string(vm, args[0])->chars, O_RDONLY | O_CLOEXEC);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) < 0) {
+    if (fd >= 0)
+      close(fd);
+    *result = NIL_VAL;
+    return NATIVE_OK;
+  }
+
+  // an empty file cannot be mapped and has no lines anyway
+  size_t size = (size_t)info.st_size;
+  char *start = NULL;
+  if (size > 0) {
+    start = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (start == MAP_FAILED) {
+      close(fd);
+      *result = NIL_VAL;
+      return NATIVE_OK;
+    }
+    madvise(start, size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  *result = OBJ_VAL(new_lines(vm, start, size));
+  return NATIVE_OK;
+}
+
+// keeps LINES_READAHEAD bytes past position on their way in
+static void prefetch_lines(ObjLines *lines, size_t position) {
+  size_t prefetched = __atomic_load_n(&lines->prefetched, __ATOMIC_RELAXED);
+  if (prefetched >= lines->size ||
+      position + LINES_READAHEAD / 2 < prefetched)
+    return;
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t from = prefetched & ~(page - 1);
+  size_t to = position + LINES_READAHEAD;
+  if (to > lines->size)
+    to = lines->size;
+  // whichever task wins the swap issues the hint
+  if (__atomic_compare_exchange_n(&lines->prefetched, &prefetched, to, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    madvise(lines->start + from, to - from, MADV_WILLNEED);
+}
+
+// next_line(lines) evaluates to the next line without its line ending, or to
+// nil after the last one. The line shares memory with the mapping
+NativeResult next_line_native(VM *vm, Task *task, int arg_count, Value *args,
+                              Value *result) {
+  if (!IS_LINES(args[0])) {
+    log_vm_error(vm, task, "next_line expects the result of lines\n");
+    return NATIVE_ERROR;
+  }
+  ObjLines *lines = AS_LINES(args[0]);
+  size_t position = __atomic_load_n(&lines->position, __ATOMIC_RELAXED);
+  char *line;
+  size_t length;
+  for (;;) {
+    if (position >= lines->size) {
+      *result = NIL_VAL;
+      return NATIVE_OK;
+    }
+    // glibc's memchr scans with SIMD, a whole vector of bytes per step
+    line = lines->start + position;
+    size_t remaining = lines->size - position;
+    char *newline = (char *)memchr(line, '\n', remaining);
+    length = newline != NULL ? (size_t)(newline - line) : remaining;
+    size_t next = position + length + (newline != NULL);
+    if (__atomic_compare_exchange_n(&lines->position, &position, next, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      break;
+  }
+
+  prefetch_lines(lines, position);
+  if (length > 0 && line[length - 1] == '\r')
+    length--;
+  *result = OBJ_VAL(new_string_view(vm, (Obj *)lines, line, length));
+  return NATIVE_OK;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// how far ahead of the reader the kernel is asked to read the file
+#define LINES_READAHEAD (8 * 1024 * 1024)
+
+NativeResult lines_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result);
+NativeResult next_line_native(VM *vm, Task *task, int arg_count, Value *args,
+                              Value *result);
@@ -0,0 +1,152 @@
+#include "arena.h"
+#include "chunk.h"
+#include "isolate.h"
+#include "lexer.h"
+#include "opcode_stats.h"
+#include "parser.h"
+#include "profiler.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// what --opcode-stats and --profile collect into, shared by isolates
+typedef struct {
+  OpcodeStats *stats;
+  Profile *profile;
+} Instruments;
+
+static void instrument_isolate(VM *vm, size_t index, void *user_data) {
+  Instruments *instruments = (Instruments *)user_data;
+  vm->opcode_stats = instruments->stats;
+  vm->profile = instruments->profile;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = NULL;
+  bool show_compile_stats = false;
+  size_t isolate_count = 0;
+  size_t worker_count = 0;
+  IoBackend io_backend = IO_BACKEND_URING;
+  const char *flush = NULL;
+  bool show_opcode_stats = false;
+  const char *opcode_csv = NULL;
+  const char *profile_path = NULL;
+  int profile_rate = DEFAULT_PROFILE_RATE;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--compile-stats") == 0) {
+      show_compile_stats = true;
+    } else if (strcmp(argv[i], "--isolates") == 0 && i + 1 < argc) {
+      isolate_count = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      worker_count = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc) {
+      io_backend = strcmp(argv[++i], "epoll") == 0 ? IO_BACKEND_EPOLL
+                                                   : IO_BACKEND_URING;
+    } else if (strcmp(argv[i], "--flush") == 0 && i + 1 < argc) {
+      flush = argv[++i];
+    } else if (strcmp(argv[i], "--opcode-stats") == 0) {
+      show_opcode_stats = true;
+    } else if (strcmp(argv[i], "--opcode-csv") == 0 && i + 1 < argc) {
+      opcode_csv = argv[++i];
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "--profile-rate") == 0 && i + 1 < argc) {
+      profile_rate = (int)strtol(argv[++i], NULL, 10);
+    } else {
+      path = argv[i];
+    }
+  }
+
+  if (path == NULL) {
+    fprintf(stderr, "provide a path to file\n");
+    return 1;
+  }
+
+  char *program = read_file(path);
+  if (program == NULL) {
+    return 1;
+  }
+
+  // everything the front end allocates lives in this arena and is released
+  // in one shot once the chunk has been moved to the heap
+  Arena arena;
+  init_arena(&arena);
+  TokenList token_list = scan_tokens(&arena, program);
+  // --profile quotes the hot lines from it
+  if (profile_path == NULL) {
+    free(program);
+    program = NULL;
+  }
+  // print_token_list(&token_list);
+
+  Chunk chunk;
+  VM vm;
+
+  init_chunk(&chunk);
+  init_vm(&vm);
+  vm.worker_count = worker_count;
+  vm.io_backend = io_backend;
+  if (flush != NULL) {
+    vm.output.policy = strcmp(flush, "line") == 0   ? FLUSH_LINE
+                       : strcmp(flush, "exit") == 0 ? FLUSH_AT_EXIT
+                                                    : FLUSH_FULL;
+  }
+  bool compiled = compile(&vm, &arena, &token_list, &chunk);
+  if (show_compile_stats) {
+    print_arena_stats(&arena, "compile");
+  }
+  free_arena(&arena);
+  if (!compiled) {
+    free_vm(&vm);
+    free_chunk(&chunk);
+    free(program);
+    return 1;
+  }
+
+  OpcodeStats *stats = NULL;
+  if (show_opcode_stats || opcode_csv != NULL) {
+    stats = create_opcode_stats();
+    vm.opcode_stats = stats;
+  }
+  Profile *profile = NULL;
+  if (profile_path != NULL) {
+    profile = create_profile(profile_rate);
+    vm.profile = profile;
+    if (!start_profile(profile))
+      fprintf(stderr, "could not start the profiling timer\n");
+  }
+
+  if (isolate_count > 0) {
+    // compile once, then run the same chunk on isolate_count threads
+    freeze_chunk(&chunk, &vm);
+    if (stats != NULL)
+      stats->shared = true;
+    Instruments instruments = {stats, profile};
+    bool instrumented = stats != NULL || profile != NULL;
+    run_isolates(&chunk, isolate_count,
+                 instrumented ? instrument_isolate : NULL, &instruments, NULL);
+  } else {
+    interpret(&vm, &chunk);
+  }
+
+  if (profile != NULL) {
+    stop_profile(profile);
+    print_profile(profile, program, stderr);
+    if (!write_folded_stacks(profile, profile_path))
+      fprintf(stderr, "could not write %s\n", profile_path);
+    free_profile(profile);
+    free(program);
+  }
+
+  if (stats != NULL) {
+    if (show_opcode_stats)
+      print_opcode_stats(stats, stderr);
+    if (opcode_csv != NULL && !write_opcode_stats_csv(stats, opcode_csv))
+      fprintf(stderr, "could not write %s\n", opcode_csv);
+    free_opcode_stats(stats);
+  }
+  free_vm(&vm);
+  free_chunk(&chunk);
+}
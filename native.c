@@ -0,0 +1,79 @@
+#include "native.h"
+#include "array.h"
+#include "builder.h"
+#include "channel.h"
+#include "dict.h"
+#include "event_loop.h"
+#include "json.h"
+#include "lines.h"
+#include "object.h"
+#include "string_ops.h"
+#include "vm.h"
+
+void define_native(VM *vm, const char *name, NativeFn function, int arity) {
+  define_global(vm, name, OBJ_VAL(new_native(vm, name, function, arity)));
+}
+
+// the length of an array, dictionary, builder or string
+static NativeResult len_native(VM *vm, Task *task, int arg_count, Value *args,
+                               Value *result) {
+  if (IS_ARRAY(args[0])) {
+    ObjArray *array = AS_ARRAY(args[0]);
+    lock_array(vm, array, false);
+    *result = INT_VAL((int64_t)array->count);
+    unlock_array(vm, array);
+  } else if (IS_DICT(args[0])) {
+    ObjDict *dict = AS_DICT(args[0]);
+    lock_dict(vm, dict, false);
+    *result = INT_VAL((int64_t)dict->table.count);
+    unlock_dict(vm, dict);
+  } else if (IS_BUILDER(args[0])) {
+    ObjBuilder *builder = AS_BUILDER(args[0]);
+    lock_builder(vm, builder);
+    *result = INT_VAL((int64_t)builder->length);
+    unlock_builder(vm, builder);
+  } else if (is_string_value(args[0])) {
+    *result = INT_VAL((int64_t)string_value_length(args[0]));
+  } else {
+    log_vm_error(vm, task,
+                 "len expects an array, dictionary, builder or string\n");
+    return NATIVE_ERROR;
+  }
+  return NATIVE_OK;
+}
+
+// the builtins every program sees as globals
+void define_natives(VM *vm) {
+  define_native(vm, "channel", channel_native, 1);
+  define_native(vm, "send", send_native, 2);
+  define_native(vm, "receive", receive_native, 1);
+  define_native(vm, "try_receive", try_receive_native, 1);
+  define_native(vm, "open", open_native, 2);
+  define_native(vm, "close", close_native, 1);
+  define_native(vm, "read", read_native, 2);
+  define_native(vm, "write", write_native, 2);
+  define_native(vm, "pipe", pipe_native, 0);
+  define_native(vm, "pipe_writer", pipe_writer_native, 1);
+  define_native(vm, "lines", lines_native, 1);
+  define_native(vm, "next_line", next_line_native, 1);
+  define_native(vm, "array", array_native, 1);
+  define_native(vm, "len", len_native, 1);
+  define_native(vm, "push", push_native, 2);
+  define_native(vm, "sum", sum_native, 1);
+  define_native(vm, "min", min_native, 1);
+  define_native(vm, "max", max_native, 1);
+  define_native(vm, "dot", dot_native, 2);
+  define_native(vm, "dict", dict_native, 1);
+  define_native(vm, "has", has_native, 2);
+  define_native(vm, "delete", delete_native, 2);
+  define_native(vm, "find", find_native, 2);
+  define_native(vm, "split", split_native, 2);
+  define_native(vm, "starts_with", starts_with_native, 2);
+  define_native(vm, "ends_with", ends_with_native, 2);
+  define_native(vm, "substring", substring_native, 3);
+  define_native(vm, "builder", builder_native, 0);
+  define_native(vm, "append", append_native, 2);
+  define_native(vm, "build", build_native, 1);
+  define_native(vm, "parse_json", parse_json_native, 1);
+  define_native(vm, "to_json", to_json_native, 1);
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "object.h"
+#include "vm.h"
+
+void define_native(VM *vm, const char *name, NativeFn function, int arity);
+void define_natives(VM *vm);
@@ -1,46 +1,459 @@
 #include "object.h"
+#include "channel.h"
+#include "hash_map.h"
 #include "memory.h"
 #include "value.h"
+#include "vm.h"
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-static Obj *allocate_object(Obj *objects, size_t size, ObjType type) {
+static Obj *allocate_object(VM *vm, size_t size, ObjType type) {
   Obj *object = (Obj *)malloc(size);
+  if (object == NULL) {
+    printf("ran out of memory when allocating an object\n");
+    exit(1);
+  }
   object->type = type;
-  object->next = objects;
-  objects = object;
+  object->next = vm->objects;
+  vm->objects = object;
   return object;
 }
 
-static ObjString *allocate_string(Obj *objects, char *chars, size_t length,
+static ObjString *allocate_string(VM *vm, char *chars, size_t length,
                                   uint32_t hash) {
   ObjString *string =
-      (ObjString *)allocate_object(objects, sizeof(ObjString), OBJ_STRING);
+      (ObjString *)allocate_object(vm, sizeof(ObjString), OBJ_STRING);
   string->length = length;
   string->chars = chars;
   string->hash = hash;
+  string->owner = NULL;
   return string;
 }
 
-size_t calculate_string_length(char *chars) {
-  size_t length = 0;
-  while (chars[length] != '\0') {
-    length++;
+// wyhash (final version 4, public domain) reading 8 or 16 bytes per step
+// instead of FNV's one byte. Strings hash once when they are created, the
+// result is folded to 32 bits for ObjString.hash
+static const uint64_t HASH_SECRET[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull,
+    0x4d5a2da51de1aa47ull};
+#define HASH_SEED 0xa0761d6478bd642full
+
+static inline void hash_multiply(uint64_t *a, uint64_t *b) {
+  __uint128_t result = (__uint128_t)*a * *b;
+  *a = (uint64_t)result;
+  *b = (uint64_t)(result >> 64);
+}
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+  hash_multiply(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t read_64(const uint8_t *bytes) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static inline uint64_t read_32(const uint8_t *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+// reads 1 to 3 bytes without branching on the exact length
+static inline uint64_t read_small(const uint8_t *bytes, size_t length) {
+  return ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[length >> 1] << 8) |
+         bytes[length - 1];
+}
+
+uint32_t hash_string(const char *chars, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)chars;
+  const uint64_t *secret = HASH_SECRET;
+  uint64_t seed = HASH_SEED ^ hash_mix(HASH_SEED ^ secret[0], secret[1]);
+  uint64_t a, b;
+
+  if (length <= 16) {
+    if (length >= 4) {
+      size_t middle = (length >> 3) << 2;
+      a = (read_32(bytes) << 32) | read_32(bytes + middle);
+      b = (read_32(bytes + length - 4) << 32) |
+          read_32(bytes + length - 4 - middle);
+    } else if (length > 0) {
+      a = read_small(bytes, length);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t remaining = length;
+    if (remaining > 48) {
+      uint64_t seed1 = seed;
+      uint64_t seed2 = seed;
+      do {
+        seed = hash_mix(read_64(bytes) ^ secret[1], read_64(bytes + 8) ^ seed);
+        seed1 = hash_mix(read_64(bytes + 16) ^ secret[2],
+                         read_64(bytes + 24) ^ seed1);
+        seed2 = hash_mix(read_64(bytes + 32) ^ secret[3],
+                         read_64(bytes + 40) ^ seed2);
+        bytes += 48;
+        remaining -= 48;
+      } while (remaining > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (remaining > 16) {
+      seed = hash_mix(read_64(bytes) ^ secret[1], read_64(bytes + 8) ^ seed);
+      bytes += 16;
+      remaining -= 16;
+    }
+    a = read_64(bytes + remaining - 16);
+    b = read_64(bytes + remaining - 8);
   }
-  return length;
+
+  a ^= secret[1];
+  b ^= seed;
+  hash_multiply(&a, &b);
+  uint64_t hash = hash_mix(a ^ secret[0] ^ length, b ^ secret[1]);
+  return (uint32_t)(hash ^ (hash >> 32));
 }
 
-uint32_t FNV32(const char *s) {
-  uint32_t hash = FNV_OFFSET_32, i;
-  for (i = 0; i < strlen(s); i++) {
-    hash = hash ^ (s[i]);
-    hash = hash * FNV_PRIME_32;
+static ObjString *intern_string(VM *vm, char *chars, size_t length,
+                                uint32_t hash) {
+  ObjString *string = allocate_string(vm, chars, length, hash);
+  insert_entry(&vm->strings, string, NIL_VAL);
+  return string;
+}
+
+// copies chars into the vm heap, used for strings that must outlive the
+// buffer they were read from (e.g. lexemes in the compiler arena). Strings
+// are interned so an existing copy is returned when there is one
+ObjString *copy_string(VM *vm, const char *chars, size_t length) {
+  uint32_t hash = hash_string(chars, length);
+  lock_heap(vm);
+  ObjString *interned = find_string(&vm->strings, chars, length, hash);
+  if (interned == NULL) {
+    char *heap_chars = (char *)malloc(length + 1);
+    if (heap_chars == NULL) {
+      printf("ran out of memory when copying a string\n");
+      exit(1);
+    }
+    memcpy(heap_chars, chars, length);
+    heap_chars[length] = '\0';
+    interned = intern_string(vm, heap_chars, length, hash);
   }
-  return hash;
+  unlock_heap(vm);
+  return interned;
+}
+
+// takes ownership of a heap allocated, null terminated buffer, freeing it
+// when an equal string is already interned
+ObjString *take_string(VM *vm, char *chars, size_t length) {
+  uint32_t hash = hash_string(chars, length);
+  lock_heap(vm);
+  ObjString *interned = find_string(&vm->strings, chars, length, hash);
+  if (interned != NULL) {
+    free(chars);
+  } else {
+    interned = intern_string(vm, chars, length, hash);
+  }
+  unlock_heap(vm);
+  return interned;
+}
+
+typedef void (*RopeVisitor)(const char *chars, size_t length, void *context);
+
+// walks the leaves of a rope left to right. Ropes built in a loop are deeply
+// unbalanced so this uses an explicit stack instead of recursion
+static void visit_rope(ObjRope *rope, RopeVisitor visit, void *context) {
+  size_t capacity = 64;
+  size_t count = 0;
+  Obj **pending = (Obj **)malloc(capacity * sizeof(Obj *));
+  if (pending == NULL) {
+    printf("ran out of memory when walking a rope\n");
+    exit(1);
+  }
+
+  pending[count++] = (Obj *)rope;
+  while (count > 0) {
+    Obj *node = pending[--count];
+    if (node->type == OBJ_STRING) {
+      ObjString *string = (ObjString *)node;
+      visit(string->chars, string->length, context);
+      continue;
+    }
+
+    ObjRope *current = (ObjRope *)node;
+    ObjString *flat = __atomic_load_n(&current->flat, __ATOMIC_ACQUIRE);
+    if (flat != NULL) {
+      visit(flat->chars, flat->length, context);
+      continue;
+    }
+
+    if (count + 2 > capacity) {
+      capacity = get_new_array_capacity(capacity);
+      pending = (Obj **)grow_array_size(pending, capacity * sizeof(Obj *));
+      if (pending == NULL) {
+        printf("ran out of memory when walking a rope\n");
+        exit(1);
+      }
+    }
+    pending[count++] = current->right;
+    pending[count++] = current->left;
+  }
+
+  free(pending);
+}
+
+static void copy_rope_piece(const char *chars, size_t length, void *context) {
+  char **cursor = (char **)context;
+  memcpy(*cursor, chars, length);
+  *cursor += length;
+}
+
+static void print_rope_piece(const char *chars, size_t length,
+                             void *context) {
+  fwrite(chars, 1, length, stdout);
+}
+
+// concatenation is O(1): short results are copied, everything else becomes a
+// rope node pointing at both operands
+Value concatenate_strings(VM *vm, Value a, Value b) {
+  size_t length = string_value_length(a) + string_value_length(b);
+  if (length < ROPE_MIN_LENGTH) {
+    ObjString *left = flatten_string(vm, a);
+    ObjString *right = flatten_string(vm, b);
+    char *chars = (char *)malloc(length + 1);
+    if (chars == NULL) {
+      printf("ran out of memory concatenating string\n");
+      exit(1);
+    }
+    memcpy(chars, left->chars, left->length);
+    memcpy(chars + left->length, right->chars, right->length);
+    chars[length] = '\0';
+    return OBJ_VAL(take_string(vm, chars, length));
+  }
+
+  lock_heap(vm);
+  ObjRope *rope = (ObjRope *)allocate_object(vm, sizeof(ObjRope), OBJ_ROPE);
+  unlock_heap(vm);
+  rope->length = length;
+  rope->left = AS_OBJ(a);
+  rope->right = AS_OBJ(b);
+  rope->flat = NULL;
+  return OBJ_VAL(rope);
 }
 
-ObjString *create_string(Obj *objects, char *chars) {
-  uint32_t hash = FNV32(chars);
-  return allocate_string(objects, chars, calculate_string_length(chars), hash);
+// returns the interned string holding the characters of a string value,
+// flattening (and caching the result of) a rope on first use
+ObjString *flatten_string(VM *vm, Value value) {
+  if (IS_STRING(value))
+    return AS_STRING(value);
+
+  // tasks on other threads may flatten the same rope, both produce the same
+  // interned string so whichever store lands last is fine
+  ObjRope *rope = AS_ROPE(value);
+  ObjString *flat = __atomic_load_n(&rope->flat, __ATOMIC_ACQUIRE);
+  if (flat == NULL) {
+    char *chars = (char *)malloc(rope->length + 1);
+    if (chars == NULL) {
+      printf("ran out of memory flattening string\n");
+      exit(1);
+    }
+    char *cursor = chars;
+    visit_rope(rope, copy_rope_piece, &cursor);
+    chars[rope->length] = '\0';
+    flat = take_string(vm, chars, rope->length);
+    __atomic_store_n(&rope->flat, flat, __ATOMIC_RELEASE);
+  }
+  return flat;
+}
+
+// like flatten_string, but views are copied so the characters can be passed
+// to C functions expecting a null terminated string
+ObjString *flatten_c_string(VM *vm, Value value) {
+  ObjString *string = flatten_string(vm, value);
+  if (string->owner != NULL)
+    string = copy_string(vm, string->chars, string->length);
+  return string;
+}
+
+// a string sharing chars with owner instead of copying them
+ObjString *new_string_view(VM *vm, Obj *owner, char *chars, size_t length) {
+  lock_heap(vm);
+  ObjString *string = allocate_string(vm, chars, length, 0);
+  unlock_heap(vm);
+  string->owner = owner;
+  return string;
+}
+
+void print_rope(ObjRope *rope) { visit_rope(rope, print_rope_piece, NULL); }
+
+// writes the characters of a rope to dest without flattening it
+void copy_rope_chars(ObjRope *rope, char *dest) {
+  visit_rope(rope, copy_rope_piece, &dest);
+}
+
+ObjCoroutine *new_coroutine(VM *vm, Chunk *chunk, uint8_t *ip) {
+  lock_heap(vm);
+  ObjCoroutine *coroutine =
+      (ObjCoroutine *)allocate_object(vm, sizeof(ObjCoroutine), OBJ_COROUTINE);
+  unlock_heap(vm);
+  // a coroutine spends the budget of the task resuming it
+  init_task(&coroutine->task, chunk, ip, 0);
+  return coroutine;
+}
+
+ObjNative *new_native(VM *vm, const char *name, NativeFn function, int arity) {
+  lock_heap(vm);
+  ObjNative *native =
+      (ObjNative *)allocate_object(vm, sizeof(ObjNative), OBJ_NATIVE);
+  unlock_heap(vm);
+  native->function = function;
+  native->name = name;
+  native->arity = arity;
+  native->external = NULL;
+  native->user_data = NULL;
+  return native;
+}
+
+// takes over a reference to channel, released when the vm frees the object
+ObjChannel *new_channel_object(VM *vm, Channel *channel) {
+  lock_heap(vm);
+  ObjChannel *handle =
+      (ObjChannel *)allocate_object(vm, sizeof(ObjChannel), OBJ_CHANNEL);
+  unlock_heap(vm);
+  handle->channel = channel;
+  return handle;
+}
+
+ObjFile *new_file(VM *vm, int fd) {
+  lock_heap(vm);
+  ObjFile *file = (ObjFile *)allocate_object(vm, sizeof(ObjFile), OBJ_FILE);
+  unlock_heap(vm);
+  file->fd = fd;
+  file->writer = NULL;
+  return file;
+}
+
+void close_file(ObjFile *file) {
+  if (file->fd >= 0) {
+    close(file->fd);
+    file->fd = -1;
+  }
+}
+
+ObjLines *new_lines(VM *vm, char *start, size_t size) {
+  lock_heap(vm);
+  ObjLines *lines = (ObjLines *)allocate_object(vm, sizeof(ObjLines), OBJ_LINES);
+  unlock_heap(vm);
+  lines->start = start;
+  lines->size = size;
+  lines->position = 0;
+  lines->prefetched = 0;
+  return lines;
+}
+
+// an empty array with room for capacity values
+ObjArray *new_array(VM *vm, size_t capacity) {
+  double *values = NULL;
+  if (capacity > 0) {
+    values = (double *)malloc(capacity * sizeof(double));
+    if (values == NULL) {
+      printf("ran out of memory when allocating an array\n");
+      exit(1);
+    }
+  }
+  lock_heap(vm);
+  ObjArray *array = (ObjArray *)allocate_object(vm, sizeof(ObjArray), OBJ_ARRAY);
+  unlock_heap(vm);
+  array->count = 0;
+  array->capacity = capacity;
+  array->values = values;
+  pthread_rwlock_init(&array->lock, NULL);
+  return array;
+}
+
+ObjDict *new_dict(VM *vm) {
+  lock_heap(vm);
+  ObjDict *dict = (ObjDict *)allocate_object(vm, sizeof(ObjDict), OBJ_DICT);
+  unlock_heap(vm);
+  init_hash_map(&dict->table);
+  pthread_rwlock_init(&dict->lock, NULL);
+  return dict;
+}
+
+ObjBuilder *new_builder(VM *vm) {
+  lock_heap(vm);
+  ObjBuilder *builder =
+      (ObjBuilder *)allocate_object(vm, sizeof(ObjBuilder), OBJ_BUILDER);
+  unlock_heap(vm);
+  builder->chars = NULL;
+  builder->length = 0;
+  builder->capacity = 0;
+  pthread_mutex_init(&builder->lock, NULL);
+  return builder;
+}
+
+// the parser compiles the body into the function's chunk
+ObjFunction *new_function(VM *vm, ObjString *name, int arity) {
+  lock_heap(vm);
+  ObjFunction *function =
+      (ObjFunction *)allocate_object(vm, sizeof(ObjFunction), OBJ_FUNCTION);
+  unlock_heap(vm);
+  function->name = name;
+  function->arity = arity;
+  init_chunk(&function->chunk);
+  return function;
+}
+
+void free_objects(Obj *objects) {
+  Obj *object = objects;
+  while (object != NULL) {
+    Obj *next = object->next;
+    switch (object->type) {
+    case OBJ_STRING:
+      if (((ObjString *)object)->owner == NULL)
+        free(((ObjString *)object)->chars);
+      break;
+    case OBJ_ROPE:
+      break;
+    case OBJ_COROUTINE:
+      free_task_stacks(&((ObjCoroutine *)object)->task);
+      break;
+    case OBJ_NATIVE:
+      break;
+    case OBJ_CHANNEL:
+      release_channel(((ObjChannel *)object)->channel);
+      break;
+    case OBJ_FILE:
+      close_file((ObjFile *)object);
+      break;
+    case OBJ_LINES:
+      // views into the mapping are freed in the same pass and never read
+      if (((ObjLines *)object)->size > 0)
+        munmap(((ObjLines *)object)->start, ((ObjLines *)object)->size);
+      break;
+    case OBJ_ARRAY:
+      free(((ObjArray *)object)->values);
+      pthread_rwlock_destroy(&((ObjArray *)object)->lock);
+      break;
+    case OBJ_DICT:
+      free_hash_map(&((ObjDict *)object)->table);
+      pthread_rwlock_destroy(&((ObjDict *)object)->lock);
+      break;
+    case OBJ_BUILDER:
+      free(((ObjBuilder *)object)->chars);
+      pthread_mutex_destroy(&((ObjBuilder *)object)->lock);
+      break;
+    case OBJ_FUNCTION:
+      free_chunk(&((ObjFunction *)object)->chunk);
+      break;
+    }
+    free(object);
+    object = next;
+  }
 }
@@ -1,9 +1,21 @@
 #pragma once
+#include "hash_map.h"
 #include "value.h"
+#include "vm.h"
 #include <stdint.h>
 
 typedef enum {
   OBJ_STRING,
+  OBJ_ROPE,
+  OBJ_COROUTINE,
+  OBJ_NATIVE,
+  OBJ_CHANNEL,
+  OBJ_FILE,
+  OBJ_LINES,
+  OBJ_ARRAY,
+  OBJ_DICT,
+  OBJ_BUILDER,
+  OBJ_FUNCTION,
 } ObjType;
 
 // This is a form of inheritance
@@ -18,24 +30,197 @@ struct ObjString {
   int length;
   char *chars;
   uint32_t hash;
+  // set for a view into memory owned by another object (e.g. a line of a
+  // mapped file). Views are not interned or null terminated and their hash is
+  // not computed
+  Obj *owner;
 };
 
-#define FNV_PRIME_32 16777619
-#define FNV_OFFSET_32 2166136261U
+// Lazy concatenation of two strings or ropes. Building one is O(1), the
+// characters are only materialized (into an interned ObjString) the first time
+// they are needed.
+typedef struct {
+  Obj obj;
+  int length;
+  Obj *left;
+  Obj *right;
+  ObjString *flat;
+} ObjRope;
+
+// A suspended computation owning its own stack and saved ip in an embedded
+// task. Resuming points the vm at that task, yielding points it back at the
+// caller, nothing is copied either way. A finished coroutine has a NULL ip.
+typedef struct {
+  Obj obj;
+  Task task;
+} ObjCoroutine;
+
+typedef enum {
+  NATIVE_OK,
+  // the native already reported the error with log_vm_error
+  NATIVE_ERROR,
+  // the call cannot complete yet (e.g. receiving from an empty channel), the
+  // vm lets other tasks run and calls it again
+  NATIVE_BLOCKED,
+  // the native stored an I/O request in task->io, the vm parks the task until
+  // it completes and then calls the native again
+  NATIVE_SUSPENDED,
+} NativeResult;
+
+// a builtin implemented in C. args points at the arguments on the calling
+// task's stack, the value stored in result replaces the callee and arguments
+typedef NativeResult (*NativeFn)(VM *vm, Task *task, int arg_count,
+                                 Value *args, Value *result);
+
+typedef struct {
+  Obj obj;
+  NativeFn function;
+  const char *name;
+  int arity;
+  // for natives defined through tinylang.h, the embedder's function and the
+  // pointer it is passed
+  void (*external)(void);
+  void *user_data;
+} ObjNative;
+
+typedef struct Channel Channel;
+
+// this vm's handle on a channel, the channel itself is shared by every vm
+// holding a handle and freed with the last one
+typedef struct {
+  Obj obj;
+  Channel *channel;
+} ObjChannel;
+
+// an open file descriptor, closed by close() or when the vm is freed. The
+// read end of a pipe keeps its write end in writer
+typedef struct ObjFile {
+  Obj obj;
+  int fd;
+  struct ObjFile *writer;
+} ObjFile;
+
+// reads a memory mapped file a line at a time, each line is a view into the
+// mapping, which stays mapped until the vm is freed
+typedef struct {
+  Obj obj;
+  char *start;
+  size_t size;
+  // offset of the next line, advanced with a compare and swap so tasks can
+  // share a reader
+  size_t position;
+  // the mapping up to here has been passed to MADV_WILLNEED
+  size_t prefetched;
+} ObjLines;
+
+// a growable array of numbers stored unboxed and contiguous, so bulk
+// arithmetic over it runs as one instruction (see array.c)
+typedef struct {
+  Obj obj;
+  size_t count;
+  size_t capacity;
+  double *values;
+  // held around every use of values while tasks run on several threads, see
+  // lock_array
+  pthread_rwlock_t lock;
+} ObjArray;
+
+// a hash table from any value but nil to a value, see dict.c for how keys
+// are normalized
+typedef struct {
+  Obj obj;
+  Table table;
+  // held around every use of table while tasks run on several threads, see
+  // lock_dict
+  pthread_rwlock_t lock;
+} ObjDict;
+
+// a growable character buffer strings and numbers are appended to in place,
+// turned into a string once at the end (see builder.c)
+typedef struct {
+  Obj obj;
+  char *chars;
+  size_t length;
+  size_t capacity;
+  // held by append, build and len while tasks run on several threads, see
+  // lock_builder
+  pthread_mutex_t lock;
+} ObjBuilder;
+
+// a function declared with fun. Its body is compiled into a chunk of its own,
+// calling it runs that chunk in a new call frame of the calling task with the
+// arguments, still where the caller pushed them, as its first locals
+typedef struct {
+  Obj obj;
+  ObjString *name;
+  int arity;
+  Chunk chunk;
+} ObjFunction;
+
+// concatenations shorter than this are copied eagerly, a rope node costs more
+// than copying a handful of bytes
+#define ROPE_MIN_LENGTH 32
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+#define IS_ROPE(value) is_obj_type(value, OBJ_ROPE)
+#define IS_COROUTINE(value) is_obj_type(value, OBJ_COROUTINE)
+#define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
+#define IS_CHANNEL(value) is_obj_type(value, OBJ_CHANNEL)
+#define IS_FILE(value) is_obj_type(value, OBJ_FILE)
+#define IS_LINES(value) is_obj_type(value, OBJ_LINES)
+#define IS_ARRAY(value) is_obj_type(value, OBJ_ARRAY)
+#define IS_DICT(value) is_obj_type(value, OBJ_DICT)
+#define IS_BUILDER(value) is_obj_type(value, OBJ_BUILDER)
+#define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
 
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_ROPE(value) ((ObjRope *)AS_OBJ(value))
+#define AS_COROUTINE(value) ((ObjCoroutine *)AS_OBJ(value))
+#define AS_NATIVE(value) ((ObjNative *)AS_OBJ(value))
+#define AS_CHANNEL(value) ((ObjChannel *)AS_OBJ(value))
+#define AS_FILE(value) ((ObjFile *)AS_OBJ(value))
+#define AS_LINES(value) ((ObjLines *)AS_OBJ(value))
+#define AS_ARRAY(value) ((ObjArray *)AS_OBJ(value))
+#define AS_DICT(value) ((ObjDict *)AS_OBJ(value))
+#define AS_BUILDER(value) ((ObjBuilder *)AS_OBJ(value))
+#define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
 
 static inline bool is_obj_type(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
-static Obj *allocate_object(Obj *objects, size_t size, ObjType type);
-static ObjString *allocate_string(Obj *objects, char *chars, size_t length,
+// true for any value holding characters, flat or not
+static inline bool is_string_value(Value value) {
+  return IS_STRING(value) || IS_ROPE(value);
+}
+
+static inline int string_value_length(Value value) {
+  return IS_ROPE(value) ? AS_ROPE(value)->length : AS_STRING(value)->length;
+}
+
+static Obj *allocate_object(VM *vm, size_t size, ObjType type);
+static ObjString *allocate_string(VM *vm, char *chars, size_t length,
                                   uint32_t hash);
-size_t calculate_string_length(char *chars);
-ObjString *create_string(Obj *objects, char *chars);
+uint32_t hash_string(const char *chars, size_t length);
+ObjString *copy_string(VM *vm, const char *chars, size_t length);
+ObjString *take_string(VM *vm, char *chars, size_t length);
+Value concatenate_strings(VM *vm, Value a, Value b);
+ObjString *flatten_string(VM *vm, Value value);
+ObjString *flatten_c_string(VM *vm, Value value);
+ObjString *new_string_view(VM *vm, Obj *owner, char *chars, size_t length);
+void print_rope(ObjRope *rope);
+void copy_rope_chars(ObjRope *rope, char *dest);
+ObjCoroutine *new_coroutine(VM *vm, Chunk *chunk, uint8_t *ip);
+ObjNative *new_native(VM *vm, const char *name, NativeFn function, int arity);
+ObjChannel *new_channel_object(VM *vm, Channel *channel);
+ObjFile *new_file(VM *vm, int fd);
+void close_file(ObjFile *file);
+ObjLines *new_lines(VM *vm, char *start, size_t size);
+ObjArray *new_array(VM *vm, size_t capacity);
+ObjDict *new_dict(VM *vm);
+ObjBuilder *new_builder(VM *vm);
+ObjFunction *new_function(VM *vm, ObjString *name, int arity);
+void free_objects(Obj *objects);
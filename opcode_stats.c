@@ -0,0 +1,214 @@
+#include "opcode_stats.h"
+#include "chunk.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// rows shown per table by print_opcode_stats
+#define TOP_ROWS 20
+
+OpcodeStats *create_opcode_stats(void) {
+  OpcodeStats *stats = (OpcodeStats *)calloc(1, sizeof(OpcodeStats));
+  if (stats == NULL) {
+    printf("ran out of memory when allocating opcode stats\n");
+    exit(1);
+  }
+  pthread_mutex_init(&stats->lock, NULL);
+  return stats;
+}
+
+void free_opcode_stats(OpcodeStats *stats) {
+  ChunkHits *hits = stats->chunks;
+  while (hits != NULL) {
+    ChunkHits *next = hits->next;
+    free(hits->counts);
+    free(hits);
+    hits = next;
+  }
+  pthread_mutex_destroy(&stats->lock);
+  free(stats);
+}
+
+void init_opcode_trace(OpcodeTrace *trace) {
+  trace->previous = -1;
+  trace->chunk = NULL;
+  trace->hits = NULL;
+}
+
+static uint64_t *find_hits(OpcodeStats *stats, Chunk *chunk) {
+  ChunkHits *hits = __atomic_load_n(&stats->chunks, __ATOMIC_ACQUIRE);
+  for (; hits != NULL; hits = hits->next) {
+    if (hits->chunk == chunk)
+      return hits->counts;
+  }
+  return NULL;
+}
+
+// the per offset counters of chunk, added the first time it runs
+uint64_t *chunk_hits(OpcodeStats *stats, Chunk *chunk) {
+  uint64_t *counts = find_hits(stats, chunk);
+  if (counts != NULL)
+    return counts;
+
+  pthread_mutex_lock(&stats->lock);
+  counts = find_hits(stats, chunk);
+  if (counts == NULL) {
+    ChunkHits *hits = (ChunkHits *)malloc(sizeof(ChunkHits));
+    counts = (uint64_t *)calloc(chunk->count, sizeof(uint64_t));
+    if (hits == NULL || counts == NULL) {
+      printf("ran out of memory when counting instructions\n");
+      exit(1);
+    }
+    hits->chunk = chunk;
+    hits->counts = counts;
+    hits->next = stats->chunks;
+    __atomic_store_n(&stats->chunks, hits, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&stats->lock);
+  return counts;
+}
+
+// one counter of any of the three kinds, for sorting
+typedef struct {
+  uint64_t count;
+  int first;
+  int second;
+  Chunk *chunk;
+  size_t offset;
+} StatRow;
+
+static int compare_rows(const void *a, const void *b) {
+  const StatRow *left = (const StatRow *)a;
+  const StatRow *right = (const StatRow *)b;
+  if (left->count != right->count)
+    return left->count < right->count ? 1 : -1;
+  if (left->offset != right->offset)
+    return left->offset < right->offset ? -1 : 1;
+  if (left->first != right->first)
+    return left->first - right->first;
+  return left->second - right->second;
+}
+
+static StatRow *allocate_rows(size_t count) {
+  StatRow *rows = (StatRow *)malloc((count + 1) * sizeof(StatRow));
+  if (rows == NULL) {
+    printf("ran out of memory when sorting opcode stats\n");
+    exit(1);
+  }
+  return rows;
+}
+
+static size_t opcode_rows(OpcodeStats *stats, StatRow **rows) {
+  *rows = allocate_rows(OPCODE_COUNT);
+  size_t count = 0;
+  for (int i = 0; i < OPCODE_COUNT; i++) {
+    if (stats->counts[i] > 0)
+      (*rows)[count++] = (StatRow){stats->counts[i], i, -1, NULL, 0};
+  }
+  qsort(*rows, count, sizeof(StatRow), compare_rows);
+  return count;
+}
+
+static size_t pair_rows(OpcodeStats *stats, StatRow **rows) {
+  *rows = allocate_rows(OPCODE_COUNT * OPCODE_COUNT);
+  size_t count = 0;
+  for (int i = 0; i < OPCODE_COUNT; i++) {
+    for (int j = 0; j < OPCODE_COUNT; j++) {
+      if (stats->pairs[i][j] > 0)
+        (*rows)[count++] = (StatRow){stats->pairs[i][j], i, j, NULL, 0};
+    }
+  }
+  qsort(*rows, count, sizeof(StatRow), compare_rows);
+  return count;
+}
+
+static size_t offset_rows(OpcodeStats *stats, StatRow **rows) {
+  size_t total = 0;
+  for (ChunkHits *hits = stats->chunks; hits != NULL; hits = hits->next)
+    total += hits->chunk->count;
+  *rows = allocate_rows(total);
+  size_t count = 0;
+  for (ChunkHits *hits = stats->chunks; hits != NULL; hits = hits->next) {
+    Chunk *chunk = hits->chunk;
+    for (size_t i = 0; i < chunk->count; i++) {
+      if (hits->counts[i] > 0) {
+        (*rows)[count++] = (StatRow){hits->counts[i], chunk->byte_code[i], -1,
+                                     chunk, i};
+      }
+    }
+  }
+  qsort(*rows, count, sizeof(StatRow), compare_rows);
+  return count;
+}
+
+static double percent(uint64_t count, uint64_t total) {
+  return total > 0 ? 100.0 * count / total : 0;
+}
+
+void print_opcode_stats(OpcodeStats *stats, FILE *file) {
+  uint64_t total = 0;
+  for (int i = 0; i < OPCODE_COUNT; i++)
+    total += stats->counts[i];
+  fprintf(file, "%llu instructions\n", (unsigned long long)total);
+
+  StatRow *rows;
+  size_t count = opcode_rows(stats, &rows);
+  fprintf(file, "\n%14s %7s  opcode\n", "count", "%");
+  for (size_t i = 0; i < count; i++) {
+    fprintf(file, "%14llu %6.2f%%  %s\n", (unsigned long long)rows[i].count,
+            percent(rows[i].count, total), opcode_name(rows[i].first));
+  }
+  free(rows);
+
+  count = pair_rows(stats, &rows);
+  fprintf(file, "\n%14s %7s  pair\n", "count", "%");
+  for (size_t i = 0; i < count && i < TOP_ROWS; i++) {
+    fprintf(file, "%14llu %6.2f%%  %s %s\n", (unsigned long long)rows[i].count,
+            percent(rows[i].count, total), opcode_name(rows[i].first),
+            opcode_name(rows[i].second));
+  }
+  free(rows);
+
+  count = offset_rows(stats, &rows);
+  fprintf(file, "\n%14s %7s  instruction\n", "count", "%");
+  for (size_t i = 0; i < count && i < TOP_ROWS; i++) {
+    Chunk *chunk = rows[i].chunk;
+    fprintf(file, "%14llu %6.2f%%  %s:%04zu line %d %s\n",
+            (unsigned long long)rows[i].count, percent(rows[i].count, total),
+            chunk_name(chunk), rows[i].offset,
+            get_line(chunk, rows[i].offset), opcode_name(rows[i].first));
+  }
+  free(rows);
+}
+
+bool write_opcode_stats_csv(OpcodeStats *stats, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return false;
+
+  fprintf(file, "kind,opcode,next,chunk,offset,line,count\n");
+  StatRow *rows;
+  size_t count = opcode_rows(stats, &rows);
+  for (size_t i = 0; i < count; i++) {
+    fprintf(file, "opcode,%s,,,,,%llu\n", opcode_name(rows[i].first),
+            (unsigned long long)rows[i].count);
+  }
+  free(rows);
+
+  count = pair_rows(stats, &rows);
+  for (size_t i = 0; i < count; i++) {
+    fprintf(file, "pair,%s,%s,,,,%llu\n", opcode_name(rows[i].first),
+            opcode_name(rows[i].second), (unsigned long long)rows[i].count);
+  }
+  free(rows);
+
+  count = offset_rows(stats, &rows);
+  for (size_t i = 0; i < count; i++) {
+    Chunk *chunk = rows[i].chunk;
+    fprintf(file, "offset,%s,,%s,%zu,%d,%llu\n", opcode_name(rows[i].first),
+            chunk_name(chunk), rows[i].offset,
+            get_line(chunk, rows[i].offset),
+            (unsigned long long)rows[i].count);
+  }
+  free(rows);
+  return fclose(file) == 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "chunk.h"
+#include "vm.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// how often each instruction of one chunk ran, indexed by offset
+typedef struct ChunkHits ChunkHits;
+
+struct ChunkHits {
+  Chunk *chunk;
+  uint64_t *counts;
+  ChunkHits *next;
+};
+
+// Exact execution counts collected by run() while vm->opcode_stats is set:
+// per opcode, per pair of opcodes run one after the other by the same run
+// loop, and per instruction of every chunk
+struct OpcodeStats {
+  uint64_t counts[OPCODE_COUNT];
+  // [first][second]
+  uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];
+  ChunkHits *chunks;
+  // taken to add a chunk, the list is read without it
+  pthread_mutex_t lock;
+  // set when several vms count into these stats (isolates). They, or the
+  // workers of a vm running tasks, bump the counters with atomic adds
+  bool shared;
+};
+
+// what a run loop remembers between the instructions it counts: the opcode
+// before (-1 at first) and the counters of the chunk it last ran in
+typedef struct {
+  int previous;
+  Chunk *chunk;
+  uint64_t *hits;
+} OpcodeTrace;
+
+OpcodeStats *create_opcode_stats(void);
+void free_opcode_stats(OpcodeStats *stats);
+void init_opcode_trace(OpcodeTrace *trace);
+uint64_t *chunk_hits(OpcodeStats *stats, Chunk *chunk);
+
+static inline void bump_counter(uint64_t *counter, bool atomic) {
+  if (atomic) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+  } else {
+    (*counter)++;
+  }
+}
+
+// counts the instruction at ip, an offset of chunk
+static inline void count_instruction(VM *vm, OpcodeTrace *trace, Chunk *chunk,
+                                     uint8_t *ip) {
+  OpcodeStats *stats = vm->opcode_stats;
+  uint8_t opcode = *ip;
+  if (opcode >= OPCODE_COUNT)
+    return;
+  if (chunk != trace->chunk) {
+    trace->chunk = chunk;
+    trace->hits = chunk_hits(stats, chunk);
+  }
+  bool atomic = stats->shared || vm->scheduler != NULL;
+  bump_counter(&stats->counts[opcode], atomic);
+  if (trace->previous >= 0)
+    bump_counter(&stats->pairs[trace->previous][opcode], atomic);
+  bump_counter(&trace->hits[ip - chunk->byte_code], atomic);
+  trace->previous = opcode;
+}
+// the counts as tables sorted by count, the top rows of each
+void print_opcode_stats(OpcodeStats *stats, FILE *file);
+// every non-zero counter as one csv row, false when path can not be written
+bool write_opcode_stats_csv(OpcodeStats *stats, const char *path);
@@ -0,0 +1,178 @@
+#include "output.h"
+#include "format_number.h"
+#include "object.h"
+#include "value.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void init_output(OutputBuffer *output, int fd, FlushPolicy policy) {
+  output->data = NULL;
+  output->length = 0;
+  output->capacity = 0;
+  output->policy = policy;
+  output->fd = fd;
+  pthread_mutex_init(&output->lock, NULL);
+}
+
+void free_output(OutputBuffer *output) {
+  flush_output(output);
+  free(output->data);
+  pthread_mutex_destroy(&output->lock);
+}
+
+void flush_output(OutputBuffer *output) {
+  // anything printed through stdio (e.g. error messages) came first
+  fflush(stdout);
+  size_t written = 0;
+  while (written < output->length) {
+    ssize_t count =
+        write(output->fd, output->data + written, output->length - written);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      // nowhere left to report to, drop the output like stdio does
+      break;
+    }
+    written += (size_t)count;
+  }
+  output->length = 0;
+}
+
+// makes room for size more bytes, flushing first unless the policy keeps
+// everything until exit
+static char *reserve_output(OutputBuffer *output, size_t size) {
+  if (output->length + size > output->capacity) {
+    if (output->policy != FLUSH_AT_EXIT)
+      flush_output(output);
+    if (output->length + size > output->capacity) {
+      size_t capacity =
+          output->capacity < OUTPUT_BUFFER_SIZE ? OUTPUT_BUFFER_SIZE
+                                                : output->capacity * 2;
+      while (capacity < output->length + size)
+        capacity *= 2;
+      output->data = (char *)realloc(output->data, capacity);
+      if (output->data == NULL) {
+        printf("ran out of memory when buffering output\n");
+        exit(1);
+      }
+      output->capacity = capacity;
+    }
+  }
+  return output->data + output->length;
+}
+
+static void append_output(OutputBuffer *output, const char *chars,
+                          size_t length) {
+  memcpy(reserve_output(output, length), chars, length);
+  output->length += length;
+}
+
+// [1.0, 2.5] with every element formatted like a number
+static void output_array(OutputBuffer *output, ObjArray *array) {
+  // always taken, as for dictionaries
+  pthread_rwlock_rdlock(&array->lock);
+  append_output(output, "[", 1);
+  for (size_t i = 0; i < array->count; i++) {
+    if (i > 0)
+      append_output(output, ", ", 2);
+    char *chars = reserve_output(output, FORMAT_NUMBER_SIZE);
+    output->length += format_number(array->values[i], chars);
+  }
+  pthread_rwlock_unlock(&array->lock);
+  append_output(output, "]", 1);
+}
+
+static void output_value(OutputBuffer *output, Value value, int depth);
+
+// {"name": "ada", 1.0: true}, dictionaries nested deeper than
+// OUTPUT_MAX_DEPTH (e.g. one holding itself) print as {...}
+static void output_dict(OutputBuffer *output, ObjDict *dict, int depth) {
+  if (depth > OUTPUT_MAX_DEPTH) {
+    append_output(output, "{...}", 5);
+    return;
+  }
+  append_output(output, "{", 1);
+  size_t position = 0;
+  Entry *entry;
+  bool first = true;
+  // the output buffer does not know whether tasks run on several threads, so
+  // the dictionary's lock is always taken. A nested copy of the same
+  // dictionary takes it again, shared
+  pthread_rwlock_rdlock(&dict->lock);
+  while ((entry = next_entry(&dict->table, &position)) != NULL) {
+    if (!first)
+      append_output(output, ", ", 2);
+    first = false;
+    output_value(output, entry_key(entry), depth + 1);
+    append_output(output, ": ", 2);
+    output_value(output, entry->value, depth + 1);
+  }
+  pthread_rwlock_unlock(&dict->lock);
+  append_output(output, "}", 1);
+}
+
+// strings inside a dictionary (depth > 0) are quoted
+static void output_value(OutputBuffer *output, Value value, int depth) {
+  switch (value.type) {
+  case VAL_NIL:
+    append_output(output, "NULL", 4);
+    break;
+  case VAL_BOOL:
+    if (AS_BOOL(value)) {
+      append_output(output, "true", 4);
+    } else {
+      append_output(output, "false", 5);
+    }
+    break;
+  case VAL_NUMBER: {
+    // formatted straight into the buffer
+    char *chars = reserve_output(output, FORMAT_NUMBER_SIZE);
+    output->length += format_number(AS_NUMBER(value), chars);
+    break;
+  }
+  case VAL_INT: {
+    char *chars = reserve_output(output, FORMAT_NUMBER_SIZE);
+    output->length += format_integer(AS_INT(value), chars);
+    break;
+  }
+  case VAL_OBJ:
+    if (IS_STRING(value)) {
+      if (depth > 0)
+        append_output(output, "\"", 1);
+      append_output(output, AS_CSTRING(value), AS_STRING(value)->length);
+      if (depth > 0)
+        append_output(output, "\"", 1);
+    } else if (IS_ARRAY(value)) {
+      output_array(output, AS_ARRAY(value));
+    } else if (IS_DICT(value)) {
+      output_dict(output, AS_DICT(value), depth);
+    } else {
+      char text[OBJECT_TEXT_SIZE];
+      append_output(output, text, format_object(value, text, sizeof(text)));
+    }
+    break;
+  }
+}
+
+// value as print shows it, without the newline, in a buffer of *length bytes
+// the caller frees. Ropes must be flattened by the caller, as for output_line
+char *format_value_text(Value value, size_t *length) {
+  OutputBuffer text;
+  init_output(&text, -1, FLUSH_AT_EXIT);
+  output_value(&text, value, 0);
+  pthread_mutex_destroy(&text.lock);
+  *length = text.length;
+  return text.data;
+}
+
+// writes value and a newline. Ropes must be flattened by the caller, they
+// may need the vm's heap
+void output_line(OutputBuffer *output, Value value) {
+  output_value(output, value, 0);
+  append_output(output, "\n", 1);
+  if (output->policy == FLUSH_LINE)
+    flush_output(output);
+}
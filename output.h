@@ -0,0 +1,36 @@
+#pragma once
+#include "value.h"
+#include <pthread.h>
+#include <stddef.h>
+
+typedef enum {
+  // write after every line, the default for a terminal
+  FLUSH_LINE,
+  // write when the buffer fills up, the default otherwise
+  FLUSH_FULL,
+  // keep everything until the program ends
+  FLUSH_AT_EXIT,
+} FlushPolicy;
+
+// What print statements write into. Lines go to the file descriptor in one
+// write per flush instead of through stdio, and a flush never splits a line
+// unless the line alone is larger than the buffer.
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+  FlushPolicy policy;
+  int fd;
+  // only taken while a scheduler is running, see lock_output
+  pthread_mutex_t lock;
+} OutputBuffer;
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+// dictionaries nested deeper than this print as {...}
+#define OUTPUT_MAX_DEPTH 16
+
+void init_output(OutputBuffer *output, int fd, FlushPolicy policy);
+void free_output(OutputBuffer *output);
+void flush_output(OutputBuffer *output);
+void output_line(OutputBuffer *output, Value value);
+char *format_value_text(Value value, size_t *length);
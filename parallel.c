@@ -0,0 +1,118 @@
+#include "parallel.h"
+#include "chunk.h"
+#include "scheduler.h"
+#include "value.h"
+#include "vm.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// a loop over integral bounds counts in integers, like a while loop would
+static Value loop_index(double index) {
+  if (index == floor(index) && fabs(index) < 9007199254740992.0)
+    return INT_VAL((int64_t)index);
+  return NUMBER_VAL(index);
+}
+
+bool parallel_bounds_valid(double start, double end) {
+  if (!isfinite(start) || !isfinite(end))
+    return false;
+  // end - start may itself overflow to infinity, which fails the test too
+  return end <= start || end - start < (double)SIZE_MAX;
+}
+
+// splits [start, end) into chunks and schedules a task for each. The tasks
+// start at the parent's ip (the loop body) with a copy of its first
+// local_count slots followed by their index, end and reduction identities
+ParallelLoop *start_parallel_loop(VM *vm, Task *parent, double start,
+                                  double end, uint8_t local_count,
+                                  int reduction_count, uint8_t *reductions) {
+  if (vm->scheduler == NULL) {
+    vm->scheduler = create_scheduler(vm, vm->worker_count);
+  }
+  // parallel_bounds_valid holds, so the count fits
+  size_t iterations = end > start ? (size_t)ceil(end - start) : 0;
+  size_t chunk_count =
+      vm->scheduler->worker_count * PARALLEL_CHUNKS_PER_WORKER;
+  if (chunk_count > iterations)
+    chunk_count = iterations;
+
+  ParallelLoop *loop = (ParallelLoop *)malloc(sizeof(ParallelLoop));
+  Value *partials =
+      (Value *)malloc((chunk_count * reduction_count + 1) * sizeof(Value));
+  if (loop == NULL || partials == NULL) {
+    printf("ran out of memory when starting a parallel loop\n");
+    exit(1);
+  }
+  loop->remaining = chunk_count;
+  loop->failed = false;
+  loop->chunk_count = chunk_count;
+  loop->reduction_count = reduction_count;
+  loop->reductions = reductions;
+  loop->partials = partials;
+  loop->partial_slot = local_count + 2;
+  pthread_mutex_init(&loop->lock, NULL);
+  pthread_cond_init(&loop->done, NULL);
+
+  for (size_t i = 0; i < chunk_count; i++) {
+    size_t first = iterations * i / chunk_count;
+    size_t last = iterations * (i + 1) / chunk_count;
+    Task *chunk =
+        create_task(parent->chunk, parent->ip, vm->task_yield_interval);
+    copy_locals(parent, chunk, local_count);
+    stack_push(&chunk->stack, loop_index(start + first));
+    stack_push(&chunk->stack, loop_index(start + last));
+    for (int r = 0; r < reduction_count; r++) {
+      int64_t identity = reductions[r * 3] == OP_MULTIPLY ? 1 : 0;
+      stack_push(&chunk->stack, INT_VAL(identity));
+    }
+    chunk->loop = loop;
+    chunk->chunk_index = i;
+    schedule_task(vm->scheduler, chunk);
+  }
+  return loop;
+}
+
+// called when a chunk's body returns, its reductions are still in their slots
+void store_parallel_partials(Task *task) {
+  ParallelLoop *loop = task->loop;
+  for (int r = 0; r < loop->reduction_count; r++) {
+    loop->partials[task->chunk_index * loop->reduction_count + r] =
+        task->stack.values[loop->partial_slot + r];
+  }
+}
+
+// called by the scheduler when a chunk task ends, whether or not it failed
+void finish_parallel_chunk(Task *task, bool succeeded) {
+  ParallelLoop *loop = task->loop;
+  pthread_mutex_lock(&loop->lock);
+  if (!succeeded)
+    loop->failed = true;
+  if (--loop->remaining == 0)
+    pthread_cond_broadcast(&loop->done);
+  pthread_mutex_unlock(&loop->lock);
+}
+
+// the last chunk touches the loop under its lock, checking under the lock
+// makes it safe to free the loop as soon as this returns true
+bool is_parallel_loop_done(ParallelLoop *loop) {
+  pthread_mutex_lock(&loop->lock);
+  bool done = loop->remaining == 0;
+  pthread_mutex_unlock(&loop->lock);
+  return done;
+}
+
+void wait_for_parallel_loop(ParallelLoop *loop) {
+  pthread_mutex_lock(&loop->lock);
+  while (loop->remaining > 0) {
+    pthread_cond_wait(&loop->done, &loop->lock);
+  }
+  pthread_mutex_unlock(&loop->lock);
+}
+
+void free_parallel_loop(ParallelLoop *loop) {
+  pthread_mutex_destroy(&loop->lock);
+  pthread_cond_destroy(&loop->done);
+  free(loop->partials);
+  free(loop);
+}
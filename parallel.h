@@ -0,0 +1,39 @@
+#pragma once
+#include "vm.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// The state a parallel loop's tasks share with the task that started it.
+// Chunk tasks leave their reduction results in partials and count down
+// remaining, the starting task waits in OP_PARALLEL_JOIN and folds them in.
+struct ParallelLoop {
+  size_t remaining;
+  bool failed;
+  size_t chunk_count;
+  int reduction_count;
+  // the reduction operands of the OP_PARALLEL instruction, 3 bytes each
+  uint8_t *reductions;
+  // chunk_count * reduction_count results, by chunk then reduction
+  Value *partials;
+  // stack slot of the first reduction in a chunk task
+  int partial_slot;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+};
+
+// iterations handed to each worker, more than one chunk per worker evens out
+// uneven iterations
+#define PARALLEL_CHUNKS_PER_WORKER 4
+
+// false when start or end is not finite or the loop has more iterations than
+// a size_t counts
+bool parallel_bounds_valid(double start, double end);
+ParallelLoop *start_parallel_loop(VM *vm, Task *parent, double start,
+                                  double end, uint8_t local_count,
+                                  int reduction_count, uint8_t *reductions);
+void store_parallel_partials(Task *task);
+void finish_parallel_chunk(Task *task, bool succeeded);
+bool is_parallel_loop_done(ParallelLoop *loop);
+void wait_for_parallel_loop(ParallelLoop *loop);
+void free_parallel_loop(ParallelLoop *loop);
@@ -11,9 +11,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 ParseRule rules[] = {
-    [LEFT_PAREN] = {grouping, NULL, PREC_NONE},
+    [LEFT_PAREN] = {grouping, call, PREC_CALL},
+    [LEFT_SQUARE] = {array_literal, subscript, PREC_CALL},
+    [LEFT_BRACKET] = {dict_literal, NULL, PREC_NONE},
     [RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
     [MINUS] = {unary, binary, PREC_TERM},
     [BANG] = {unary, NULL, PREC_NONE},
@@ -33,16 +36,34 @@ ParseRule rules[] = {
     [NIL] = {literal, NULL, PREC_NONE},
     [TRUE] = {literal, NULL, PREC_NONE},
     [STRING] = {literal, NULL, PREC_NONE},
+    [INTERPOLATION] = {interpolation, NULL, PREC_NONE},
     [IDENTIFIER] = {variable, NULL, PREC_NONE},
+    [COROUTINE] = {coroutine, NULL, PREC_NONE},
+    [RESUME] = {resume, NULL, PREC_NONE},
 };
 
 void init_parser(Parser *parser) {
   parser->current_token = NULL;
   parser->previous_token = NULL;
   parser->chunk = NULL;
+  init_hash_map(&parser->string_constants);
   parser->had_error = false;
   parser->panic_mode = false;
   parser->vm = NULL;
+  parser->local_count = 0;
+  parser->scope_depth = 0;
+  parser->parallel_depth = 0;
+  parser->parallel_local_base = 0;
+  parser->in_function = false;
+  parser->last_call = -1;
+}
+
+static void parser_error(Parser *parser, const char *message) {
+  if (parser->panic_mode)
+    return;
+  parser->had_error = true;
+  parser->panic_mode = true;
+  log_error(parser->previous_token->line, message);
 }
 
 static void report_parsing_error(Parser *parser) {
@@ -92,18 +113,49 @@ static void emit_bytes(Parser *parser, int num_bytes, ...) {
   va_end(args);
 }
 
+// instructions address the constant pool with one byte
+static bool check_constant_index(Parser *parser, int index) {
+  if (index <= UINT8_MAX)
+    return true;
+  parser_error(parser, "too many constants in one chunk\n");
+  return false;
+}
+
 static void emit_constant(Parser *parser, Value value) {
   int constant_index = add_constant(parser->chunk, value);
-  emit_bytes(parser, 2, OP_CONSTANT, constant_index);
+  if (check_constant_index(parser, constant_index))
+    emit_bytes(parser, 2, OP_CONSTANT, constant_index);
 }
 
 static void emit_return(Parser *parser) { emit_byte(parser, OP_RETURN); }
 
+// lexemes live in the compiler arena so string constants are copied into the
+// vm heap, reusing an existing constant when the same string was seen before
+// in this chunk, found through string_constants rather than a scan of the pool
+static uint8_t string_constant(Parser *parser, Token *token) {
+  ObjString *string = copy_string(parser->vm, token->lexeme, token->length);
+  Value index;
+  if (parser->string_constants.count > 0 &&
+      get_entry(&parser->string_constants, string, &index))
+    return (uint8_t)AS_NUMBER(index);
+
+  int constant = add_constant(parser->chunk, OBJ_VAL(string));
+  if (!check_constant_index(parser, constant))
+    return 0;
+  insert_entry(&parser->string_constants, string, NUMBER_VAL(constant));
+  return (uint8_t)constant;
+}
+
 static void literal(Parser *parser) {
   switch (parser->previous_token->type) {
   case NUMBER:
-    emit_constant(parser,
-                  NUMBER_VAL(strtod(parser->previous_token->lexeme, NULL)));
+    // literals too large for an integer are read as doubles
+    if (parser->previous_token->literal.int_value >= 0) {
+      emit_constant(parser, INT_VAL(parser->previous_token->literal.int_value));
+    } else {
+      emit_constant(parser,
+                    NUMBER_VAL(strtod(parser->previous_token->lexeme, NULL)));
+    }
     break;
   case FALSE:
     emit_byte(parser, OP_FALSE);
@@ -114,22 +166,127 @@ static void literal(Parser *parser) {
   case NIL:
     emit_byte(parser, OP_NIL);
     break;
-  case STRING: {
-    ObjString *string =
-        create_string(parser->vm->objects, parser->previous_token->lexeme);
-    emit_constant(parser, OBJ_VAL(string));
+  case STRING:
+    emit_bytes(parser, 2, OP_CONSTANT,
+               string_constant(parser, parser->previous_token));
     break;
-  }
   default:
     return;
   }
 }
 
+// "a{x}b{y}c" arrives as INTERPOLATION a, x, INTERPOLATION b, y, STRING c.
+// The parts are left on the stack and joined by one OP_FORMAT, empty text
+// between them is skipped
+static void interpolation(Parser *parser) {
+  int count = 0;
+  do {
+    if (parser->previous_token->length > 0) {
+      emit_bytes(parser, 2, OP_CONSTANT,
+                 string_constant(parser, parser->previous_token));
+      count++;
+    }
+    expression(parser);
+    count++;
+    if (parser->current_token->type != INTERPOLATION)
+      break;
+    advance(parser);
+  } while (true);
+
+  consume(parser, STRING, "expected '}' after interpolated expression\n");
+  if (parser->previous_token->type == STRING &&
+      parser->previous_token->length > 0) {
+    emit_bytes(parser, 2, OP_CONSTANT,
+               string_constant(parser, parser->previous_token));
+    count++;
+  }
+  if (count > UINT8_MAX) {
+    parser_error(parser, "too many parts in an interpolated string\n");
+  }
+  emit_bytes(parser, 2, OP_FORMAT, count);
+}
+
 static void grouping(Parser *parser) {
   expression(parser);
   consume(parser, RIGHT_PAREN, "");
 }
 
+static uint8_t argument_list(Parser *parser) {
+  int arg_count = 0;
+  if (parser->current_token->type != RIGHT_PAREN) {
+    do {
+      expression(parser);
+      if (arg_count == UINT8_MAX) {
+        parser_error(parser, "too many arguments\n");
+      }
+      arg_count++;
+      if (parser->current_token->type != COMMA)
+        break;
+      advance(parser);
+    } while (true);
+  }
+  consume(parser, RIGHT_PAREN, "expected ')' after arguments\n");
+  return arg_count;
+}
+
+static void call(Parser *parser) {
+  uint8_t arg_count = argument_list(parser);
+  parser->last_call = parser->chunk->count;
+  emit_bytes(parser, 2, OP_CALL, arg_count);
+}
+
+// [1, 2, 3] builds an array from the values left on the stack
+static void array_literal(Parser *parser) {
+  int count = 0;
+  if (parser->current_token->type != RIGHT_SQUARE) {
+    do {
+      expression(parser);
+      if (count == UINT8_MAX) {
+        parser_error(parser, "too many elements in an array literal\n");
+      }
+      count++;
+      if (parser->current_token->type != COMMA)
+        break;
+      advance(parser);
+    } while (true);
+  }
+  consume(parser, RIGHT_SQUARE, "expected ']' after array elements\n");
+  emit_bytes(parser, 2, OP_ARRAY, count);
+}
+
+// {key: value, ...} in an expression, a '{' starting a statement is a block
+static void dict_literal(Parser *parser) {
+  int count = 0;
+  if (parser->current_token->type != RIGHT_BRACKET) {
+    do {
+      expression(parser);
+      consume(parser, COLON, "expected ':' after dictionary key\n");
+      expression(parser);
+      if (count == UINT8_MAX) {
+        parser_error(parser, "too many entries in a dictionary literal\n");
+      }
+      count++;
+      if (parser->current_token->type != COMMA)
+        break;
+      advance(parser);
+    } while (true);
+  }
+  consume(parser, RIGHT_BRACKET, "expected '}' after dictionary entries\n");
+  emit_bytes(parser, 2, OP_DICT, count);
+}
+
+static void subscript(Parser *parser) {
+  expression(parser);
+  consume(parser, RIGHT_SQUARE, "expected ']' after index\n");
+  if (parser->current_token->type == EQUAL) {
+    advance(parser);
+    expression(parser);
+    emit_byte(parser, OP_SET_INDEX);
+  } else {
+    emit_byte(parser, OP_GET_INDEX);
+  }
+}
+
 static ParseRule *get_rule(TokenType token_type) { return &rules[token_type]; }
 
 static void parse_precedence(Parser *parser, Precedence prescedence) {
@@ -211,16 +368,62 @@ static void binary(Parser *parser) {
   }
 }
 
+static bool identifiers_equal(Token *a, Token *b) {
+  return a->length == b->length && memcmp(a->lexeme, b->lexeme, a->length) == 0;
+}
+
+// returns the stack slot of a local or -1 if the name refers to a global
+static int resolve_local(Parser *parser, Token *name) {
+  for (int i = parser->local_count - 1; i >= 0; i--) {
+    Local *local = &parser->locals[i];
+    if (identifiers_equal(name, local->name)) {
+      if (local->depth == -1) {
+        parser_error(parser, "cannot read a local in its own initializer\n");
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+
+// a parallel loop body runs on several threads at once with copies of the
+// enclosing locals, so writes to globals would race and writes to enclosing
+// locals would be lost. Values leave the loop through its reduce clause
+static void check_parallel_assignment(Parser *parser, uint8_t set_op,
+                                      int slot) {
+  if (parser->parallel_depth == 0)
+    return;
+  if (set_op == OP_SET_GLOBAL) {
+    parser_error(parser, "cannot assign to a global inside a parallel loop, "
+                         "list it in the loop's reduce clause\n");
+  } else if (slot < parser->parallel_local_base) {
+    parser_error(parser, "cannot assign to an enclosing local inside a "
+                         "parallel loop, list it in the loop's reduce "
+                         "clause\n");
+  } else if (slot == parser->parallel_local_base) {
+    parser_error(parser, "cannot assign to a parallel loop's index\n");
+  }
+}
+
 static void variable(Parser *parser) {
-  uint8_t arg_index = add_constant(
-      parser->chunk, OBJ_VAL(create_string(parser->vm->objects,
-                                           parser->previous_token->lexeme)));
+  uint8_t get_op, set_op;
+  int arg_index = resolve_local(parser, parser->previous_token);
+  if (arg_index != -1) {
+    get_op = OP_GET_LOCAL;
+    set_op = OP_SET_LOCAL;
+  } else {
+    arg_index = string_constant(parser, parser->previous_token);
+    get_op = OP_GET_GLOBAL;
+    set_op = OP_SET_GLOBAL;
+  }
+
   if (parser->current_token->type == EQUAL) {
+    check_parallel_assignment(parser, set_op, arg_index);
     advance(parser);
     expression(parser);
-    emit_bytes(parser, 2, OP_SET_GLOBAL, arg_index);
+    emit_bytes(parser, 2, set_op, arg_index);
   } else {
-    emit_bytes(parser, 2, OP_GET_GLOBAL, arg_index);
+    emit_bytes(parser, 2, get_op, arg_index);
   }
 }
 
@@ -234,6 +437,17 @@ static void print_statement(Parser *parser) {
   emit_byte(parser, OP_PRINT);
 }
 
+static void begin_scope(Parser *parser) { parser->scope_depth++; }
+
+static void end_scope(Parser *parser) {
+  parser->scope_depth--;
+  while (parser->local_count > 0 &&
+         parser->locals[parser->local_count - 1].depth > parser->scope_depth) {
+    emit_byte(parser, OP_POP);
+    parser->local_count--;
+  }
+}
+
 static void expression_statement(Parser *parser) {
   expression(parser);
   consume(parser, SEMICOLON, "expected semicolon after expression statment\n");
@@ -300,13 +514,188 @@ static void while_statement(Parser *parser) {
   emit_loop(parser, loop_start);
 
   patch_jump(parser, exit_jump);
+  emit_byte(parser, OP_POP);
 }
 
 static void block_statement(Parser *parser) {
-  while (parser->current_token->type != RIGHT_BRACKET) {
+  begin_scope(parser);
+  while (parser->current_token->type != RIGHT_BRACKET &&
+         parser->current_token->type != END) {
     advance(parser);
-    statement(parser);
+    declaration(parser);
+  }
+  consume(parser, RIGHT_BRACKET, "expected '}' after block\n");
+  end_scope(parser);
+}
+
+// compiles the statement run by a spawned task or a coroutine. The body
+// starts right after the instruction's operands with a copy of the enclosing
+// locals in the same slots, the code creating it jumps over the body
+static void body_statement(Parser *parser, uint8_t instruction) {
+  int body_jump = emit_jump(parser, instruction);
+  emit_byte(parser, parser->local_count);
+  bool in_function = parser->in_function;
+  parser->in_function = false;
+  advance(parser);
+  statement(parser);
+  emit_return(parser);
+  parser->in_function = in_function;
+
+  // -3 to skip the jump offset and the local count
+  int jump = parser->chunk->count - body_jump - 3;
+  parser->chunk->byte_code[body_jump] = (jump >> 8) & 0xff;
+  parser->chunk->byte_code[body_jump + 1] = jump & 0xff;
+}
+
+static void spawn_statement(Parser *parser) { body_statement(parser, OP_SPAWN); }
+
+// `coroutine <statement>` evaluates to a suspended coroutine, the statement
+// runs when it is resumed
+static void coroutine(Parser *parser) { body_statement(parser, OP_COROUTINE); }
+
+// `resume <coroutine>` runs the coroutine up to its next yield and evaluates to
+// the yielded value, or nil once the coroutine has finished
+static void resume(Parser *parser) {
+  parse_precedence(parser, PREC_UNARY);
+  emit_byte(parser, OP_RESUME);
+}
+
+static void yield_statement(Parser *parser) {
+  expression(parser);
+  consume(parser, SEMICOLON, "expected semicolon after yield statment\n");
+  emit_byte(parser, OP_YIELD);
+}
+
+static void add_local(Parser *parser, Token *name) {
+  if (parser->local_count == MAX_LOCALS) {
+    parser_error(parser, "too many local variables\n");
+    return;
+  }
+  Local *local = &parser->locals[parser->local_count++];
+  local->name = name;
+  local->depth = parser->scope_depth;
+}
+
+// parallel (i = start, end) reduce (+ total, * product) statement
+//
+// runs the statement for i from start up to end, split into chunks that run
+// as tasks. Each chunk starts its reduction variables at 0 (+) or 1 (*) and
+// the chunks' results are folded into the variables in order once all of
+// them have finished. The operands of OP_PARALLEL are the body jump, the
+// enclosing local count, the reduction count and, per reduction, its operator
+// and whether it is a local (1) or a global (0) with the slot or constant
+static void parallel_statement(Parser *parser) {
+  consume(parser, LEFT_PAREN, "expected a '(' after parallel\n");
+  consume(parser, IDENTIFIER, "expected a loop index name\n");
+  Token *index_name = parser->previous_token;
+  consume(parser, EQUAL, "expected '=' after the loop index\n");
+  expression(parser);
+  consume(parser, COMMA, "expected ',' after the loop start\n");
+  expression(parser);
+  consume(parser, RIGHT_PAREN, "expected a ')' after the loop end\n");
+
+  Token *reduction_names[MAX_REDUCTIONS];
+  uint8_t reductions[MAX_REDUCTIONS * 3];
+  int reduction_count = 0;
+  if (parser->current_token->type == REDUCE) {
+    advance(parser);
+    consume(parser, LEFT_PAREN, "expected a '(' after reduce\n");
+    do {
+      uint8_t op = parser->current_token->type == STAR ? OP_MULTIPLY : OP_ADD;
+      if (parser->current_token->type != PLUS &&
+          parser->current_token->type != STAR) {
+        parser_error(parser, "expected '+' or '*' before a reduction\n");
+      }
+      advance(parser);
+      consume(parser, IDENTIFIER, "expected a reduction variable\n");
+      if (reduction_count == MAX_REDUCTIONS) {
+        parser_error(parser, "too many reduction variables\n");
+        break;
+      }
+      Token *name = parser->previous_token;
+      int slot = resolve_local(parser, name);
+      uint8_t *reduction = &reductions[reduction_count * 3];
+      reduction[0] = op;
+      reduction[1] = slot != -1;
+      reduction[2] = slot != -1 ? slot : string_constant(parser, name);
+      reduction_names[reduction_count++] = name;
+      if (parser->current_token->type != COMMA)
+        break;
+      advance(parser);
+    } while (true);
+    consume(parser, RIGHT_PAREN, "expected a ')' after the reductions\n");
+  }
+
+  int body_jump = emit_jump(parser, OP_PARALLEL);
+  emit_bytes(parser, 2, parser->local_count, reduction_count);
+  for (int i = 0; i < reduction_count * 3; i++) {
+    emit_byte(parser, reductions[i]);
+  }
+  int body_start = parser->chunk->count;
+
+  // the chunk task's stack: enclosing locals, index, end, reductions
+  static Token end_name = {.lexeme = "", .length = 0};
+  int enclosing_base = parser->parallel_local_base;
+  int enclosing_count = parser->local_count;
+  begin_scope(parser);
+  int index_slot = parser->local_count;
+  add_local(parser, index_name);
+  add_local(parser, &end_name);
+  for (int i = 0; i < reduction_count; i++) {
+    add_local(parser, reduction_names[i]);
+  }
+  parser->parallel_depth++;
+  parser->parallel_local_base = index_slot;
+  bool in_function = parser->in_function;
+  parser->in_function = false;
+
+  int loop_start = parser->chunk->count;
+  emit_bytes(parser, 4, OP_GET_LOCAL, index_slot, OP_GET_LOCAL,
+             index_slot + 1);
+  emit_byte(parser, OP_LESS);
+  int exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+  emit_byte(parser, OP_POP);
+  advance(parser);
+  statement(parser);
+  emit_bytes(parser, 2, OP_GET_LOCAL, index_slot);
+  emit_constant(parser, INT_VAL(1));
+  emit_byte(parser, OP_ADD);
+  emit_bytes(parser, 3, OP_SET_LOCAL, index_slot, OP_POP);
+  emit_loop(parser, loop_start);
+  patch_jump(parser, exit_jump);
+  emit_byte(parser, OP_POP);
+  // the task ends here, its reductions are read off its stack
+  emit_return(parser);
+
+  parser->parallel_depth--;
+  parser->parallel_local_base = enclosing_base;
+  parser->in_function = in_function;
+  parser->scope_depth--;
+  parser->local_count = enclosing_count;
+
+  int jump = parser->chunk->count - body_start;
+  parser->chunk->byte_code[body_jump] = (jump >> 8) & 0xff;
+  parser->chunk->byte_code[body_jump + 1] = jump & 0xff;
+  emit_byte(parser, OP_PARALLEL_JOIN);
+}
+
+// `return expression;`, or `return;` for nil. When the expression ends with a
+// call, that call becomes OP_TAIL_CALL: the callee takes over the returning
+// function's frame instead of nesting in it
+static void return_statement(Parser *parser) {
+  if (!parser->in_function) {
+    parser_error(parser, "can only return from a function\n");
   }
+  if (parser->current_token->type == SEMICOLON) {
+    emit_byte(parser, OP_NIL);
+  } else {
+    expression(parser);
+    if (parser->last_call == (int)parser->chunk->count - 2) {
+      parser->chunk->byte_code[parser->last_call] = OP_TAIL_CALL;
+    }
+  }
+  consume(parser, SEMICOLON, "expected semicolon after return statement\n");
+  emit_return(parser);
 }
 
 static void statement(Parser *parser) {
@@ -320,6 +709,14 @@ static void statement(Parser *parser) {
     block_statement(parser);
   } else if (parser->previous_token->type == EXPR) {
     expression_statement(parser);
+  } else if (parser->previous_token->type == SPAWN) {
+    spawn_statement(parser);
+  } else if (parser->previous_token->type == YIELD) {
+    yield_statement(parser);
+  } else if (parser->previous_token->type == PARALLEL) {
+    parallel_statement(parser);
+  } else if (parser->previous_token->type == RETURN) {
+    return_statement(parser);
   }
 }
 
@@ -331,6 +728,7 @@ static void synchronize(Parser *parser) {
       return;
     switch (parser->current_token->type) {
     case VAR:
+    case FUN:
     case IF:
     case PRINT:
     case RETURN:
@@ -343,11 +741,37 @@ static void synchronize(Parser *parser) {
   }
 }
 
+static void declare_local(Parser *parser, Token *name) {
+  for (int i = parser->local_count - 1; i >= 0; i--) {
+    Local *local = &parser->locals[i];
+    if (local->depth != -1 && local->depth < parser->scope_depth)
+      break;
+    if (identifiers_equal(name, local->name)) {
+      parser_error(parser, "variable already declared in this scope\n");
+      return;
+    }
+  }
+
+  if (parser->local_count == MAX_LOCALS) {
+    parser_error(parser, "too many local variables\n");
+    return;
+  }
+  Local *local = &parser->locals[parser->local_count++];
+  local->name = name;
+  local->depth = -1;
+}
+
+// variables declared inside a block are locals, the initializer's value is
+// left on the stack and becomes the local's slot
 static void variable_decleration(Parser *parser) {
   consume(parser, IDENTIFIER, "expected identifier after var\n");
-  uint8_t variable_index = add_constant(
-      parser->chunk, OBJ_VAL(create_string(parser->vm->objects,
-                                           parser->previous_token->lexeme)));
+  Token *name = parser->previous_token;
+  uint8_t variable_index = 0;
+  if (parser->scope_depth > 0) {
+    declare_local(parser, name);
+  } else {
+    variable_index = string_constant(parser, name);
+  }
 
   if (parser->current_token->type == EQUAL) {
     advance(parser);
@@ -357,12 +781,83 @@ static void variable_decleration(Parser *parser) {
   }
 
   consume(parser, SEMICOLON, "Expect ';' after variable declaration.");
-  emit_bytes(parser, 2, OP_DEFINE_GLOBAL, variable_index);
+  if (parser->scope_depth > 0) {
+    parser->locals[parser->local_count - 1].depth = parser->scope_depth;
+  } else {
+    emit_bytes(parser, 2, OP_DEFINE_GLOBAL, variable_index);
+  }
+}
+
+// fun name(a, b) { ... } compiles the body into the chunk of a new function
+// and defines it as a global. The arguments are the function's first locals
+// and a body that runs off its end returns nil. Functions cannot see the
+// locals around them, so they are only declared at the top level
+static void function_declaration(Parser *parser) {
+  consume(parser, IDENTIFIER, "expected a function name after fun\n");
+  Token *name = parser->previous_token;
+  uint8_t name_constant = string_constant(parser, name);
+  if (parser->scope_depth > 0 || parser->in_function) {
+    parser_error(parser, "functions can only be declared at the top level\n");
+  }
+
+  ObjFunction *function = new_function(
+      parser->vm, copy_string(parser->vm, name->lexeme, name->length), 0);
+  Chunk *enclosing = parser->chunk;
+  Table enclosing_constants = parser->string_constants;
+  init_hash_map(&parser->string_constants);
+  int enclosing_count = parser->local_count;
+  int enclosing_depth = parser->scope_depth;
+  bool enclosing_in_function = parser->in_function;
+  parser->chunk = &function->chunk;
+  parser->chunk->arena = enclosing->arena;
+  parser->chunk->name = function->name->chars;
+  parser->local_count = 0;
+  parser->scope_depth = 1;
+  parser->in_function = true;
+  parser->last_call = -1;
+
+  consume(parser, LEFT_PAREN, "expected '(' after the function name\n");
+  if (parser->current_token->type != RIGHT_PAREN) {
+    do {
+      consume(parser, IDENTIFIER, "expected a parameter name\n");
+      if (function->arity == UINT8_MAX) {
+        parser_error(parser, "too many parameters\n");
+      }
+      function->arity++;
+      declare_local(parser, parser->previous_token);
+      parser->locals[parser->local_count - 1].depth = parser->scope_depth;
+      if (parser->current_token->type != COMMA)
+        break;
+      advance(parser);
+    } while (true);
+  }
+  consume(parser, RIGHT_PAREN, "expected ')' after parameters\n");
+  consume(parser, LEFT_BRACKET, "expected '{' before the function body\n");
+  while (parser->current_token->type != RIGHT_BRACKET &&
+         parser->current_token->type != END) {
+    advance(parser);
+    declaration(parser);
+  }
+  consume(parser, RIGHT_BRACKET, "expected '}' after the function body\n");
+  emit_bytes(parser, 2, OP_NIL, OP_RETURN);
+  move_chunk_to_heap(parser->chunk);
+
+  free_hash_map(&parser->string_constants);
+  parser->chunk = enclosing;
+  parser->string_constants = enclosing_constants;
+  parser->local_count = enclosing_count;
+  parser->scope_depth = enclosing_depth;
+  parser->in_function = enclosing_in_function;
+  parser->last_call = -1;
+  emit_constant(parser, OBJ_VAL(function));
+  emit_bytes(parser, 2, OP_DEFINE_GLOBAL, name_constant);
 }
 
 static void declaration(Parser *parser) {
   if (parser->previous_token->type == VAR) {
     variable_decleration(parser);
+  } else if (parser->previous_token->type == FUN) {
+    function_declaration(parser);
   } else {
     statement(parser);
   }
@@ -370,7 +865,7 @@ static void declaration(Parser *parser) {
     synchronize(parser);
 }
 
-bool compile(VM *vm, TokenList *token_list, Chunk *chunk) {
+bool compile(VM *vm, Arena *arena, TokenList *token_list, Chunk *chunk) {
   Parser parser;
   init_parser(&parser);
 
@@ -378,6 +873,7 @@ bool compile(VM *vm, TokenList *token_list, Chunk *chunk) {
   parser.current_token = token_list->tokens;
   parser.chunk = chunk;
   parser.vm = vm;
+  chunk->arena = arena;
 
   while (!(parser.current_token->type == END)) {
     advance(&parser);
@@ -386,6 +882,8 @@ bool compile(VM *vm, TokenList *token_list, Chunk *chunk) {
 
   emit_return(&parser);
   consume(&parser, END, "failed to reach end of code\n");
+  move_chunk_to_heap(chunk);
+  free_hash_map(&parser.string_constants);
 
   return !parser.had_error;
 }
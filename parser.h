@@ -1,15 +1,43 @@
 #pragma once
+#include "arena.h"
 #include "chunk.h"
 #include "lexer.h"
 #include "vm.h"
 
+#define MAX_LOCALS 256
+#define MAX_REDUCTIONS 16
+
+// a variable declared inside a block, it lives in a fixed slot at the bottom
+// of the running task's stack
+typedef struct {
+  Token *name;
+  // -1 while the initializer is being compiled
+  int depth;
+} Local;
+
 typedef struct {
   Token *current_token;
   Token *previous_token;
   bool had_error;
   bool panic_mode;
   Chunk *chunk;
+  // the interned names and strings in chunk's constant pool, to their index
+  Table string_constants;
   VM *vm;
+  Local locals[MAX_LOCALS];
+  int local_count;
+  int scope_depth;
+  // nesting of parallel loop bodies being compiled. Inside one, locals below
+  // parallel_local_base belong to the enclosing code and are read only
+  int parallel_depth;
+  int parallel_local_base;
+  // set while the body of a function is compiled, but not the bodies of the
+  // spawn, coroutine and parallel statements in it, which run as tasks of
+  // their own and have no caller to return to
+  bool in_function;
+  // offset of the last OP_CALL emitted. When a return's expression ends with
+  // it, the call is in tail position
+  int last_call;
 } Parser;
 
 typedef enum {
@@ -34,12 +62,19 @@ typedef struct {
   Precedence precedence;
 } ParseRule;
 
-bool compile(VM *vm, TokenList *token_list, Chunk *chunk);
+bool compile(VM *vm, Arena *arena, TokenList *token_list, Chunk *chunk);
 static void grouping(Parser *parser);
 static void expression(Parser *parser);
 static void binary(Parser *parser);
 static void unary(Parser *parser);
 static void literal(Parser *parser);
 static void statement(Parser *parser);
-static void decleration(Parser *parser);
+static void declaration(Parser *parser);
 static void variable(Parser *parser);
+static void coroutine(Parser *parser);
+static void resume(Parser *parser);
+static void call(Parser *parser);
+static void array_literal(Parser *parser);
+static void subscript(Parser *parser);
+static void dict_literal(Parser *parser);
+static void interpolation(Parser *parser);
@@ -0,0 +1,356 @@
+#include "profiler.h"
+#include "chunk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// lines shown by print_profile
+#define TOP_LINES 20
+// characters of a source line quoted by print_profile
+#define QUOTE_WIDTH 48
+
+__thread volatile sig_atomic_t profile_ticks = 0;
+
+static void on_profile_tick(int signal_number) { profile_ticks++; }
+
+Profile *create_profile(int rate) {
+  Profile *profile = (Profile *)calloc(1, sizeof(Profile));
+  if (profile == NULL) {
+    printf("ran out of memory when allocating a profile\n");
+    exit(1);
+  }
+  profile->rate = rate > 0 ? rate : DEFAULT_PROFILE_RATE;
+  pthread_mutex_init(&profile->lock, NULL);
+  return profile;
+}
+
+void free_profile(Profile *profile) {
+  free(profile->frames);
+  free(profile->samples);
+  free(profile->buckets);
+  pthread_mutex_destroy(&profile->lock);
+  free(profile);
+}
+
+bool start_profile(Profile *profile) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_profile_tick;
+  sigemptyset(&action.sa_mask);
+  // reads, writes and waits carry on where the tick interrupted them
+  action.sa_flags = SA_RESTART;
+  if (sigaction(SIGPROF, &action, NULL) != 0)
+    return false;
+
+  long interval = 1000000 / profile->rate;
+  struct itimerval timer;
+  timer.it_interval.tv_sec = interval / 1000000;
+  timer.it_interval.tv_usec = interval > 0 ? interval % 1000000 : 1;
+  timer.it_value = timer.it_interval;
+  profile->started = clock();
+  return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+// the handler stays installed, a tick still on its way would otherwise end
+// the process
+void stop_profile(Profile *profile) {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  profile->cpu_seconds =
+      (double)(clock() - profile->started) / CLOCKS_PER_SEC;
+}
+
+static void *grow_array(void *array, size_t *capacity, size_t size) {
+  *capacity = *capacity < 64 ? 64 : *capacity * 2;
+  array = realloc(array, *capacity * size);
+  if (array == NULL) {
+    printf("ran out of memory when recording a profile\n");
+    exit(1);
+  }
+  return array;
+}
+
+static int frame_line(Chunk *chunk, uint8_t *ip) {
+  size_t offset = ip - chunk->byte_code;
+  return offset < chunk->count ? get_line(chunk, offset) : -1;
+}
+
+// FNV-1a over the frames, so a stack is found again wherever it is stored
+static uint64_t hash_stack(ProfileFrame *frames, int depth, bool truncated) {
+  uint64_t hash = 14695981039346656037ull ^ (uint64_t)truncated;
+  for (int i = 0; i < depth; i++) {
+    hash = (hash ^ (uint64_t)(uintptr_t)frames[i].chunk) * 1099511628211ull;
+    hash = (hash ^ (uint64_t)(uint32_t)frames[i].line) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static bool same_frames(ProfileFrame *left, ProfileFrame *right, int depth) {
+  for (int i = 0; i < depth; i++) {
+    if (left[i].chunk != right[i].chunk || left[i].line != right[i].line)
+      return false;
+  }
+  return true;
+}
+
+// the bucket holding the sample with these frames, or the empty one it would
+// go in
+static size_t *find_bucket(Profile *profile, ProfileFrame *frames, int depth,
+                           bool truncated, uint64_t hash) {
+  size_t mask = profile->bucket_capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    size_t *bucket = &profile->buckets[i];
+    if (*bucket == 0)
+      return bucket;
+    ProfileSample *sample = &profile->samples[*bucket - 1];
+    if (sample->hash == hash && sample->depth == depth &&
+        sample->truncated == truncated &&
+        same_frames(&profile->frames[sample->first], frames, depth))
+      return bucket;
+  }
+}
+
+static void grow_buckets(Profile *profile) {
+  size_t capacity = profile->bucket_capacity < 64
+                        ? 64
+                        : profile->bucket_capacity * 2;
+  free(profile->buckets);
+  profile->buckets = (size_t *)calloc(capacity, sizeof(size_t));
+  if (profile->buckets == NULL) {
+    printf("ran out of memory when recording a profile\n");
+    exit(1);
+  }
+  profile->bucket_capacity = capacity;
+  for (size_t i = 0; i < profile->sample_count; i++) {
+    ProfileSample *sample = &profile->samples[i];
+    *find_bucket(profile, &profile->frames[sample->first], sample->depth,
+                 sample->truncated, sample->hash) = i + 1;
+  }
+}
+
+void record_sample(Profile *profile, Task *task, int weight) {
+  int depth = task->frame_count + 1;
+  bool truncated = depth > PROFILE_MAX_DEPTH;
+  int skipped = truncated ? depth - PROFILE_MAX_DEPTH : 0;
+  depth -= skipped;
+
+  pthread_mutex_lock(&profile->lock);
+  while (profile->frame_count + depth > profile->frame_capacity) {
+    profile->frames =
+        (ProfileFrame *)grow_array(profile->frames, &profile->frame_capacity,
+                                   sizeof(ProfileFrame));
+  }
+
+  // the stack is written past the recorded frames, and only kept there when
+  // it was not seen before
+  ProfileFrame *stack = &profile->frames[profile->frame_count];
+  ProfileFrame *frames = stack;
+  for (int i = skipped; i < task->frame_count; i++) {
+    // a caller's ip is past its call, the call's line is the one before it
+    CallFrame *frame = &task->frames[i];
+    *frames++ = (ProfileFrame){frame->chunk, frame_line(frame->chunk,
+                                                        frame->ip - 1)};
+  }
+  *frames = (ProfileFrame){task->chunk, frame_line(task->chunk, task->ip)};
+
+  uint64_t hash = hash_stack(stack, depth, truncated);
+  if (2 * (profile->sample_count + 1) > profile->bucket_capacity)
+    grow_buckets(profile);
+  size_t *bucket = find_bucket(profile, stack, depth, truncated, hash);
+  if (*bucket != 0) {
+    profile->samples[*bucket - 1].weight += weight;
+    pthread_mutex_unlock(&profile->lock);
+    return;
+  }
+
+  if (profile->sample_count == profile->sample_capacity) {
+    profile->samples =
+        (ProfileSample *)grow_array(profile->samples, &profile->sample_capacity,
+                                    sizeof(ProfileSample));
+  }
+  profile->samples[profile->sample_count] =
+      (ProfileSample){profile->frame_count, depth, weight, hash, truncated};
+  *bucket = ++profile->sample_count;
+  profile->frame_count += depth;
+  pthread_mutex_unlock(&profile->lock);
+}
+
+// by chunk name, then line. Functions defined twice under one name keep
+// apart
+static int compare_frames(const ProfileFrame *left, const ProfileFrame *right) {
+  if (left->chunk != right->chunk) {
+    int order = strcmp(chunk_name(left->chunk), chunk_name(right->chunk));
+    if (order != 0)
+      return order;
+    return left->chunk < right->chunk ? -1 : 1;
+  }
+  return left->line - right->line;
+}
+
+// for sorting samples by their stacks
+static Profile *sorted_profile;
+
+static int compare_samples(const void *a, const void *b) {
+  const ProfileSample *left = (const ProfileSample *)a;
+  const ProfileSample *right = (const ProfileSample *)b;
+  if (left->truncated != right->truncated)
+    return left->truncated ? 1 : -1;
+  ProfileFrame *frames = sorted_profile->frames;
+  for (int i = 0; i < left->depth && i < right->depth; i++) {
+    int order =
+        compare_frames(&frames[left->first + i], &frames[right->first + i]);
+    if (order != 0)
+      return order;
+  }
+  return left->depth - right->depth;
+}
+
+bool write_folded_stacks(Profile *profile, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return false;
+
+  // sorted as a copy, the buckets point into profile->samples
+  ProfileSample *samples =
+      (ProfileSample *)malloc((profile->sample_count + 1) *
+                              sizeof(ProfileSample));
+  if (samples == NULL) {
+    printf("ran out of memory when sorting a profile\n");
+    exit(1);
+  }
+  memcpy(samples, profile->samples,
+         profile->sample_count * sizeof(ProfileSample));
+  sorted_profile = profile;
+  qsort(samples, profile->sample_count, sizeof(ProfileSample),
+        compare_samples);
+  for (size_t i = 0; i < profile->sample_count; i++) {
+    ProfileSample *sample = &samples[i];
+    if (sample->truncated)
+      fprintf(file, "[truncated];");
+    for (int j = 0; j < sample->depth; j++) {
+      ProfileFrame *frame = &profile->frames[sample->first + j];
+      fprintf(file, "%s%s:%d", j > 0 ? ";" : "", chunk_name(frame->chunk),
+              frame->line);
+    }
+    fprintf(file, " %ld\n", sample->weight);
+  }
+  free(samples);
+  return fclose(file) == 0;
+}
+
+// the time spent on one line: self in its own instructions, total also in
+// the functions it called. A line counts once per sample however often it
+// is on the stack
+typedef struct {
+  Chunk *chunk;
+  int line;
+  long self;
+  long total;
+} LineRow;
+
+// a frame of one sample, for collecting LineRows
+typedef struct {
+  ProfileFrame frame;
+  size_t sample;
+  long weight;
+  bool leaf;
+} LineHit;
+
+static int compare_hits(const void *a, const void *b) {
+  const LineHit *left = (const LineHit *)a;
+  const LineHit *right = (const LineHit *)b;
+  int order = compare_frames(&left->frame, &right->frame);
+  if (order != 0)
+    return order;
+  if (left->sample != right->sample)
+    return left->sample < right->sample ? -1 : 1;
+  return 0;
+}
+
+static int compare_lines(const void *a, const void *b) {
+  const LineRow *left = (const LineRow *)a;
+  const LineRow *right = (const LineRow *)b;
+  if (left->self != right->self)
+    return left->self < right->self ? 1 : -1;
+  if (left->total != right->total)
+    return left->total < right->total ? 1 : -1;
+  return compare_frames(&(ProfileFrame){left->chunk, left->line},
+                        &(ProfileFrame){right->chunk, right->line});
+}
+
+static size_t line_rows(Profile *profile, LineRow **rows) {
+  LineHit *hits = (LineHit *)malloc((profile->frame_count + 1) *
+                                    sizeof(LineHit));
+  *rows = (LineRow *)malloc((profile->frame_count + 1) * sizeof(LineRow));
+  if (hits == NULL || *rows == NULL) {
+    printf("ran out of memory when sorting a profile\n");
+    exit(1);
+  }
+  size_t hit_count = 0;
+  for (size_t i = 0; i < profile->sample_count; i++) {
+    ProfileSample *sample = &profile->samples[i];
+    for (int j = 0; j < sample->depth; j++) {
+      hits[hit_count++] = (LineHit){profile->frames[sample->first + j], i,
+                                    sample->weight, j == sample->depth - 1};
+    }
+  }
+  qsort(hits, hit_count, sizeof(LineHit), compare_hits);
+
+  size_t count = 0;
+  for (size_t i = 0; i < hit_count; i++) {
+    LineHit *hit = &hits[i];
+    bool new_line = i == 0 || compare_frames(&hit->frame, &hits[i - 1].frame);
+    if (new_line)
+      (*rows)[count++] = (LineRow){hit->frame.chunk, hit->frame.line, 0, 0};
+    LineRow *row = &(*rows)[count - 1];
+    if (new_line || hit->sample != hits[i - 1].sample)
+      row->total += hit->weight;
+    if (hit->leaf)
+      row->self += hit->weight;
+  }
+  free(hits);
+  qsort(*rows, count, sizeof(LineRow), compare_lines);
+  return count;
+}
+
+// prints line number line of source, without its indentation
+static void quote_line(const char *source, int line, FILE *file) {
+  for (int i = 1; i < line && source != NULL; i++) {
+    source = strchr(source, '\n');
+    if (source != NULL)
+      source++;
+  }
+  if (source == NULL || line < 1)
+    return;
+  source += strspn(source, " \t");
+  int length = (int)strcspn(source, "\r\n");
+  fprintf(file, "  %.*s%s", length < QUOTE_WIDTH ? length : QUOTE_WIDTH,
+          source, length > QUOTE_WIDTH ? "..." : "");
+}
+
+static double percent(long count, long total) {
+  return total > 0 ? 100.0 * count / total : 0;
+}
+
+void print_profile(Profile *profile, const char *source, FILE *file) {
+  long total = 0;
+  for (size_t i = 0; i < profile->sample_count; i++)
+    total += profile->samples[i].weight;
+  fprintf(file, "%ld samples in %.2f s of cpu time, %d Hz asked for\n",
+          total, profile->cpu_seconds, profile->rate);
+
+  LineRow *rows;
+  size_t count = line_rows(profile, &rows);
+  fprintf(file, "\n%8s %7s %8s %7s  line\n", "self", "%", "total", "%");
+  for (size_t i = 0; i < count && i < TOP_LINES; i++) {
+    LineRow *row = &rows[i];
+    fprintf(file, "%8ld %6.2f%% %8ld %6.2f%%  %s:%d", row->self,
+            percent(row->self, total), row->total, percent(row->total, total),
+            chunk_name(row->chunk), row->line);
+    quote_line(source, row->line, file);
+    fprintf(file, "\n");
+  }
+  free(rows);
+}
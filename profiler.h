@@ -0,0 +1,82 @@
+#pragma once
+#include "chunk.h"
+#include "vm.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// samples a rate given with --profile-rate falls back to
+#define DEFAULT_PROFILE_RATE 1000
+// frames kept of a deeper stack, the innermost ones
+#define PROFILE_MAX_DEPTH 256
+
+// one level of a sampled stack: a chunk and the line running in it, the call
+// for the frames a function was called from
+typedef struct {
+  Chunk *chunk;
+  int line;
+} ProfileFrame;
+
+// a stack seen by one or more SIGPROF ticks, its frames outermost first.
+// Each distinct stack is kept once, the ticks that saw it add to its weight
+typedef struct {
+  size_t first;
+  int depth;
+  long weight;
+  uint64_t hash;
+  // the outer frames of a stack deeper than PROFILE_MAX_DEPTH were dropped
+  bool truncated;
+} ProfileSample;
+
+// A sampling profile of the cpu time spent running bytecode. While the timer
+// is started, every SIGPROF tick marks the thread it lands on and the run loop
+// of that thread records its task's stack before its next instruction, so the
+// signal handler never touches the vm. Set as vm->profile; isolates may share
+// one, samples are added under the lock
+struct Profile {
+  // samples asked for per second of cpu time. The kernel checks the timer
+  // on its scheduler tick, which caps the rate at CONFIG_HZ (often 250)
+  int rate;
+  // cpu time of the process between start_profile and stop_profile
+  clock_t started;
+  double cpu_seconds;
+  ProfileFrame *frames;
+  size_t frame_count;
+  size_t frame_capacity;
+  ProfileSample *samples;
+  size_t sample_count;
+  size_t sample_capacity;
+  // open addressing from a stack's hash to 1 + its index in samples, 0 for
+  // an empty bucket. Never more than half full
+  size_t *buckets;
+  size_t bucket_capacity;
+  pthread_mutex_t lock;
+};
+
+// SIGPROF ticks this thread got since its run loop last took a sample
+extern __thread volatile sig_atomic_t profile_ticks;
+
+Profile *create_profile(int rate);
+void free_profile(Profile *profile);
+// arms the process' cpu time timer, false when it could not be
+bool start_profile(Profile *profile);
+void stop_profile(Profile *profile);
+void record_sample(Profile *profile, Task *task, int weight);
+
+// takes a sample of task when a tick arrived since the last one
+static inline void check_profile(VM *vm, Task *task) {
+  if (profile_ticks == 0)
+    return;
+  int weight = __atomic_exchange_n(&profile_ticks, 0, __ATOMIC_RELAXED);
+  record_sample(vm->profile, task, weight);
+}
+
+// the lines with the most samples, as self and total time. source is the
+// program, its lines are quoted when given
+void print_profile(Profile *profile, const char *source, FILE *file);
+// the samples as folded stacks for flamegraph.pl, false when path can not be
+// written
+bool write_folded_stacks(Profile *profile, const char *path);
@@ -0,0 +1,369 @@
+#include "scheduler.h"
+#include "event_loop.h"
+#include "parallel.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define INITIAL_DEQUE_CAPACITY 64
+// a worker checks the shared queue before its own deque every this many
+// tasks, so yielded tasks keep moving while a deque is never empty
+#define SHARED_QUEUE_INTERVAL 61
+// passes over the other workers before an idle worker goes to sleep
+#define STEAL_ROUNDS 4
+
+// the worker running on this thread, NULL on threads outside any pool
+static __thread Worker *current_worker = NULL;
+
+static TaskBuffer *create_buffer(int64_t capacity) {
+  TaskBuffer *buffer = (TaskBuffer *)malloc(sizeof(TaskBuffer));
+  if (buffer != NULL) {
+    buffer->tasks = (_Atomic(Task *) *)calloc(capacity, sizeof(Task *));
+  }
+  if (buffer == NULL || buffer->tasks == NULL) {
+    printf("ran out of memory when growing a task deque\n");
+    exit(1);
+  }
+  buffer->capacity = capacity;
+  buffer->retired = NULL;
+  return buffer;
+}
+
+static void init_deque(TaskDeque *deque) {
+  atomic_init(&deque->top, 0);
+  atomic_init(&deque->bottom, 0);
+  atomic_init(&deque->buffer, create_buffer(INITIAL_DEQUE_CAPACITY));
+}
+
+static void free_deque(TaskDeque *deque) {
+  TaskBuffer *buffer = atomic_load(&deque->buffer);
+  while (buffer != NULL) {
+    TaskBuffer *retired = buffer->retired;
+    free(buffer->tasks);
+    free(buffer);
+    buffer = retired;
+  }
+}
+
+static TaskBuffer *grow_buffer(TaskBuffer *buffer, int64_t top,
+                               int64_t bottom) {
+  TaskBuffer *grown = create_buffer(buffer->capacity * 2);
+  for (int64_t i = top; i < bottom; i++) {
+    Task *task = atomic_load_explicit(
+        &buffer->tasks[i & (buffer->capacity - 1)], memory_order_relaxed);
+    atomic_store_explicit(&grown->tasks[i & (grown->capacity - 1)], task,
+                          memory_order_relaxed);
+  }
+  grown->retired = buffer;
+  return grown;
+}
+
+// owner only
+static void deque_push(TaskDeque *deque, Task *task) {
+  int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  TaskBuffer *buffer =
+      atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+  if (bottom - top > buffer->capacity - 1) {
+    buffer = grow_buffer(buffer, top, bottom);
+    atomic_store_explicit(&deque->buffer, buffer, memory_order_release);
+  }
+  atomic_store_explicit(&buffer->tasks[bottom & (buffer->capacity - 1)], task,
+                        memory_order_release);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+// owner only, takes the most recently pushed task
+static Task *deque_pop(TaskDeque *deque) {
+  int64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  TaskBuffer *buffer =
+      atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return NULL;
+  }
+  Task *task = atomic_load_explicit(
+      &buffer->tasks[bottom & (buffer->capacity - 1)], memory_order_relaxed);
+  if (top == bottom) {
+    // the last task, a thief may be taking it at the same time
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      task = NULL;
+    }
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+// any thread, takes the oldest task. NULL when empty or when another thief
+// won the race
+static Task *deque_steal(TaskDeque *deque) {
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom)
+    return NULL;
+
+  TaskBuffer *buffer =
+      atomic_load_explicit(&deque->buffer, memory_order_acquire);
+  Task *task = atomic_load_explicit(
+      &buffer->tasks[top & (buffer->capacity - 1)], memory_order_acquire);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return NULL;
+  }
+  return task;
+}
+
+static bool deque_is_empty(TaskDeque *deque) {
+  return atomic_load(&deque->bottom) <= atomic_load(&deque->top);
+}
+
+static void enqueue_shared(Scheduler *scheduler, Task *task) {
+  task->next = NULL;
+  pthread_mutex_lock(&scheduler->queue_lock);
+  if (scheduler->queue_tail == NULL) {
+    scheduler->queue_head = task;
+  } else {
+    scheduler->queue_tail->next = task;
+  }
+  scheduler->queue_tail = task;
+  atomic_fetch_add(&scheduler->queue_length, 1);
+  pthread_mutex_unlock(&scheduler->queue_lock);
+}
+
+static Task *dequeue_shared(Scheduler *scheduler) {
+  if (atomic_load(&scheduler->queue_length) == 0)
+    return NULL;
+
+  pthread_mutex_lock(&scheduler->queue_lock);
+  Task *task = scheduler->queue_head;
+  if (task != NULL) {
+    scheduler->queue_head = task->next;
+    if (scheduler->queue_head == NULL)
+      scheduler->queue_tail = NULL;
+    atomic_fetch_sub(&scheduler->queue_length, 1);
+  }
+  pthread_mutex_unlock(&scheduler->queue_lock);
+  return task;
+}
+
+static bool has_work(Scheduler *scheduler) {
+  if (atomic_load(&scheduler->queue_length) > 0)
+    return true;
+  for (size_t i = 0; i < scheduler->worker_count; i++) {
+    if (!deque_is_empty(&scheduler->workers[i].deque))
+      return true;
+  }
+  return false;
+}
+
+static void wake_worker(Scheduler *scheduler) {
+  // pairs with the sleeping increment in sleep_until_work: either the sleeper
+  // sees the new task or we see the sleeper
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&scheduler->sleeping) == 0)
+    return;
+  pthread_mutex_lock(&scheduler->idle_lock);
+  pthread_cond_signal(&scheduler->wake);
+  pthread_mutex_unlock(&scheduler->idle_lock);
+}
+
+static void sleep_until_work(Scheduler *scheduler) {
+  pthread_mutex_lock(&scheduler->idle_lock);
+  atomic_fetch_add(&scheduler->sleeping, 1);
+  if (!has_work(scheduler) && !atomic_load(&scheduler->stopping)) {
+    pthread_cond_wait(&scheduler->wake, &scheduler->idle_lock);
+  }
+  atomic_fetch_sub(&scheduler->sleeping, 1);
+  pthread_mutex_unlock(&scheduler->idle_lock);
+}
+
+static uint32_t next_random(Worker *worker) {
+  // xorshift32
+  uint32_t x = worker->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  worker->random_state = x;
+  return x;
+}
+
+static Task *steal_task(Worker *worker) {
+  Scheduler *scheduler = worker->scheduler;
+  size_t count = scheduler->worker_count;
+  for (int round = 0; round < STEAL_ROUNDS; round++) {
+    size_t start = next_random(worker) % count;
+    for (size_t i = 0; i < count; i++) {
+      Worker *victim = &scheduler->workers[(start + i) % count];
+      if (victim == worker)
+        continue;
+      Task *task = deque_steal(&victim->deque);
+      if (task != NULL)
+        return task;
+    }
+  }
+  return NULL;
+}
+
+static Task *find_task(Worker *worker) {
+  Scheduler *scheduler = worker->scheduler;
+  Task *task = NULL;
+  if (++worker->tick % SHARED_QUEUE_INTERVAL == 0)
+    task = dequeue_shared(scheduler);
+  if (task == NULL)
+    task = deque_pop(&worker->deque);
+  if (task == NULL)
+    task = dequeue_shared(scheduler);
+  if (task == NULL)
+    task = steal_task(worker);
+  return task;
+}
+
+static void run_task(Scheduler *scheduler, Task *task) {
+  InterpretResponse response = run(scheduler->vm, task);
+  if (response == INTERPRET_YIELD) {
+    // to the back of the line, the worker's own deque is LIFO and would hand
+    // the same task straight back
+    enqueue_shared(scheduler, task);
+    return;
+  }
+  if (response == INTERPRET_SUSPENDED) {
+    // submitted only now that the worker is done with the task, the loop may
+    // hand it to another worker as soon as the operation completes
+    Task *running = task->active != NULL ? task->active : task;
+    submit_io(get_event_loop(scheduler->vm), running->io, task);
+    return;
+  }
+
+  if (response != INTERPRET_OK) {
+    __atomic_store_n(&scheduler->vm->had_task_error, true, __ATOMIC_RELAXED);
+  }
+  if (task->loop != NULL) {
+    finish_parallel_chunk(task, response == INTERPRET_OK);
+  }
+  free_task(task);
+  if (atomic_fetch_sub(&scheduler->live_tasks, 1) == 1) {
+    pthread_mutex_lock(&scheduler->idle_lock);
+    pthread_cond_broadcast(&scheduler->done);
+    pthread_mutex_unlock(&scheduler->idle_lock);
+  }
+}
+
+static void *run_worker(void *argument) {
+  Worker *worker = (Worker *)argument;
+  Scheduler *scheduler = worker->scheduler;
+  current_worker = worker;
+  for (;;) {
+    Task *task = find_task(worker);
+    if (task != NULL) {
+      run_task(scheduler, task);
+      continue;
+    }
+    if (atomic_load(&scheduler->stopping))
+      break;
+    sleep_until_work(scheduler);
+  }
+  current_worker = NULL;
+  return NULL;
+}
+
+// starts worker_count threads (one per online core when 0)
+Scheduler *create_scheduler(VM *vm, size_t worker_count) {
+  if (worker_count == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = cores > 0 ? (size_t)cores : 1;
+  }
+
+  Scheduler *scheduler = (Scheduler *)malloc(sizeof(Scheduler));
+  Worker *workers = (Worker *)malloc(worker_count * sizeof(Worker));
+  if (scheduler == NULL || workers == NULL) {
+    printf("ran out of memory when starting the scheduler\n");
+    exit(1);
+  }
+  scheduler->vm = vm;
+  scheduler->workers = workers;
+  scheduler->worker_count = worker_count;
+  pthread_mutex_init(&scheduler->queue_lock, NULL);
+  scheduler->queue_head = NULL;
+  scheduler->queue_tail = NULL;
+  atomic_init(&scheduler->queue_length, 0);
+  pthread_mutex_init(&scheduler->idle_lock, NULL);
+  pthread_cond_init(&scheduler->wake, NULL);
+  atomic_init(&scheduler->sleeping, 0);
+  atomic_init(&scheduler->stopping, false);
+  atomic_init(&scheduler->live_tasks, 0);
+  pthread_cond_init(&scheduler->done, NULL);
+
+  for (size_t i = 0; i < worker_count; i++) {
+    Worker *worker = &workers[i];
+    worker->scheduler = scheduler;
+    worker->index = i;
+    worker->random_state = (uint32_t)(i * 2654435761u + 1);
+    worker->tick = 0;
+    init_deque(&worker->deque);
+  }
+  for (size_t i = 0; i < worker_count; i++) {
+    if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) !=
+        0) {
+      printf("failed to start scheduler worker %zu\n", i);
+      exit(1);
+    }
+  }
+  return scheduler;
+}
+
+// called from a worker the task goes on that worker's deque, from any other
+// thread it goes on the shared queue
+void schedule_task(Scheduler *scheduler, Task *task) {
+  atomic_fetch_add(&scheduler->live_tasks, 1);
+  Worker *worker = current_worker;
+  if (worker != NULL && worker->scheduler == scheduler) {
+    deque_push(&worker->deque, task);
+  } else {
+    enqueue_shared(scheduler, task);
+  }
+  wake_worker(scheduler);
+}
+
+// puts a task parked on I/O back in line, it never stopped counting as live
+void resume_task(Scheduler *scheduler, Task *task) {
+  enqueue_shared(scheduler, task);
+  wake_worker(scheduler);
+}
+
+// blocks until every scheduled task has finished, including ones they spawn
+void wait_for_tasks(Scheduler *scheduler) {
+  pthread_mutex_lock(&scheduler->idle_lock);
+  while (atomic_load(&scheduler->live_tasks) > 0) {
+    pthread_cond_wait(&scheduler->done, &scheduler->idle_lock);
+  }
+  pthread_mutex_unlock(&scheduler->idle_lock);
+}
+
+void free_scheduler(Scheduler *scheduler) {
+  atomic_store(&scheduler->stopping, true);
+  pthread_mutex_lock(&scheduler->idle_lock);
+  pthread_cond_broadcast(&scheduler->wake);
+  pthread_mutex_unlock(&scheduler->idle_lock);
+  for (size_t i = 0; i < scheduler->worker_count; i++) {
+    pthread_join(scheduler->workers[i].thread, NULL);
+    free_deque(&scheduler->workers[i].deque);
+  }
+
+  pthread_mutex_destroy(&scheduler->queue_lock);
+  pthread_mutex_destroy(&scheduler->idle_lock);
+  pthread_cond_destroy(&scheduler->wake);
+  pthread_cond_destroy(&scheduler->done);
+  free(scheduler->workers);
+  free(scheduler);
+}
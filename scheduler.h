@@ -0,0 +1,63 @@
+#pragma once
+#include "vm.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Runs spawned tasks on a pool of worker threads. Each worker owns a
+// Chase-Lev deque: it pushes and pops tasks it spawned at the bottom while
+// idle workers steal from the top of a random victim. Tasks that yield, and
+// tasks spawned from outside the pool, go through a shared FIFO queue so a
+// long running task cannot starve the others.
+typedef struct TaskBuffer TaskBuffer;
+
+struct TaskBuffer {
+  int64_t capacity;
+  _Atomic(Task *) *tasks;
+  // buffers replaced by a grow are kept until the deque is freed, a thief may
+  // still be reading one
+  TaskBuffer *retired;
+};
+
+typedef struct {
+  atomic_int_fast64_t top;
+  atomic_int_fast64_t bottom;
+  _Atomic(TaskBuffer *) buffer;
+} TaskDeque;
+
+typedef struct {
+  Scheduler *scheduler;
+  size_t index;
+  pthread_t thread;
+  TaskDeque deque;
+  uint32_t random_state;
+  uint32_t tick;
+} Worker;
+
+struct Scheduler {
+  VM *vm;
+  Worker *workers;
+  size_t worker_count;
+
+  pthread_mutex_t queue_lock;
+  Task *queue_head;
+  Task *queue_tail;
+  atomic_size_t queue_length;
+
+  // idle workers sleep on wake, the counter lets producers skip the signal
+  pthread_mutex_t idle_lock;
+  pthread_cond_t wake;
+  atomic_size_t sleeping;
+  atomic_bool stopping;
+
+  // spawned tasks that have not finished yet, wait_for_tasks sleeps on done
+  atomic_size_t live_tasks;
+  pthread_cond_t done;
+};
+
+Scheduler *create_scheduler(VM *vm, size_t worker_count);
+void schedule_task(Scheduler *scheduler, Task *task);
+void resume_task(Scheduler *scheduler, Task *task);
+void wait_for_tasks(Scheduler *scheduler);
+void free_scheduler(Scheduler *scheduler);
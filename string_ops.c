@@ -0,0 +1,198 @@
+#include "string_ops.h"
+#include "cpu.h"
+#include "hash_map.h"
+#include "object.h"
+#include "vm.h"
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+// cleared by use_string_simd(false)
+static int simd_enabled = 1;
+
+void use_string_simd(bool enabled) {
+  __atomic_store_n(&simd_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+static bool has_avx2(void) {
+  return __atomic_load_n(&simd_enabled, __ATOMIC_RELAXED) && cpu_has_avx2();
+}
+
+// compares the first and last byte of the needle against 32 positions at
+// once and only checks the bytes in between where both match, which rules
+// out almost every position in text like logs. needle_length >= 2
+__attribute__((target("avx2"))) static long
+find_avx2(const char *haystack, size_t length, const char *needle,
+          size_t needle_length, size_t from) {
+  __m256i first = _mm256_set1_epi8(needle[0]);
+  __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+  size_t i = from;
+  for (; i + needle_length - 1 + 32 <= length; i += 32) {
+    __m256i starts = _mm256_loadu_si256((const __m256i *)(haystack + i));
+    __m256i ends = _mm256_loadu_si256(
+        (const __m256i *)(haystack + i + needle_length - 1));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(starts, first),
+                         _mm256_cmpeq_epi8(ends, last)));
+    while (mask) {
+      size_t candidate = i + __builtin_ctz(mask);
+      if (memcmp(haystack + candidate + 1, needle + 1, needle_length - 2) == 0)
+        return (long)candidate;
+      mask &= mask - 1;
+    }
+  }
+  for (; i + needle_length <= length; i++) {
+    if (haystack[i] == needle[0] &&
+        memcmp(haystack + i, needle, needle_length) == 0)
+      return (long)i;
+  }
+  return -1;
+}
+
+// memchr for the first byte, then compare the rest
+static long find_scalar(const char *haystack, size_t length,
+                        const char *needle, size_t needle_length,
+                        size_t from) {
+  size_t i = from;
+  while (i + needle_length <= length) {
+    const char *match = (const char *)memchr(haystack + i, needle[0],
+                                             length - needle_length + 1 - i);
+    if (match == NULL)
+      return -1;
+    i = (size_t)(match - haystack);
+    if (memcmp(match, needle, needle_length) == 0)
+      return (long)i;
+    i++;
+  }
+  return -1;
+}
+
+long find_bytes(const char *haystack, size_t length, const char *needle,
+                size_t needle_length, size_t from) {
+  if (needle_length == 0)
+    return from <= length ? (long)from : -1;
+  if (from > length || needle_length > length - from)
+    return -1;
+  if (needle_length == 1) {
+    const char *match =
+        (const char *)memchr(haystack + from, needle[0], length - from);
+    return match == NULL ? -1 : (long)(match - haystack);
+  }
+  if (has_avx2())
+    return find_avx2(haystack, length, needle, needle_length, from);
+  return find_scalar(haystack, length, needle, needle_length, from);
+}
+
+// the flat string behind a string argument
+static bool string_argument(VM *vm, Task *task, Value value,
+                            const char *message, ObjString **string) {
+  if (!is_string_value(value)) {
+    log_vm_error(vm, task, message);
+    return false;
+  }
+  *string = flatten_string(vm, value);
+  return true;
+}
+
+// a view of part of string, pointing at the memory string itself points at
+static ObjString *substring_view(VM *vm, ObjString *string, size_t start,
+                                 size_t length) {
+  Obj *owner = string->owner != NULL ? string->owner : (Obj *)string;
+  return new_string_view(vm, owner, string->chars + start, length);
+}
+
+// find(string, needle) is the offset of the first needle, -1 when missing
+NativeResult find_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result) {
+  ObjString *string, *needle;
+  if (!string_argument(vm, task, args[0], "find expects strings\n", &string) ||
+      !string_argument(vm, task, args[1], "find expects strings\n", &needle))
+    return NATIVE_ERROR;
+  *result = INT_VAL((int64_t)find_bytes(string->chars, string->length,
+                                        needle->chars, needle->length, 0));
+  return NATIVE_OK;
+}
+
+// split(string, separator) is a dictionary from 0, 1, ... to the pieces
+// between separators. The pieces are views into string
+NativeResult split_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result) {
+  ObjString *string, *separator;
+  if (!string_argument(vm, task, args[0], "split expects strings\n",
+                       &string) ||
+      !string_argument(vm, task, args[1], "split expects strings\n",
+                       &separator))
+    return NATIVE_ERROR;
+  if (separator->length == 0) {
+    log_vm_error(vm, task, "split separator can not be empty\n");
+    return NATIVE_ERROR;
+  }
+
+  ObjDict *pieces = new_dict(vm);
+  size_t start = 0;
+  int64_t count = 0;
+  for (;;) {
+    long match = find_bytes(string->chars, string->length, separator->chars,
+                            separator->length, start);
+    size_t end = match < 0 ? (size_t)string->length : (size_t)match;
+    ObjString *piece = substring_view(vm, string, start, end - start);
+    insert_value_entry(&pieces->table, INT_VAL(count++), OBJ_VAL(piece));
+    if (match < 0)
+      break;
+    start = end + separator->length;
+  }
+  *result = OBJ_VAL(pieces);
+  return NATIVE_OK;
+}
+
+NativeResult starts_with_native(VM *vm, Task *task, int arg_count,
+                                Value *args, Value *result) {
+  ObjString *string, *prefix;
+  if (!string_argument(vm, task, args[0], "starts_with expects strings\n",
+                       &string) ||
+      !string_argument(vm, task, args[1], "starts_with expects strings\n",
+                       &prefix))
+    return NATIVE_ERROR;
+  *result = BOOL_VAL(prefix->length <= string->length &&
+                     memcmp(string->chars, prefix->chars, prefix->length) == 0);
+  return NATIVE_OK;
+}
+
+NativeResult ends_with_native(VM *vm, Task *task, int arg_count, Value *args,
+                              Value *result) {
+  ObjString *string, *suffix;
+  if (!string_argument(vm, task, args[0], "ends_with expects strings\n",
+                       &string) ||
+      !string_argument(vm, task, args[1], "ends_with expects strings\n",
+                       &suffix))
+    return NATIVE_ERROR;
+  *result = BOOL_VAL(suffix->length <= string->length &&
+                     memcmp(string->chars + string->length - suffix->length,
+                            suffix->chars, suffix->length) == 0);
+  return NATIVE_OK;
+}
+
+static bool is_offset(Value value, size_t limit) {
+  return IS_NUMERIC(value) && AS_DOUBLE(value) >= 0 &&
+         AS_DOUBLE(value) <= (double)limit &&
+         AS_DOUBLE(value) == floor(AS_DOUBLE(value));
+}
+
+// substring(string, start, end) is a view of the bytes from start up to end
+NativeResult substring_native(VM *vm, Task *task, int arg_count, Value *args,
+                              Value *result) {
+  ObjString *string;
+  if (!string_argument(vm, task, args[0], "substring expects a string\n",
+                       &string))
+    return NATIVE_ERROR;
+  if (!is_offset(args[1], string->length) ||
+      !is_offset(args[2], string->length) ||
+      AS_DOUBLE(args[1]) > AS_DOUBLE(args[2])) {
+    log_vm_error(vm, task, "substring range out of bounds\n");
+    return NATIVE_ERROR;
+  }
+  size_t start = (size_t)AS_DOUBLE(args[1]);
+  size_t end = (size_t)AS_DOUBLE(args[2]);
+  *result = OBJ_VAL(substring_view(vm, string, start, end - start));
+  return NATIVE_OK;
+}
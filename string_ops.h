@@ -0,0 +1,24 @@
+#pragma once
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// searches use AVX2 when the cpu has it, false forces the scalar fallback
+// (for benchmarks)
+void use_string_simd(bool enabled);
+// offset of the first needle in haystack at or after from, -1 when missing
+long find_bytes(const char *haystack, size_t length, const char *needle,
+                size_t needle_length, size_t from);
+
+NativeResult find_native(VM *vm, Task *task, int arg_count, Value *args,
+                         Value *result);
+NativeResult split_native(VM *vm, Task *task, int arg_count, Value *args,
+                          Value *result);
+NativeResult starts_with_native(VM *vm, Task *task, int arg_count,
+                                Value *args, Value *result);
+NativeResult ends_with_native(VM *vm, Task *task, int arg_count, Value *args,
+                              Value *result);
+NativeResult substring_native(VM *vm, Task *task, int arg_count, Value *args,
+                              Value *result);
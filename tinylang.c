@@ -0,0 +1,150 @@
+#include "tinylang.h"
+#include "arena.h"
+#include "chunk.h"
+#include "hash_map.h"
+#include "lexer.h"
+#include "native.h"
+#include "object.h"
+#include "parser.h"
+#include "value.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(TlValue) == sizeof(Value), "TlValue must match Value");
+_Static_assert(offsetof(TlValue, as) == offsetof(Value, as),
+               "TlValue must match Value");
+_Static_assert(TL_BOOL == (int)VAL_BOOL && TL_NIL == (int)VAL_NIL &&
+                   TL_NUMBER == (int)VAL_NUMBER && TL_OBJECT == (int)VAL_OBJ &&
+                   TL_INT == (int)VAL_INT,
+               "TlType must match ValueType");
+
+struct TlProgram {
+  // owns the strings table the frozen chunk's constants were interned in
+  VM compiler;
+  Chunk chunk;
+};
+
+struct TlVm {
+  // first, natives get a VM * and cast it back
+  VM vm;
+  TlProgram *program;
+};
+
+static void *allocate(size_t size) {
+  void *memory = malloc(size);
+  if (memory == NULL) {
+    printf("ran out of memory in the embedding api\n");
+    exit(1);
+  }
+  return memory;
+}
+
+TlProgram *tl_compile(const char *source) {
+  TlProgram *program = (TlProgram *)allocate(sizeof(TlProgram));
+  init_vm(&program->compiler);
+  init_chunk(&program->chunk);
+
+  Arena arena;
+  init_arena(&arena);
+  char *copy = arena_copy_string(&arena, source, strlen(source));
+  TokenList token_list = scan_tokens(&arena, copy);
+  bool compiled =
+      compile(&program->compiler, &arena, &token_list, &program->chunk);
+  free_arena(&arena);
+  if (!compiled) {
+    tl_free_program(program);
+    return NULL;
+  }
+  freeze_chunk(&program->chunk, &program->compiler);
+  return program;
+}
+
+void tl_free_program(TlProgram *program) {
+  free_vm(&program->compiler);
+  free_chunk(&program->chunk);
+  free(program);
+}
+
+TlVm *tl_create_vm(TlProgram *program) {
+  TlVm *vm = (TlVm *)allocate(sizeof(TlVm));
+  init_vm(&vm->vm);
+  vm->program = program;
+  // before any global is defined from C, so the names resolve to the
+  // chunk's own strings
+  intern_chunk_strings(&vm->vm, &program->chunk);
+  // the builtins too, so a native defined under a builtin's name replaces it
+  // instead of being overwritten by the first run
+  define_natives(&vm->vm);
+  vm->vm.natives_defined = true;
+  return vm;
+}
+
+void tl_free_vm(TlVm *vm) {
+  free_vm(&vm->vm);
+  free(vm);
+}
+
+TlResult tl_run(TlVm *vm) {
+  return interpret(&vm->vm, &vm->program->chunk) == INTERPRET_OK
+             ? TL_OK
+             : TL_RUNTIME_ERROR;
+}
+
+// the native behind every function defined through the api, one indirect
+// call on top of a builtin's
+static NativeResult call_external(VM *vm, Task *task, int arg_count,
+                                  Value *args, Value *result) {
+  // the callee sits just below its arguments
+  ObjNative *native = AS_NATIVE(args[-1]);
+  TlNativeFn function = (TlNativeFn)native->external;
+  *result = NIL_VAL;
+  const char *error = function((TlVm *)vm, arg_count, (const TlValue *)args,
+                               (TlValue *)result, native->user_data);
+  if (error == NULL)
+    return NATIVE_OK;
+
+  char message[256];
+  snprintf(message, sizeof(message), "%s\n", error);
+  log_vm_error(vm, task, message);
+  return NATIVE_ERROR;
+}
+
+void tl_define_native(TlVm *vm, const char *name, TlNativeFn function,
+                      int arity, void *user_data) {
+  // the name is kept by the object, builtins use string literals
+  size_t length = strlen(name);
+  ObjString *key = copy_string(&vm->vm, name, length);
+  ObjNative *native = new_native(&vm->vm, key->chars, call_external, arity);
+  native->external = (void (*)(void))function;
+  native->user_data = user_data;
+  insert_entry(&vm->vm.globals, key, OBJ_VAL(native));
+}
+
+bool tl_get_global(TlVm *vm, const char *name, TlValue *value) {
+  ObjString *key = copy_string(&vm->vm, name, strlen(name));
+  return get_entry(&vm->vm.globals, key, (Value *)value);
+}
+
+void tl_set_global(TlVm *vm, const char *name, TlValue value) {
+  ObjString *key = copy_string(&vm->vm, name, strlen(name));
+  insert_entry(&vm->vm.globals, key, *(Value *)&value);
+}
+
+TlValue tl_string(TlVm *vm, const char *chars, size_t length) {
+  Value value = OBJ_VAL(copy_string(&vm->vm, chars, length));
+  return *(TlValue *)&value;
+}
+
+bool tl_is_string(TlValue value) {
+  return is_string_value(*(Value *)&value);
+}
+
+const char *tl_string_chars(TlVm *vm, TlValue value, size_t *length) {
+  ObjString *string = flatten_c_string(&vm->vm, *(Value *)&value);
+  if (length != NULL)
+    *length = string->length;
+  return string->chars;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The embedding API, the only header a program linking libtinylang needs. A
+// program is compiled once and run by any number of vms. Each vm has its own
+// globals and heap and keeps its globals from one run to the next.
+
+#if defined(__GNUC__)
+#define TL_API __attribute__((visibility("default")))
+#else
+#define TL_API
+#endif
+
+typedef struct TlProgram TlProgram;
+typedef struct TlVm TlVm;
+
+// laid out like the interpreter's own values, so natives get their arguments
+// as a pointer into the vm's stack. New types are only ever added at the end
+typedef enum {
+  TL_BOOL,
+  TL_NIL,
+  TL_NUMBER,
+  TL_OBJECT,
+  // integer literals and counts, TL_NUMBER is a double
+  TL_INT,
+} TlType;
+
+typedef struct {
+  TlType type;
+  union {
+    bool boolean;
+    double number;
+    void *object;
+    int64_t integer;
+  } as;
+} TlValue;
+
+static inline TlValue tl_nil(void) {
+  TlValue value = {TL_NIL, {.number = 0}};
+  return value;
+}
+
+static inline TlValue tl_bool(bool boolean) {
+  TlValue value = {TL_BOOL, {.boolean = boolean}};
+  return value;
+}
+
+static inline TlValue tl_number(double number) {
+  TlValue value = {TL_NUMBER, {.number = number}};
+  return value;
+}
+
+static inline TlValue tl_int(int64_t integer) {
+  TlValue value = {TL_INT, {.integer = integer}};
+  return value;
+}
+
+// true for both number types, tl_as_number widens an integer
+static inline bool tl_is_number(TlValue value) {
+  return value.type == TL_NUMBER || value.type == TL_INT;
+}
+
+static inline double tl_as_number(TlValue value) {
+  return value.type == TL_INT ? (double)value.as.integer : value.as.number;
+}
+
+typedef enum {
+  TL_OK,
+  TL_RUNTIME_ERROR,
+} TlResult;
+
+// a C function scripts can call. args points at the call's arguments on the
+// vm's stack and is only valid during the call. Returns NULL on success or
+// an error message, which stops the script. Natives are called from worker
+// threads when the script spawns tasks
+typedef const char *(*TlNativeFn)(TlVm *vm, int arg_count,
+                                  const TlValue *args, TlValue *result,
+                                  void *user_data);
+
+// NULL when the source does not compile, the errors are printed
+TL_API TlProgram *tl_compile(const char *source);
+// after every vm created for the program has been freed
+TL_API void tl_free_program(TlProgram *program);
+
+TL_API TlVm *tl_create_vm(TlProgram *program);
+TL_API void tl_free_vm(TlVm *vm);
+TL_API TlResult tl_run(TlVm *vm);
+
+// globals are read and written between runs, or from a native while the
+// script has no tasks running
+TL_API void tl_define_native(TlVm *vm, const char *name, TlNativeFn function,
+                             int arity, void *user_data);
+TL_API bool tl_get_global(TlVm *vm, const char *name, TlValue *value);
+TL_API void tl_set_global(TlVm *vm, const char *name, TlValue value);
+
+TL_API TlValue tl_string(TlVm *vm, const char *chars, size_t length);
+TL_API bool tl_is_string(TlValue value);
+// null terminated, valid as long as the vm. length is optional
+TL_API const char *tl_string_chars(TlVm *vm, TlValue value, size_t *length);
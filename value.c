@@ -1,10 +1,45 @@
 #include "value.h"
+#include "format_number.h"
 #include "memory.h"
 #include "object.h"
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+// number is not nan
+static int compare_integer_double(int64_t integer, double number) {
+  // the doubles outside [-2^63, 2^63) are beyond every integer
+  if (number >= 9223372036854775808.0)
+    return -1;
+  if (number < -9223372036854775808.0)
+    return 1;
+  // in range, so the whole part converts exactly and the fraction decides
+  // between the integer and its neighbours
+  int64_t whole = (int64_t)number;
+  if (integer != whole)
+    return integer < whole ? -1 : 1;
+  double fraction = number - (double)whole;
+  return fraction > 0 ? -1 : fraction < 0 ? 1 : 0;
+}
+
+int compare_numbers(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b))
+    return AS_INT(a) < AS_INT(b) ? -1 : AS_INT(a) > AS_INT(b);
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    return x < y ? -1 : x > y ? 1 : x == y ? 0 : UNORDERED;
+  }
+  if (IS_INT(a))
+    return isnan(AS_NUMBER(b)) ? UNORDERED
+                               : compare_integer_double(AS_INT(a),
+                                                        AS_NUMBER(b));
+  return isnan(AS_NUMBER(a)) ? UNORDERED
+                             : -compare_integer_double(AS_INT(b),
+                                                       AS_NUMBER(a));
+}
+
 void init_value_array(ValueArray *value_array) {
   value_array->capacity = 0;
   value_array->count = 0;
@@ -35,12 +70,72 @@ void free_value_array(ValueArray *value_array) {
   init_value_array(value_array);
 }
 
+// the text printed for objects other than strings, at most size - 1
+// characters
+int format_object(Value value, char *buffer, size_t size) {
+  int length = 0;
+  switch (OBJ_TYPE(value)) {
+  case OBJ_STRING:
+  case OBJ_ROPE:
+    length = snprintf(buffer, size, "<string>");
+    break;
+  case OBJ_COROUTINE:
+    length = snprintf(buffer, size, "<coroutine>");
+    break;
+  case OBJ_NATIVE:
+    length = snprintf(buffer, size, "<native %s>", AS_NATIVE(value)->name);
+    break;
+  case OBJ_CHANNEL:
+    length = snprintf(buffer, size, "<channel>");
+    break;
+  case OBJ_FILE:
+    length = snprintf(buffer, size, "<file %d>", AS_FILE(value)->fd);
+    break;
+  case OBJ_LINES:
+    length = snprintf(buffer, size, "<lines>");
+    break;
+  case OBJ_ARRAY:
+    length = snprintf(buffer, size, "<array %zu>", AS_ARRAY(value)->count);
+    break;
+  case OBJ_DICT:
+    length = snprintf(buffer, size, "<dict %zu>", AS_DICT(value)->table.count);
+    break;
+  case OBJ_BUILDER:
+    length = snprintf(buffer, size, "<builder %zu>", AS_BUILDER(value)->length);
+    break;
+  case OBJ_FUNCTION:
+    length =
+        snprintf(buffer, size, "<fun %s>", AS_FUNCTION(value)->name->chars);
+    break;
+  }
+  return length < (int)size ? length : (int)size - 1;
+}
+
 void print_object(Value value) {
   switch (OBJ_TYPE(value)) {
   case OBJ_STRING:
-    printf("%s", AS_CSTRING(value));
+    fwrite(AS_CSTRING(value), 1, AS_STRING(value)->length, stdout);
+    break;
+  case OBJ_ROPE:
+    print_rope(AS_ROPE(value));
+    break;
+  case OBJ_ARRAY: {
+    ObjArray *array = AS_ARRAY(value);
+    char text[FORMAT_NUMBER_SIZE];
+    putchar('[');
+    for (size_t i = 0; i < array->count; i++) {
+      format_number(array->values[i], text);
+      printf(i > 0 ? ", %s" : "%s", text);
+    }
+    putchar(']');
+    break;
+  }
+  default: {
+    char text[OBJECT_TEXT_SIZE];
+    fwrite(text, 1, format_object(value, text, sizeof(text)), stdout);
     break;
   }
+  }
 }
 
 void print_value(Value value) {
@@ -51,9 +146,18 @@ void print_value(Value value) {
   case VAL_BOOL:
     printf("%s", AS_BOOL(value) ? "true" : "false");
     break;
-  case VAL_NUMBER:
-    printf("%.01f", AS_NUMBER(value));
+  case VAL_NUMBER: {
+    char text[FORMAT_NUMBER_SIZE];
+    format_number(AS_NUMBER(value), text);
+    fputs(text, stdout);
     break;
+  }
+  case VAL_INT: {
+    char text[FORMAT_NUMBER_SIZE];
+    format_integer(AS_INT(value), text);
+    fputs(text, stdout);
+    break;
+  }
   case VAL_OBJ:
     print_object(value);
     break;
@@ -12,6 +12,9 @@ typedef enum {
   VAL_NIL,
   VAL_NUMBER,
   VAL_OBJ,
+  // integer literals and counts. Arithmetic on two integers stays exact and
+  // promotes to a double only when the result would overflow
+  VAL_INT,
 } ValueType;
 
 typedef struct {
@@ -20,6 +23,7 @@ typedef struct {
     bool boolean;
     double number;
     Obj *obj;
+    int64_t integer;
   } as;
 } Value;
 
@@ -27,15 +31,31 @@ typedef struct {
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj *)object}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = value}})
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
 #define AS_OBJ(value) ((value).as.obj)
+#define AS_INT(value) ((value).as.integer)
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
+#define IS_INT(value) ((value).type == VAL_INT)
+
+// either kind of number, AS_DOUBLE widens an integer
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
+#define AS_DOUBLE(value)                                                       \
+  (IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value))
+
+// what compare_numbers returns when either side is nan
+#define UNORDERED 2
+
+// -1, 0 or 1 as a is below, equal to or above b, for two numbers of either
+// kind. An integer and a double are compared exactly, without rounding the
+// integer to a double first
+int compare_numbers(Value a, Value b);
 
 typedef struct {
   size_t count;
@@ -48,3 +68,8 @@ void add_value(ValueArray *value_array, Value value);
 void free_value_array(ValueArray *value_array);
 void print_value_array(ValueArray *value_array);
 void print_value(Value value);
+
+// room for the text of any object that is not a string
+#define OBJECT_TEXT_SIZE 64
+
+int format_object(Value value, char *buffer, size_t size);
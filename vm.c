@@ -1,86 +1,207 @@
 #include "vm.h"
+#include "array.h"
+#include "builder.h"
 #include "chunk.h"
+#include "dict.h"
+#include "event_loop.h"
 #include "hash_map.h"
 #include "log_error.h"
+#include "native.h"
 #include "object.h"
+#include "opcode_stats.h"
+#include "profiler.h"
+#include "parallel.h"
+#include "scheduler.h"
 #include "stack.h"
 #include "value.h"
 #include <math.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 void init_vm(VM *vm) {
-  vm->ip = NULL;
   vm->chunk = NULL;
   vm->objects = NULL;
-  init_stack(&vm->stack);
+  vm->scheduler = NULL;
+  vm->worker_count = 0;
+  vm->task_yield_interval = DEFAULT_TASK_YIELD_INTERVAL;
+  vm->event_loop = NULL;
+  vm->io_backend = IO_BACKEND_URING;
+  init_output(&vm->output, STDOUT_FILENO,
+              isatty(STDOUT_FILENO) ? FLUSH_LINE : FLUSH_FULL);
+  vm->had_task_error = false;
+  vm->natives_defined = false;
+  vm->opcode_stats = NULL;
+  vm->profile = NULL;
+  pthread_mutex_init(&vm->heap_lock, NULL);
+  pthread_rwlock_init(&vm->globals_lock, NULL);
   init_hash_map(&vm->strings);
   init_hash_map(&vm->globals);
 }
 
-void free_object(Obj *objects) {
-  Obj *object = objects;
-  while (object != NULL) {
-    Obj *next = object->next;
-    free(object);
-    object = next;
-  }
-}
-
 void free_vm(VM *vm) {
-  free_stack(&vm->stack);
+  free_output(&vm->output);
+  pthread_mutex_destroy(&vm->heap_lock);
+  pthread_rwlock_destroy(&vm->globals_lock);
   free_hash_map(&vm->strings);
   free_hash_map(&vm->globals);
-  free_object(vm->objects);
+  free_objects(vm->objects);
+  vm->objects = NULL;
+}
+
+void init_task(Task *task, Chunk *chunk, uint8_t *ip, int budget) {
+  task->ip = ip;
+  task->chunk = chunk;
+  task->base = 0;
+  task->frames = NULL;
+  task->frame_count = 0;
+  task->frame_capacity = 0;
+  task->budget = budget;
+  task->next = NULL;
+  task->caller = NULL;
+  task->active = NULL;
+  task->joining = NULL;
+  task->loop = NULL;
+  task->chunk_index = 0;
+  task->io = NULL;
+  init_stack(&task->stack);
 }
 
-uint8_t read_byte(VM *vm) { return *(vm->ip++); }
+Task *create_task(Chunk *chunk, uint8_t *ip, int budget) {
+  Task *task = (Task *)malloc(sizeof(Task));
+  if (task == NULL) {
+    printf("ran out of memory when spawning a task\n");
+    exit(1);
+  }
+  init_task(task, chunk, ip, budget);
+  return task;
+}
 
-uint16_t read_short(VM *vm) {
-  vm->ip += 2;
-  return (uint16_t)((vm->ip[-2] << 8) | vm->ip[-1]);
+// releases what a task allocated while running, but not the task itself
+void free_task_stacks(Task *task) {
+  free_stack(&task->stack);
+  free(task->frames);
+  task->frames = NULL;
+  task->frame_count = 0;
+  task->frame_capacity = 0;
 }
 
-char *concatenate(Stack *stack) {
-  ObjString *b = AS_STRING(stack_pop(stack));
-  ObjString *a = AS_STRING(stack_pop(stack));
+void free_task(Task *task) {
+  free_task_stacks(task);
+  free(task);
+}
 
-  size_t length = a->length + b->length;
-  char *chars = malloc(length);
-  if (chars == NULL) {
-    printf("ran out of memory concatenating string\n");
+static void grow_frames(Task *task) {
+  int capacity = task->frame_capacity < 8 ? 8 : task->frame_capacity * 2;
+  CallFrame *frames =
+      (CallFrame *)realloc(task->frames, capacity * sizeof(CallFrame));
+  if (frames == NULL) {
+    printf("ran out of memory when growing the call frames\n");
     exit(1);
   }
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
-  return chars;
+  task->frames = frames;
+  task->frame_capacity = capacity;
 }
 
-bool binary_operation(Obj *objects, Stack *stack, OpCode op_code) {
+static inline uint8_t read_byte(Task *task) { return *(task->ip++); }
+
+static inline Value read_constant(Task *task) {
+  return task->chunk->constants.values[read_byte(task)];
+}
+
+static inline uint16_t read_short(Task *task) {
+  task->ip += 2;
+  return (uint16_t)((task->ip[-2] << 8) | task->ip[-1]);
+}
+
+// + - * and % on two integers, false when the result does not fit in 64
+// bits (or for % by zero) and the operation has to be done on doubles. /
+// always divides doubles, 7 / 2 is 3.5
+static inline bool integer_operation(Stack *stack, OpCode op_code) {
+  int64_t b = AS_INT(*stack_peek(stack, 0));
+  int64_t a = AS_INT(*stack_peek(stack, 1));
+  int64_t result;
+  switch (op_code) {
+  case OP_ADD:
+    if (__builtin_add_overflow(a, b, &result))
+      return false;
+    break;
+  case OP_SUBTRACT:
+    if (__builtin_sub_overflow(a, b, &result))
+      return false;
+    break;
+  case OP_MULTIPLY:
+    if (__builtin_mul_overflow(a, b, &result))
+      return false;
+    break;
+  case OP_MOD:
+    if (b == 0)
+      return false;
+    // INT64_MIN % -1 traps
+    result = b == -1 ? 0 : a % b;
+    break;
+  case OP_GREATER:
+    stack_pop(stack);
+    stack_pop(stack);
+    stack_push(stack, BOOL_VAL(a > b));
+    return true;
+  case OP_LESS:
+    stack_pop(stack);
+    stack_pop(stack);
+    stack_push(stack, BOOL_VAL(a < b));
+    return true;
+  default:
+    return false;
+  }
+  stack_pop(stack);
+  stack_pop(stack);
+  stack_push(stack, INT_VAL(result));
+  return true;
+}
+
+bool binary_operation(VM *vm, Stack *stack, OpCode op_code) {
 #define BINARY_OP(value_type, op)                                              \
   do {                                                                         \
-    double b = AS_NUMBER(stack_pop(stack));                                    \
-    double a = AS_NUMBER(stack_pop(stack));                                    \
-    stack_push(stack, value_type(a op b));                                     \
+    Value right = stack_pop(stack);                                            \
+    Value left = stack_pop(stack);                                             \
+    stack_push(stack, value_type(AS_DOUBLE(left) op AS_DOUBLE(right)));        \
   } while (false)
 
-  if ((!IS_NUMBER(*stack_peek(stack, 0)) ||
-       !IS_NUMBER(*stack_peek(stack, 1))) &&
-      (!IS_STRING(*stack_peek(stack, 0)) ||
-       !IS_STRING(*stack_peek(stack, 1)))) {
+  // mixing an integer with a double, or an integer result that would
+  // overflow, goes on as doubles below. Comparisons of an integer with a
+  // double are exact
+  if (IS_INT(*stack_peek(stack, 0)) && IS_INT(*stack_peek(stack, 1)) &&
+      integer_operation(stack, op_code))
+    return true;
+
+  if (IS_ARRAY(*stack_peek(stack, 0)) || IS_ARRAY(*stack_peek(stack, 1))) {
+    Value result;
+    if (!array_binary_operation(vm, op_code, *stack_peek(stack, 1),
+                                *stack_peek(stack, 0), &result))
+      return false;
+    stack_pop(stack);
+    stack_pop(stack);
+    stack_push(stack, result);
+    return true;
+  }
+
+  if ((!IS_NUMERIC(*stack_peek(stack, 0)) ||
+       !IS_NUMERIC(*stack_peek(stack, 1))) &&
+      (!is_string_value(*stack_peek(stack, 0)) ||
+       !is_string_value(*stack_peek(stack, 1)))) {
     return false;
   }
 
   switch (op_code) {
   case OP_ADD:
-    if (IS_STRING(*stack_peek(stack, 0)) && IS_STRING(*stack_peek(stack, 0))) {
-      char *chars = concatenate(stack);
-      ObjString *result = create_string(objects, chars);
-      stack_push(stack, OBJ_VAL(result));
+    if (is_string_value(*stack_peek(stack, 0))) {
+      Value b = stack_pop(stack);
+      Value a = stack_pop(stack);
+      stack_push(stack, concatenate_strings(vm, a, b));
     } else {
       BINARY_OP(NUMBER_VAL, +);
     }
@@ -95,25 +216,33 @@ bool binary_operation(Obj *objects, Stack *stack, OpCode op_code) {
     BINARY_OP(NUMBER_VAL, *);
     break;
   case OP_MOD: {
-    double b = AS_NUMBER(stack_pop(stack));
-    double a = AS_NUMBER(stack_pop(stack));
-    stack_push(stack, NUMBER_VAL(fmod(a, b)));
+    Value b = stack_pop(stack);
+    Value a = stack_pop(stack);
+    stack_push(stack, NUMBER_VAL(fmod(AS_DOUBLE(a), AS_DOUBLE(b))));
     break;
   }
   case OP_GREATER:
-    if (IS_STRING(*stack_peek(stack, 0)) && IS_STRING(*stack_peek(stack, 0))) {
-      ObjString *b = AS_STRING(stack_pop(stack));
-      ObjString *a = AS_STRING(stack_pop(stack));
-      stack_push(stack, BOOL_VAL((a->length > b->length)));
+    if (is_string_value(*stack_peek(stack, 0))) {
+      int b = string_value_length(stack_pop(stack));
+      int a = string_value_length(stack_pop(stack));
+      stack_push(stack, BOOL_VAL((a > b)));
+    } else if (IS_INT(*stack_peek(stack, 0)) != IS_INT(*stack_peek(stack, 1))) {
+      Value b = stack_pop(stack);
+      Value a = stack_pop(stack);
+      stack_push(stack, BOOL_VAL(compare_numbers(a, b) == 1));
     } else {
       BINARY_OP(BOOL_VAL, >);
     }
     break;
   case OP_LESS:
-    if (IS_STRING(*stack_peek(stack, 0)) && IS_STRING(*stack_peek(stack, 0))) {
-      ObjString *b = AS_STRING(stack_pop(stack));
-      ObjString *a = AS_STRING(stack_pop(stack));
-      stack_push(stack, BOOL_VAL((a->length < b->length)));
+    if (is_string_value(*stack_peek(stack, 0))) {
+      int b = string_value_length(stack_pop(stack));
+      int a = string_value_length(stack_pop(stack));
+      stack_push(stack, BOOL_VAL((a < b)));
+    } else if (IS_INT(*stack_peek(stack, 0)) != IS_INT(*stack_peek(stack, 1))) {
+      Value b = stack_pop(stack);
+      Value a = stack_pop(stack);
+      stack_push(stack, BOOL_VAL(compare_numbers(a, b) == -1));
     } else {
       BINARY_OP(BOOL_VAL, <);
     }
@@ -126,12 +255,17 @@ bool binary_operation(Obj *objects, Stack *stack, OpCode op_code) {
 #undef BINARY_OP
 }
 
-int get_current_instruction_index(VM *vm) {
-  return (int)(vm->ip - vm->chunk->byte_code);
+int get_current_instruction_index(VM *vm, Task *task) {
+  return (int)(task->ip - task->chunk->byte_code);
 }
 
-void log_vm_error(VM *vm, const char *message) {
-  log_error(get_line(vm->chunk, get_current_instruction_index(vm)), message);
+void log_vm_error(VM *vm, Task *task, const char *message) {
+  // the error goes after everything printed so far
+  lock_output(vm);
+  flush_output(&vm->output);
+  unlock_output(vm);
+  log_error(get_line(task->chunk, get_current_instruction_index(vm, task)),
+            message);
 }
 
 bool values_equal(Value a, Value b) {
@@ -144,12 +278,14 @@ bool values_equal(Value a, Value b) {
     return true;
   case VAL_NUMBER:
     return AS_NUMBER(a) == AS_NUMBER(b);
+  case VAL_INT:
+    return AS_INT(a) == AS_INT(b);
   default:
     return false;
   }
 }
 
-bool is_same_type_values_equal(Value a, Value b) {
+bool is_same_type_values_equal(VM *vm, Value a, Value b) {
   switch (a.type) {
   case VAL_BOOL:
     return AS_BOOL(a) == AS_BOOL(b);
@@ -157,18 +293,105 @@ bool is_same_type_values_equal(Value a, Value b) {
     return true;
   case VAL_NUMBER:
     return AS_NUMBER(a) == AS_NUMBER(b);
-  case VAL_OBJ: {
-    ObjString *a_string = AS_STRING(a);
-    ObjString *b_string = AS_STRING(b);
-    return a_string->length == b_string->length &&
-           memcmp(a_string->chars, b_string->chars, a_string->length) == 0;
-  }
+  case VAL_INT:
+    return AS_INT(a) == AS_INT(b);
+  case VAL_OBJ:
+    if (AS_OBJ(a) == AS_OBJ(b))
+      return true;
+    if (!is_string_value(a) || !is_string_value(b) ||
+        string_value_length(a) != string_value_length(b))
+      return false;
+    // strings are interned so equal strings are the same object once any
+    // ropes have been flattened, only views need their characters compared
+    ObjString *left = flatten_string(vm, a);
+    ObjString *right = flatten_string(vm, b);
+    if (left == right)
+      return true;
+    if (left->owner == NULL && right->owner == NULL)
+      return false;
+    return memcmp(left->chars, right->chars, left->length) == 0;
   default:
     return false;
   }
 }
 
-InterpretResponse run(VM *vm) {
+// seeds a new task's stack with the first local_count locals of its parent.
+// A coroutine created in a local's initializer counts that local before its
+// slot exists, it gets nil (the body cannot read it anyway)
+void copy_locals(Task *parent, Task *child, uint8_t local_count) {
+  Value *locals = parent->stack.values + parent->base;
+  for (size_t i = 0; i < local_count; i++) {
+    Value value =
+        parent->base + i < parent->stack.count ? locals[i] : NIL_VAL;
+    stack_push(&child->stack, value);
+  }
+}
+
+static void lock_globals(VM *vm, bool write) {
+  if (vm->scheduler == NULL)
+    return;
+  if (write) {
+    pthread_rwlock_wrlock(&vm->globals_lock);
+  } else {
+    pthread_rwlock_rdlock(&vm->globals_lock);
+  }
+}
+
+static void unlock_globals(VM *vm) {
+  if (vm->scheduler != NULL)
+    pthread_rwlock_unlock(&vm->globals_lock);
+}
+
+// folds each chunk's reduction results, in chunk order, into the variables
+// named in the loop's reduce clause
+static bool merge_parallel_results(VM *vm, Task *task, ParallelLoop *loop) {
+  for (int r = 0; r < loop->reduction_count; r++) {
+    uint8_t *reduction = &loop->reductions[r * 3];
+    bool is_local = reduction[1];
+    uint8_t index = reduction[2];
+    ObjString *name = NULL;
+    Value value;
+    if (is_local) {
+      value = task->stack.values[task->base + index];
+    } else {
+      name = AS_STRING(task->chunk->constants.values[index]);
+      lock_globals(vm, false);
+      bool found = get_entry(&vm->globals, name, &value);
+      unlock_globals(vm);
+      if (!found) {
+        log_vm_error(vm, task, "Variable not found\n");
+        return false;
+      }
+    }
+
+    for (size_t i = 0; i < loop->chunk_count; i++) {
+      stack_push(&task->stack, value);
+      stack_push(&task->stack,
+                 loop->partials[i * loop->reduction_count + r]);
+      if (!binary_operation(vm, &task->stack, reduction[0])) {
+        log_vm_error(vm, task, "Failed to perform arithmetic operation\n");
+        return false;
+      }
+      value = stack_pop(&task->stack);
+    }
+
+    if (is_local) {
+      task->stack.values[task->base + index] = value;
+    } else {
+      lock_globals(vm, true);
+      insert_entry(&vm->globals, name, value);
+      unlock_globals(vm);
+    }
+  }
+  return true;
+}
+
+// the interpreter loop behind run. count and sample are constants in each of
+// its copies, the one run without --opcode-stats or --profile has no trace of
+// the counting or sampling
+static inline __attribute__((always_inline)) InterpretResponse
+execute(VM *vm, Task *root, bool count, bool sample) {
+  Task *task = root->active != NULL ? root->active : root;
 // #define VM_DEBUG
 #define UNARY_OP(value_type, op)                                               \
   do {                                                                         \
@@ -177,100 +400,161 @@ InterpretResponse run(VM *vm) {
     stack_push(stack, value_type(a op b));                                     \
   } while (false)
 
+  OpcodeTrace trace;
+  if (count)
+    init_opcode_trace(&trace);
+
   uint8_t instruction;
   for (;;) {
 #ifdef VM_DEBUG
     printf("Stack: ");
-    print_stack(&vm->stack);
-    dissasemble_instruction(vm->chunk, get_current_instruction_index(vm));
+    print_stack(&task->stack);
+    dissasemble_instruction(task->chunk,
+                            get_current_instruction_index(vm, task));
     printf("\n");
 #endif
-    instruction = read_byte(vm);
+    if (count)
+      count_instruction(vm, &trace, task->chunk, task->ip);
+    if (sample)
+      check_profile(vm, task);
+    instruction = read_byte(task);
     switch (instruction) {
     case OP_RETURN: {
-      return INTERPRET_OK;
+      if (task->frame_count > 0) {
+        // the result replaces the callee, its arguments and its locals
+        Value result = stack_pop(&task->stack);
+        task->stack.count = task->base - 1;
+        task->stack.values[task->stack.count++] = result;
+        CallFrame *frame = &task->frames[--task->frame_count];
+        task->chunk = frame->chunk;
+        task->ip = frame->ip;
+        task->base = frame->base;
+        break;
+      }
+      Task *caller = task->caller;
+      if (caller == NULL) {
+        if (task->loop != NULL)
+          store_parallel_partials(task);
+        return INTERPRET_OK;
+      }
+      // a coroutine ran off the end of its body, its stack is no longer needed
+      task->ip = NULL;
+      free_task_stacks(task);
+      __atomic_store_n(&task->caller, NULL, __ATOMIC_RELEASE);
+      stack_push(&caller->stack, NIL_VAL);
+      task = caller;
+      root->active = task == root ? NULL : task;
+      break;
     }
     case OP_PRINT: {
-      if (is_stack_empty(&vm->stack)) {
-        log_vm_error(vm, "Nothing to print\n");
+      if (is_stack_empty(&task->stack)) {
+        log_vm_error(vm, task, "Nothing to print\n");
         return RUNTIME_ERROR;
       }
-      print_value(*stack_peek(&vm->stack, 0));
-      printf("\n");
+      Value value = stack_pop(&task->stack);
+      if (IS_ROPE(value)) {
+        value = OBJ_VAL(flatten_string(vm, value));
+      }
+      lock_output(vm);
+      output_line(&vm->output, value);
+      unlock_output(vm);
       break;
     }
     case OP_CONSTANT: {
-      stack_push(&vm->stack, (vm->chunk->constants.values[read_byte(vm)]));
+      stack_push(&task->stack, read_constant(task));
       break;
     }
     case OP_NIL:
-      stack_push(&vm->stack, NIL_VAL);
+      stack_push(&task->stack, NIL_VAL);
       break;
     case OP_FALSE:
-      stack_push(&vm->stack, BOOL_VAL(false));
+      stack_push(&task->stack, BOOL_VAL(false));
       break;
     case OP_TRUE:
-      stack_push(&vm->stack, BOOL_VAL(true));
+      stack_push(&task->stack, BOOL_VAL(true));
       break;
     case OP_NEGATE: {
-      if (!IS_NUMBER(*stack_peek(&vm->stack, 0))) {
-        log_vm_error(vm, "negation operand must be a number\n");
+      Value value = stack_pop(&task->stack);
+      if (IS_INT(value) && AS_INT(value) != INT64_MIN) {
+        stack_push(&task->stack, INT_VAL(-AS_INT(value)));
+      } else if (IS_NUMERIC(value)) {
+        stack_push(&task->stack, NUMBER_VAL(-AS_DOUBLE(value)));
+      } else {
+        log_vm_error(vm, task, "negation operand must be a number\n");
         return RUNTIME_ERROR;
       }
-      stack_push(&vm->stack, NUMBER_VAL(-AS_NUMBER(stack_pop(&vm->stack))));
       break;
     }
     case OP_POP: {
-      stack_pop(&vm->stack);
+      stack_pop(&task->stack);
       break;
     }
     case OP_NOT: {
-      if (!IS_BOOL(*stack_peek(&vm->stack, 0)) &&
-          !IS_NIL(*stack_peek(&vm->stack, 0)) &&
-          !IS_NUMBER(*stack_peek(&vm->stack, 0))) {
-        log_vm_error(vm, "not operand must be a boolean or nil value\n");
+      if (!IS_BOOL(*stack_peek(&task->stack, 0)) &&
+          !IS_NIL(*stack_peek(&task->stack, 0)) &&
+          !IS_NUMERIC(*stack_peek(&task->stack, 0))) {
+        log_vm_error(vm, task, "not operand must be a boolean or nil value\n");
         return RUNTIME_ERROR;
       }
 
-      Value value = stack_pop(&vm->stack);
+      Value value = stack_pop(&task->stack);
       bool result = (!AS_BOOL(value) && IS_BOOL(value) || IS_NIL(value)) ||
-                    (!AS_NUMBER(value) && IS_NUMBER(value));
-      stack_push(&vm->stack, BOOL_VAL(result));
+                    (!AS_DOUBLE(value) && IS_NUMERIC(value));
+      stack_push(&task->stack, BOOL_VAL(result));
       break;
     }
     case OP_DEFINE_GLOBAL: {
-      ObjString *name = AS_STRING(vm->chunk->constants.values[read_byte(vm)]);
-      insert_entry(&vm->globals, name, *stack_peek(&vm->stack, 0));
-      stack_pop(&vm->stack);
+      ObjString *name = AS_STRING(read_constant(task));
+      lock_globals(vm, true);
+      insert_entry(&vm->globals, name, *stack_peek(&task->stack, 0));
+      unlock_globals(vm);
+      stack_pop(&task->stack);
       break;
     }
     case OP_GET_GLOBAL: {
-      ObjString *name = AS_STRING(vm->chunk->constants.values[read_byte(vm)]);
+      ObjString *name = AS_STRING(read_constant(task));
       Value value;
-      if (!get_entry(&vm->globals, name, &value)) {
-        log_vm_error(vm, "Variable not found\n");
+      lock_globals(vm, false);
+      bool found = get_entry(&vm->globals, name, &value);
+      unlock_globals(vm);
+      if (!found) {
+        log_vm_error(vm, task, "Variable not found\n");
         return RUNTIME_ERROR;
       }
-      stack_push(&vm->stack, value);
+      stack_push(&task->stack, value);
       break;
     }
     case OP_SET_GLOBAL: {
-      ObjString *name = AS_STRING(vm->chunk->constants.values[read_byte(vm)]);
-      if (insert_entry(&vm->globals, name, *stack_peek(&vm->stack, 0))) {
-        log_vm_error(vm, "Undeclared variable\n");
+      ObjString *name = AS_STRING(read_constant(task));
+      // the parser rejects these in a loop body, this catches the functions
+      // and coroutines it calls
+      if (root->loop != NULL) {
+        log_vm_error(vm, task,
+                     "cannot assign to a global inside a parallel loop\n");
+        return RUNTIME_ERROR;
+      }
+      lock_globals(vm, true);
+      bool is_new =
+          insert_entry(&vm->globals, name, *stack_peek(&task->stack, 0));
+      unlock_globals(vm);
+      if (is_new) {
+        log_vm_error(vm, task, "Undeclared variable\n");
         return RUNTIME_ERROR;
       }
       break;
     }
     case OP_EQUAL: {
-      Value b = stack_pop(&vm->stack);
-      Value a = stack_pop(&vm->stack);
+      Value b = stack_pop(&task->stack);
+      Value a = stack_pop(&task->stack);
       if (a.type != b.type && (IS_NIL(a) || IS_NIL(b))) {
-        stack_push(&vm->stack, BOOL_VAL(IS_NIL(a) && IS_NIL(b)));
+        stack_push(&task->stack, BOOL_VAL(IS_NIL(a) && IS_NIL(b)));
       } else if (a.type == b.type) {
-        stack_push(&vm->stack, BOOL_VAL(is_same_type_values_equal(a, b)));
+        stack_push(&task->stack, BOOL_VAL(is_same_type_values_equal(vm, a, b)));
+      } else if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+        // exactly, as dictionary keys do: 2^53 + 1 is not 2^53 as a double
+        stack_push(&task->stack, BOOL_VAL(compare_numbers(a, b) == 0));
       } else {
-        log_vm_error(vm, "Cannot compare values of different types\n");
+        log_vm_error(vm, task, "Cannot compare values of different types\n");
         return RUNTIME_ERROR;
       }
       break;
@@ -282,31 +566,316 @@ InterpretResponse run(VM *vm) {
     case OP_DIVIDE:
     case OP_MOD:
     case OP_MULTIPLY:
-      if (!binary_operation(vm->objects, &vm->stack, instruction)) {
-        log_vm_error(vm, "Failed to perform arithmetic operation\n");
+      if (!binary_operation(vm, &task->stack, instruction)) {
+        log_vm_error(vm, task, "Failed to perform arithmetic operation\n");
         return RUNTIME_ERROR;
       }
       break;
     case OP_JUMP_IF_FALSE: {
-      uint16_t jump = read_short(vm);
-      if (!IS_BOOL(*stack_peek(&vm->stack, 0))) {
-        log_vm_error(vm,
+      uint16_t jump = read_short(task);
+      if (!IS_BOOL(*stack_peek(&task->stack, 0))) {
+        log_vm_error(vm, task,
                      "expected branch expression to evaaluate to boolean\n");
         return RUNTIME_ERROR;
       }
-      if (!AS_BOOL(*stack_peek(&vm->stack, 0))) {
-        vm->ip += jump;
+      if (!AS_BOOL(*stack_peek(&task->stack, 0))) {
+        task->ip += jump;
       }
       break;
     }
     case OP_JUMP: {
-      uint16_t jump = read_short(vm);
-      vm->ip += jump;
+      uint16_t jump = read_short(task);
+      task->ip += jump;
       break;
     }
     case OP_LOOP: {
-      uint16_t jump = read_short(vm);
-      vm->ip -= jump;
+      uint16_t jump = read_short(task);
+      task->ip -= jump;
+      if (root->budget > 0 && --root->budget == 0) {
+        root->budget = vm->task_yield_interval;
+        return INTERPRET_YIELD;
+      }
+      break;
+    }
+    case OP_GET_LOCAL: {
+      uint8_t slot = read_byte(task);
+      stack_push(&task->stack, task->stack.values[task->base + slot]);
+      break;
+    }
+    case OP_SET_LOCAL: {
+      uint8_t slot = read_byte(task);
+      task->stack.values[task->base + slot] = *stack_peek(&task->stack, 0);
+      break;
+    }
+    case OP_SPAWN: {
+      uint16_t jump = read_short(task);
+      uint8_t local_count = read_byte(task);
+      Task *child =
+          create_task(task->chunk, task->ip, vm->task_yield_interval);
+      copy_locals(task, child, local_count);
+      if (vm->scheduler == NULL) {
+        vm->scheduler = create_scheduler(vm, vm->worker_count);
+      }
+      schedule_task(vm->scheduler, child);
+      task->ip += jump;
+      break;
+    }
+    case OP_COROUTINE: {
+      uint16_t jump = read_short(task);
+      uint8_t local_count = read_byte(task);
+      ObjCoroutine *coroutine = new_coroutine(vm, task->chunk, task->ip);
+      copy_locals(task, &coroutine->task, local_count);
+      stack_push(&task->stack, OBJ_VAL(coroutine));
+      task->ip += jump;
+      break;
+    }
+    case OP_RESUME: {
+      Value value = stack_pop(&task->stack);
+      if (!IS_COROUTINE(value)) {
+        log_vm_error(vm, task, "can only resume a coroutine\n");
+        return RUNTIME_ERROR;
+      }
+      // claiming the coroutine also stops two tasks resuming it at once
+      Task *coroutine = &AS_COROUTINE(value)->task;
+      Task *expected = NULL;
+      if (!__atomic_compare_exchange_n(&coroutine->caller, &expected, task,
+                                       false, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED)) {
+        log_vm_error(vm, task, "coroutine is already running\n");
+        return RUNTIME_ERROR;
+      }
+      if (coroutine->ip == NULL) {
+        __atomic_store_n(&coroutine->caller, NULL, __ATOMIC_RELEASE);
+        stack_push(&task->stack, NIL_VAL);
+        break;
+      }
+      task = coroutine;
+      root->active = task;
+      break;
+    }
+    case OP_YIELD: {
+      Task *caller = task->caller;
+      if (caller == NULL) {
+        log_vm_error(vm, task, "yield outside of a coroutine\n");
+        return RUNTIME_ERROR;
+      }
+      stack_push(&caller->stack, stack_pop(&task->stack));
+      __atomic_store_n(&task->caller, NULL, __ATOMIC_RELEASE);
+      task = caller;
+      root->active = task == root ? NULL : task;
+      break;
+    }
+    case OP_PARALLEL: {
+      uint16_t jump = read_short(task);
+      uint8_t local_count = read_byte(task);
+      uint8_t reduction_count = read_byte(task);
+      uint8_t *reductions = task->ip;
+      task->ip += reduction_count * 3;
+      Value end = stack_pop(&task->stack);
+      Value start = stack_pop(&task->stack);
+      if (!IS_NUMERIC(start) || !IS_NUMERIC(end)) {
+        log_vm_error(vm, task, "parallel loop bounds must be numbers\n");
+        return RUNTIME_ERROR;
+      }
+      if (!parallel_bounds_valid(AS_DOUBLE(start), AS_DOUBLE(end))) {
+        log_vm_error(vm, task,
+                     "parallel loop bounds must be finite and less than 2^64 "
+                     "apart\n");
+        return RUNTIME_ERROR;
+      }
+      task->joining =
+          start_parallel_loop(vm, task, AS_DOUBLE(start), AS_DOUBLE(end),
+                              local_count, reduction_count, reductions);
+      task->ip += jump;
+      break;
+    }
+    case OP_PARALLEL_JOIN: {
+      ParallelLoop *loop = task->joining;
+      if (!is_parallel_loop_done(loop)) {
+        // a spawned task lets its worker run the chunks meanwhile
+        if (root->budget > 0) {
+          task->ip--;
+          return INTERPRET_YIELD;
+        }
+        wait_for_parallel_loop(loop);
+      }
+      task->joining = NULL;
+      bool merged = !loop->failed && merge_parallel_results(vm, task, loop);
+      free_parallel_loop(loop);
+      if (!merged)
+        return RUNTIME_ERROR;
+      break;
+    }
+    case OP_ARRAY: {
+      uint8_t count = read_byte(task);
+      ObjArray *array = new_array(vm, count);
+      for (int i = count - 1; i >= 0; i--) {
+        Value value = stack_pop(&task->stack);
+        if (!IS_NUMERIC(value)) {
+          log_vm_error(vm, task, "arrays can only hold numbers\n");
+          return RUNTIME_ERROR;
+        }
+        array->values[i] = AS_DOUBLE(value);
+      }
+      array->count = count;
+      stack_push(&task->stack, OBJ_VAL(array));
+      break;
+    }
+    case OP_DICT: {
+      uint8_t count = read_byte(task);
+      ObjDict *dict = new_dict(vm);
+      // entries are inserted left to right so a repeated key keeps its last
+      // value
+      for (int i = count - 1; i >= 0; i--) {
+        Value key;
+        if (!dict_key(vm, task, *stack_peek(&task->stack, i * 2 + 1), &key))
+          return RUNTIME_ERROR;
+        insert_value_entry(&dict->table, key,
+                           dict_value(vm, *stack_peek(&task->stack, i * 2)));
+      }
+      for (int i = 0; i < count * 2; i++)
+        stack_pop(&task->stack);
+      stack_push(&task->stack, OBJ_VAL(dict));
+      break;
+    }
+    case OP_FORMAT: {
+      uint8_t count = read_byte(task);
+      Value result =
+          format_values(vm, stack_peek(&task->stack, count - 1), count);
+      for (int i = 0; i < count; i++)
+        stack_pop(&task->stack);
+      stack_push(&task->stack, result);
+      break;
+    }
+    case OP_GET_INDEX:
+    case OP_SET_INDEX: {
+      Value value = NIL_VAL;
+      if (instruction == OP_SET_INDEX)
+        value = stack_pop(&task->stack);
+      Value index = stack_pop(&task->stack);
+      Value target = stack_pop(&task->stack);
+      if (IS_DICT(target)) {
+        Value key;
+        if (!dict_key(vm, task, index, &key))
+          return RUNTIME_ERROR;
+        ObjDict *dict = AS_DICT(target);
+        if (instruction == OP_SET_INDEX) {
+          value = dict_value(vm, value);
+          lock_dict(vm, dict, true);
+          insert_value_entry(&dict->table, key, value);
+        } else {
+          lock_dict(vm, dict, false);
+          // a missing key reads as nil
+          if (!get_value_entry(&dict->table, key, &value))
+            value = NIL_VAL;
+        }
+        unlock_dict(vm, dict);
+        stack_push(&task->stack, value);
+        break;
+      }
+      if (!IS_ARRAY(target)) {
+        log_vm_error(vm, task, "can only index arrays and dictionaries\n");
+        return RUNTIME_ERROR;
+      }
+      if (instruction == OP_SET_INDEX && !IS_NUMERIC(value)) {
+        log_vm_error(vm, task, "arrays can only hold numbers\n");
+        return RUNTIME_ERROR;
+      }
+      ObjArray *array = AS_ARRAY(target);
+      lock_array(vm, array, false);
+      if (!IS_NUMERIC(index) || AS_DOUBLE(index) < 0 ||
+          AS_DOUBLE(index) >= (double)array->count ||
+          AS_DOUBLE(index) != floor(AS_DOUBLE(index))) {
+        unlock_array(vm, array);
+        log_vm_error(vm, task, "array index out of range\n");
+        return RUNTIME_ERROR;
+      }
+      size_t slot = (size_t)AS_DOUBLE(index);
+      if (instruction == OP_SET_INDEX) {
+        array->values[slot] = AS_DOUBLE(value);
+      } else {
+        value = NUMBER_VAL(array->values[slot]);
+      }
+      unlock_array(vm, array);
+      stack_push(&task->stack, value);
+      break;
+    }
+    case OP_CALL:
+    case OP_TAIL_CALL: {
+      uint8_t arg_count = read_byte(task);
+      Value callee = *stack_peek(&task->stack, arg_count);
+      if (IS_FUNCTION(callee)) {
+        ObjFunction *function = AS_FUNCTION(callee);
+        if (function->arity != arg_count) {
+          log_vm_error(vm, task, "wrong number of arguments\n");
+          return RUNTIME_ERROR;
+        }
+        if (instruction == OP_TAIL_CALL) {
+          // the callee and its arguments move down over the returning
+          // function's window and the frame is reused, so a loop written as
+          // recursion runs in constant space
+          memmove(task->stack.values + task->base - 1,
+                  stack_peek(&task->stack, arg_count),
+                  (arg_count + 1) * sizeof(Value));
+          task->stack.count = task->base + arg_count;
+        } else {
+          if (task->frame_count == MAX_CALL_DEPTH) {
+            log_vm_error(vm, task, "stack overflow\n");
+            return RUNTIME_ERROR;
+          }
+          if (task->frame_count == task->frame_capacity)
+            grow_frames(task);
+          task->frames[task->frame_count++] =
+              (CallFrame){task->chunk, task->ip, task->base};
+          task->base = task->stack.count - arg_count;
+        }
+        task->chunk = &function->chunk;
+        task->ip = function->chunk.byte_code;
+        // a call counts like a back-edge, recursion cannot starve other tasks
+        if (root->budget > 0 && --root->budget == 0) {
+          root->budget = vm->task_yield_interval;
+          return INTERPRET_YIELD;
+        }
+        break;
+      }
+      // a native in tail position is called like any other, the OP_RETURN
+      // after the call returns its result
+      if (!IS_NATIVE(callee)) {
+        log_vm_error(vm, task, "can only call functions\n");
+        return RUNTIME_ERROR;
+      }
+      ObjNative *native = AS_NATIVE(callee);
+      if (native->arity != arg_count) {
+        log_vm_error(vm, task, "wrong number of arguments\n");
+        return RUNTIME_ERROR;
+      }
+
+      Value *args = task->stack.values + task->stack.count - arg_count;
+      Value result;
+      NativeResult outcome =
+          native->function(vm, task, arg_count, args, &result);
+      if (outcome == NATIVE_ERROR)
+        return RUNTIME_ERROR;
+      if (outcome == NATIVE_BLOCKED) {
+        // retry the call later, a spawned task gives its worker to another
+        // task, the main task (which nothing can preempt) spins politely
+        task->ip -= 2;
+        if (root->budget > 0)
+          return INTERPRET_YIELD;
+        sched_yield();
+        break;
+      }
+      if (outcome == NATIVE_SUSPENDED) {
+        // the call is repeated once the I/O completes. A spawned task is
+        // parked by its worker, the main task waits for the result here
+        task->ip -= 2;
+        if (root->budget > 0)
+          return INTERPRET_SUSPENDED;
+        submit_io_and_wait(get_event_loop(vm), task->io);
+        break;
+      }
+      task->stack.count -= arg_count + 1;
+      stack_push(&task->stack, result);
       break;
     }
     default: {
@@ -317,11 +886,104 @@ InterpretResponse run(VM *vm) {
   }
 }
 
+// runs root until it returns or fails. A spawned task also stops when it uses
+// up its budget of loop back-edges or blocks, in which case INTERPRET_YIELD is
+// returned and the task can be resumed by calling run again
+InterpretResponse run(VM *vm, Task *root) {
+  bool count = vm->opcode_stats != NULL;
+  if (vm->profile != NULL)
+    return count ? execute(vm, root, true, true)
+                 : execute(vm, root, false, true);
+  if (count)
+    return execute(vm, root, true, false);
+  return execute(vm, root, false, false);
+}
+
+static bool is_chunk_constant(Chunk *chunk, Obj *object) {
+  for (size_t i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (IS_OBJ(constant) && AS_OBJ(constant) == object)
+      return true;
+    if (IS_FUNCTION(constant) &&
+        is_chunk_constant(&AS_FUNCTION(constant)->chunk, object))
+      return true;
+  }
+  return false;
+}
+
+// hands the objects in the constant pool, and in those of the functions in
+// it, over to the chunk so it no longer depends on the vm that compiled it.
+// The vm's string table still points at them, so the chunk must be freed
+// after that vm
+void freeze_chunk(Chunk *chunk, VM *vm) {
+  Obj **link = &vm->objects;
+  while (*link != NULL) {
+    Obj *object = *link;
+    if (is_chunk_constant(chunk, object)) {
+      *link = object->next;
+      object->next = chunk->objects;
+      chunk->objects = object;
+    } else {
+      link = &object->next;
+    }
+  }
+  chunk->frozen = true;
+}
+
+// a vm running a frozen chunk it did not compile has to intern the chunk's
+// strings itself, so strings it creates at runtime (or globals defined from C
+// before the chunk runs) resolve to the same objects
+static void intern_constants(VM *vm, Chunk *chunk) {
+  for (size_t i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (IS_STRING(constant)) {
+      insert_entry(&vm->strings, AS_STRING(constant), NIL_VAL);
+    } else if (IS_FUNCTION(constant)) {
+      intern_constants(vm, &AS_FUNCTION(constant)->chunk);
+    }
+  }
+}
+
+void intern_chunk_strings(VM *vm, Chunk *chunk) {
+  if (chunk->frozen)
+    intern_constants(vm, chunk);
+}
+
+void define_global(VM *vm, const char *name, Value value) {
+  ObjString *key = copy_string(vm, name, strlen(name));
+  insert_entry(&vm->globals, key, value);
+}
+
 InterpretResponse interpret(VM *vm, Chunk *chunk) {
   if (!chunk->byte_code) {
     return RUNTIME_ERROR;
   }
+  intern_chunk_strings(vm, chunk);
+  if (!vm->natives_defined) {
+    define_natives(vm);
+    vm->natives_defined = true;
+  }
   vm->chunk = chunk;
-  vm->ip = chunk->byte_code;
-  return run(vm);
+  vm->had_task_error = false;
+  Task *main_task = create_task(chunk, chunk->byte_code, 0);
+  InterpretResponse response = run(vm, main_task);
+  free_task(main_task);
+
+  // the program finishes when every task it spawned has
+  if (vm->scheduler != NULL)
+    wait_for_tasks(vm->scheduler);
+  // stopped before the scheduler, the loop thread may still be returning
+  // from rescheduling the last task
+  if (vm->event_loop != NULL) {
+    free_event_loop(vm->event_loop);
+    vm->event_loop = NULL;
+  }
+  if (vm->scheduler != NULL) {
+    free_scheduler(vm->scheduler);
+    vm->scheduler = NULL;
+  }
+  flush_output(&vm->output);
+  if (response == INTERPRET_OK && vm->had_task_error)
+    response = RUNTIME_ERROR;
+  return response;
 }
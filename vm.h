@@ -2,26 +2,144 @@
 #include "chunk.h"
 
 #include "hash_map.h"
+#include "output.h"
 #include "stack.h"
+#include <pthread.h>
 
+// A green thread: its own value stack, call frames and ip. The main program
+// runs as a task too, spawn statements create the others
+typedef struct Task Task;
+typedef struct ParallelLoop ParallelLoop;
+typedef struct IoRequest IoRequest;
+
+// where a task carries on once the function it called returns
 typedef struct {
   Chunk *chunk;
   uint8_t *ip;
+  size_t base;
+} CallFrame;
+
+// calls nested deeper than this in one task fail with a stack overflow, calls
+// in tail position do not nest
+#define MAX_CALL_DEPTH 100000
+
+struct Task {
+  uint8_t *ip;
+  // the chunk ip points into, the program's or the running function's
+  Chunk *chunk;
+  // stack slot of the running function's first argument, its locals are
+  // numbered from here. 0 outside of functions
+  size_t base;
   Stack stack;
+  // the calls the running function is nested in, innermost last. The array
+  // only grows, so a call does not allocate once it is deep enough
+  CallFrame *frames;
+  int frame_count;
+  int frame_capacity;
+  // OP_LOOP back-edges and function calls left before the task yields, 0
+  // never yields
+  int budget;
+  Task *next;
+  // while a coroutine's task runs, the task that resumed it
+  Task *caller;
+  // the innermost coroutine this task is running, NULL when it runs itself.
+  // Lets a task that yields or blocks inside a coroutine pick up there
+  Task *active;
+  // the parallel loop this task is waiting on
+  ParallelLoop *joining;
+  // for a chunk of a parallel loop, the loop and the chunk's index
+  ParallelLoop *loop;
+  size_t chunk_index;
+  // the read or write this task is parked on, kept until the repeated native
+  // call takes the result
+  IoRequest *io;
+};
+
+typedef struct Scheduler Scheduler;
+typedef struct EventLoop EventLoop;
+typedef struct OpcodeStats OpcodeStats;
+typedef struct Profile Profile;
+
+typedef enum {
+  IO_BACKEND_URING,
+  // also used when io_uring is not available
+  IO_BACKEND_EPOLL,
+} IoBackend;
+
+typedef struct {
+  Chunk *chunk;
   Obj *objects;
   Table strings;
   Table globals;
+  // started by the first spawn, NULL while the program is single threaded
+  Scheduler *scheduler;
+  // worker threads for spawned tasks, 0 uses one per online core
+  size_t worker_count;
+  // back-edges a spawned task runs before yielding to the next one
+  int task_yield_interval;
+  // started by the first read or write, NULL until then
+  EventLoop *event_loop;
+  IoBackend io_backend;
+  // where print statements go, flushed when the program ends
+  OutputBuffer output;
+  bool had_task_error;
+  // builtins are defined on first interpret (or by tl_create_vm), after the
+  // chunk's strings are interned so the names resolve to the chunk's
+  // constants
+  bool natives_defined;
+  // counts every instruction run when set (--opcode-stats), see
+  // opcode_stats.h
+  OpcodeStats *opcode_stats;
+  // samples the running line on SIGPROF when set (--profile), see profiler.h
+  Profile *profile;
+  // only taken while a scheduler is running
+  pthread_mutex_t heap_lock;
+  pthread_rwlock_t globals_lock;
 } VM;
 
 typedef enum {
   INTERPRET_OK,
   RUNTIME_ERROR,
   COMPILE_ERROR,
+  INTERPRET_YIELD,
+  // the task is parked on I/O, see Task.io
+  INTERPRET_SUSPENDED,
 } InterpretResponse;
 
+#define DEFAULT_TASK_YIELD_INTERVAL 1024
+
+// guards vm->objects and vm->strings once tasks run on several threads
+static inline void lock_heap(VM *vm) {
+  if (vm->scheduler != NULL)
+    pthread_mutex_lock(&vm->heap_lock);
+}
+
+static inline void unlock_heap(VM *vm) {
+  if (vm->scheduler != NULL)
+    pthread_mutex_unlock(&vm->heap_lock);
+}
+
+// keeps a task's line together when several are printing
+static inline void lock_output(VM *vm) {
+  if (vm->scheduler != NULL)
+    pthread_mutex_lock(&vm->output.lock);
+}
+
+static inline void unlock_output(VM *vm) {
+  if (vm->scheduler != NULL)
+    pthread_mutex_unlock(&vm->output.lock);
+}
+
 void init_vm(VM *vm);
 void free_vm(VM *vm);
-static inline uint8_t read_byte(VM *vm);
-static void handle_instruction(VM *vm, uint8_t instruction);
-InterpretResponse run(VM *vm);
+void init_task(Task *task, Chunk *chunk, uint8_t *ip, int budget);
+Task *create_task(Chunk *chunk, uint8_t *ip, int budget);
+void free_task_stacks(Task *task);
+void free_task(Task *task);
+void copy_locals(Task *parent, Task *child, uint8_t local_count);
+void log_vm_error(VM *vm, Task *task, const char *message);
+InterpretResponse run(VM *vm, Task *root);
 InterpretResponse interpret(VM *vm, Chunk *chunk);
+void freeze_chunk(Chunk *chunk, VM *vm);
+void intern_chunk_strings(VM *vm, Chunk *chunk);
+void define_global(VM *vm, const char *name, Value value);